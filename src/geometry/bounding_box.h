@@ -0,0 +1,148 @@
+#pragma once
+
+#include <limits>
+#include <optional>
+#include <utility>
+
+#include <geometry/parameters.h>
+#include <geometry/vector.h>
+#include <geometry/ray.h>
+#include <geometry/sphere.h>
+#include <geometry/triangle.h>
+
+namespace geometry {
+template <typename VectorNumericType = DefaultNumericType>
+requires NumericTypeConstraint<VectorNumericType>
+class BoundingBox {
+public:
+    BoundingBox()
+        : min_({std::numeric_limits<VectorNumericType>::infinity(),
+                std::numeric_limits<VectorNumericType>::infinity(),
+                std::numeric_limits<VectorNumericType>::infinity()}),
+          max_({-std::numeric_limits<VectorNumericType>::infinity(),
+                -std::numeric_limits<VectorNumericType>::infinity(),
+                -std::numeric_limits<VectorNumericType>::infinity()}) {
+    }
+
+    BoundingBox(Vector3D<VectorNumericType> min, Vector3D<VectorNumericType> max)
+        : min_(min), max_(max) {
+    }
+
+public:
+    const Vector3D<VectorNumericType>& GetMin() const {
+        return min_;
+    }
+
+    const Vector3D<VectorNumericType>& GetMax() const {
+        return max_;
+    }
+
+    [[nodiscard]] bool Empty() const {
+        return min_[0] > max_[0] || min_[1] > max_[1] || min_[2] > max_[2];
+    }
+
+    void Extend(const Vector3D<VectorNumericType>& point) {
+        for (int i = 0; i < 3; ++i) {
+            min_[i] = std::min(min_[i], point[i]);
+            max_[i] = std::max(max_[i], point[i]);
+        }
+    }
+
+    void Extend(const BoundingBox<VectorNumericType>& box) {
+        for (int i = 0; i < 3; ++i) {
+            min_[i] = std::min(min_[i], box.min_[i]);
+            max_[i] = std::max(max_[i], box.max_[i]);
+        }
+    }
+
+    Vector3D<VectorNumericType> Center() const {
+        return (min_ + max_) / 2;
+    }
+
+    Vector3D<VectorNumericType> Extent() const {
+        return max_ - min_;
+    }
+
+    VectorNumericType SurfaceArea() const {
+        if (Empty()) {
+            return 0;
+        }
+        auto extent = Extent();
+        return 2 * (extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0]);
+    }
+
+    [[nodiscard]] int LongestAxis() const {
+        auto extent = Extent();
+        if (extent[0] >= extent[1] && extent[0] >= extent[2]) {
+            return 0;
+        }
+        return extent[1] >= extent[2] ? 1 : 2;
+    }
+
+private:
+    Vector3D<VectorNumericType> min_;
+    Vector3D<VectorNumericType> max_;
+};
+
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType> BoundingBox<VectorNumericType> GetBoundingBox(
+    const Triangle<VectorNumericType>& triangle) {
+    BoundingBox<VectorNumericType> box;
+    for (size_t i = 0; i < 3; ++i) {
+        box.Extend(triangle.GetVertex(i));
+    }
+    return box;
+}
+
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType> BoundingBox<VectorNumericType> GetBoundingBox(
+    const Sphere<VectorNumericType>& sphere) {
+    Vector3D<VectorNumericType> radius{sphere.GetRadius(), sphere.GetRadius(),
+                                       sphere.GetRadius()};
+    return {sphere.GetCenter() - radius, sphere.GetCenter() + radius};
+}
+
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType> Vector3D<VectorNumericType> GetInverseDirection(
+    const Ray<VectorNumericType>& ray) {
+    return Vector3D<VectorNumericType>{1 / ray.GetDirection()[0], 1 / ray.GetDirection()[1],
+                                       1 / ray.GetDirection()[2]};
+}
+
+// Slab test returning the parametric interval of the ray inside the box clipped to
+// [0, max_distance]. NaNs coming from a zero direction component on a box face fail every
+// comparison and therefore do not clip the interval.
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType>
+    std::optional<std::pair<VectorNumericType, VectorNumericType>> GetEntryExitDistances(
+        const Ray<VectorNumericType>& ray, const Vector3D<VectorNumericType>& inverse_direction,
+        const BoundingBox<VectorNumericType>& box, VectorNumericType max_distance) {
+    VectorNumericType near = 0;
+    VectorNumericType far = max_distance;
+    for (int i = 0; i < 3; ++i) {
+        VectorNumericType t_min = (box.GetMin()[i] - ray.GetOrigin()[i]) * inverse_direction[i];
+        VectorNumericType t_max = (box.GetMax()[i] - ray.GetOrigin()[i]) * inverse_direction[i];
+        if (t_min > t_max) {
+            std::swap(t_min, t_max);
+        }
+        t_max *= 1 + 4 * std::numeric_limits<VectorNumericType>::epsilon();
+        near = t_min > near ? t_min : near;
+        far = t_max < far ? t_max : far;
+        if (near > far) {
+            return {};
+        }
+    }
+    return std::pair{near, far};
+}
+
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType> std::optional<VectorNumericType> GetEntryDistance(
+    const Ray<VectorNumericType>& ray, const Vector3D<VectorNumericType>& inverse_direction,
+    const BoundingBox<VectorNumericType>& box, VectorNumericType max_distance) {
+    auto interval = GetEntryExitDistances(ray, inverse_direction, box, max_distance);
+    if (!interval) {
+        return {};
+    }
+    return interval->first;
+}
+}  // namespace geometry
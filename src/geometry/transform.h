@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include <geometry/parameters.h>
+#include <geometry/vector.h>
+#include <geometry/ray.h>
+#include <geometry/bounding_box.h>
+
+namespace geometry {
+// Affine transform: point -> linear * point + translation.
+template <typename VectorNumericType = DefaultNumericType>
+requires NumericTypeConstraint<VectorNumericType>
+class Transform {
+public:
+    Transform() : linear_({{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}}), translation_({0, 0, 0}) {
+    }
+
+    Transform(std::array<Vector3D<VectorNumericType>, 3> linear_rows,
+              Vector3D<VectorNumericType> translation)
+        : linear_(linear_rows), translation_(translation) {
+    }
+
+    // Row-major 3x4 matrix, the last column being the translation.
+    explicit Transform(const std::array<VectorNumericType, 12>& matrix) {
+        for (int row = 0; row < 3; ++row) {
+            linear_[row] = {matrix[row * 4], matrix[row * 4 + 1], matrix[row * 4 + 2]};
+            translation_[row] = matrix[row * 4 + 3];
+        }
+    }
+
+    static Transform Translation(const Vector3D<VectorNumericType>& offset) {
+        return {{{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}}, offset};
+    }
+
+public:
+    Vector3D<VectorNumericType> ApplyToPoint(const Vector3D<VectorNumericType>& point) const {
+        return ApplyToDirection(point) + translation_;
+    }
+
+    Vector3D<VectorNumericType> ApplyToDirection(
+        const Vector3D<VectorNumericType>& direction) const {
+        return Vector3D<VectorNumericType>{DotProduct(linear_[0], direction),
+                                           DotProduct(linear_[1], direction),
+                                           DotProduct(linear_[2], direction)};
+    }
+
+    // Normals transform with the inverse transpose; this must be called on the inverse transform.
+    Vector3D<VectorNumericType> ApplyTransposedToNormal(
+        const Vector3D<VectorNumericType>& normal) const {
+        Vector3D<VectorNumericType> result;
+        for (int row = 0; row < 3; ++row) {
+            result += linear_[row] * normal[row];
+        }
+        return result;
+    }
+
+    Ray<VectorNumericType> ApplyToRay(const Ray<VectorNumericType>& ray) const {
+        return {ApplyToPoint(ray.GetOrigin()), ApplyToDirection(ray.GetDirection())};
+    }
+
+    BoundingBox<VectorNumericType> ApplyToBox(const BoundingBox<VectorNumericType>& box) const {
+        BoundingBox<VectorNumericType> result;
+        if (box.Empty()) {
+            return result;
+        }
+        for (int corner = 0; corner < 8; ++corner) {
+            result.Extend(ApplyToPoint(Vector3D<VectorNumericType>{
+                (corner & 1) ? box.GetMax()[0] : box.GetMin()[0],
+                (corner & 2) ? box.GetMax()[1] : box.GetMin()[1],
+                (corner & 4) ? box.GetMax()[2] : box.GetMin()[2]}));
+        }
+        return result;
+    }
+
+    Transform Inverse() const {
+        const auto& m = linear_;
+        auto determinant = DotProduct(m[0], CrossProduct(m[1], m[2]));
+        if (std::fabs(determinant) < std::numeric_limits<VectorNumericType>::epsilon()) {
+            throw std::runtime_error("Transform is not invertible");
+        }
+        // Rows of the inverse are the columns of the adjugate.
+        std::array<Vector3D<VectorNumericType>, 3> columns = {
+            CrossProduct(m[1], m[2]), CrossProduct(m[2], m[0]), CrossProduct(m[0], m[1])};
+        std::array<Vector3D<VectorNumericType>, 3> inverse_rows;
+        for (int row = 0; row < 3; ++row) {
+            inverse_rows[row] = Vector3D<VectorNumericType>{columns[0][row], columns[1][row],
+                                                            columns[2][row]} /
+                                determinant;
+        }
+        Transform inverse(inverse_rows, {0, 0, 0});
+        inverse.translation_ = -inverse.ApplyToDirection(translation_);
+        return inverse;
+    }
+
+    [[nodiscard]] bool IsIdentity() const {
+        return linear_[0][0] == 1 && linear_[0][1] == 0 && linear_[0][2] == 0 &&
+               linear_[1][0] == 0 && linear_[1][1] == 1 && linear_[1][2] == 0 &&
+               linear_[2][0] == 0 && linear_[2][1] == 0 && linear_[2][2] == 1 &&
+               translation_.Zero();
+    }
+
+private:
+    std::array<Vector3D<VectorNumericType>, 3> linear_;
+    Vector3D<VectorNumericType> translation_;
+};
+
+template <typename VectorNumericType>
+requires NumericTypeConstraint<VectorNumericType> Transform<VectorNumericType>
+operator*(const Transform<VectorNumericType>& lhs, const Transform<VectorNumericType>& rhs) {
+    std::array<Vector3D<VectorNumericType>, 3> rows;
+    for (int row = 0; row < 3; ++row) {
+        auto lhs_row = lhs.ApplyTransposedToNormal(Vector3D<VectorNumericType>{
+            row == 0 ? 1.0 : 0.0, row == 1 ? 1.0 : 0.0, row == 2 ? 1.0 : 0.0});
+        rows[row] = rhs.ApplyTransposedToNormal(lhs_row);
+    }
+    return {rows, lhs.ApplyToPoint(rhs.ApplyToPoint({0, 0, 0}))};
+}
+}  // namespace geometry
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "geometry/geometry.h"
+#include "scene/accelerator.h"
+#include "scene/reader.cpp"
+#include "scene/skybox.h"
+#include "raytracer/camera_options.h"
+#include "raytracer/raycaster.h"
+#include "raytracer/raytracer.cpp"
+
+namespace raytracer {
+struct AcceleratorBenchmark {
+    scene::AcceleratorType accelerator;
+    double build_seconds;
+    size_t memory_bytes;
+    size_t rays;
+    double rays_per_second;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const AcceleratorBenchmark& benchmark) {
+    return out << std::left << std::setw(12) << GetAcceleratorName(benchmark.accelerator)
+               << " build " << std::setw(10) << benchmark.build_seconds * 1000 << " ms"
+               << " memory " << std::setw(10) << benchmark.memory_bytes << " B"
+               << " rays " << std::setw(10) << benchmark.rays << " throughput "
+               << benchmark.rays_per_second << " rays/s";
+}
+
+// Loads the scene once and, for every accelerator, measures its build time, memory footprint and
+// the closest hit throughput of the camera rays plus one shadow ray per light and hit.
+std::vector<AcceleratorBenchmark> BenchmarkAccelerators(
+    const std::string& filename, const CameraOptions& camera_options,
+    const std::vector<scene::AcceleratorType>& accelerators = {
+        scene::AcceleratorType::kBvh, scene::AcceleratorType::kWideBvh,
+        scene::AcceleratorType::kGrid, scene::AcceleratorType::kKdTree,
+        scene::AcceleratorType::kBruteForce}) {
+    using Clock = std::chrono::steady_clock;
+
+    auto scene = scene::ReadScene(filename, scene::AcceleratorType::kBruteForce);
+    RayCaster ray_caster(camera_options);
+    std::vector<AcceleratorBenchmark> benchmarks;
+
+    for (auto accelerator : accelerators) {
+        auto build_start = Clock::now();
+        scene.RebuildAccelerators(accelerator);
+        std::chrono::duration<double> build_time = Clock::now() - build_start;
+
+        size_t rays = 0;
+        auto trace_start = Clock::now();
+        for (int i = 0; i < ray_caster.screen_width_; ++i) {
+            for (int j = 0; j < ray_caster.screen_height_; ++j) {
+                auto ray = ray_caster(i, j);
+                auto hit = scene.Intersect(ray);
+                ++rays;
+                if (!hit) {
+                    continue;
+                }
+                auto position = ray.GetOrigin() + hit->distance * ray.GetDirection();
+                for (const auto& light : scene.GetLights()) {
+                    auto direction = position - light.position;
+                    (void)scene.Intersect({light.position, direction.Normalize()});
+                    ++rays;
+                }
+            }
+        }
+        std::chrono::duration<double> trace_time = Clock::now() - trace_start;
+
+        benchmarks.push_back({accelerator, build_time.count(), scene.AcceleratorMemoryUsage(), rays,
+                              rays / trace_time.count()});
+    }
+    return benchmarks;
+}
+
+// Resident memory of the process, zero where /proc is not available.
+inline size_t ResidentMemoryBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident_pages = 0;
+    if (!(statm >> pages >> resident_pages)) {
+        return 0;
+    }
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+// Throughput of the ray kinds of one frame and its end-to-end time. A scene that fails to load
+// keeps the error instead, so that a suite run reports the rest.
+struct SceneBenchmark {
+    std::string name;
+    std::string error;
+    double load_seconds = 0;
+    size_t memory_bytes = 0;  // growth of the resident memory while loading the scene
+    size_t primary_rays = 0;
+    double primary_rays_per_second = 0;
+    size_t shadow_rays = 0;
+    double shadow_rays_per_second = 0;
+    size_t secondary_rays = 0;  // reflected and refracted rays of the primary hits
+    double secondary_rays_per_second = 0;
+    double frame_seconds = 0;
+};
+
+inline SceneBenchmark BenchmarkScene(const std::string& name, const std::string& filename,
+                                     const CameraOptions& camera_options,
+                                     const RenderOptions& render_options) {
+    using Clock = std::chrono::steady_clock;
+    auto seconds_since = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+
+    SceneBenchmark benchmark;
+    benchmark.name = name;
+    std::shared_ptr<scene::Scene> scene;
+    auto memory_before = ResidentMemoryBytes();
+    auto load_start = Clock::now();
+    try {
+        scene.reset(new scene::Scene(scene::ReadScene(filename, render_options.accelerator)));
+    } catch (const std::exception& error) {
+        benchmark.error = error.what();
+        return benchmark;
+    }
+    benchmark.load_seconds = seconds_since(load_start);
+    auto memory_after = ResidentMemoryBytes();
+    benchmark.memory_bytes = memory_after > memory_before ? memory_after - memory_before : 0;
+
+    struct PrimaryHit {
+        geometry::Ray<> ray;
+        geometry::Intersection<> intersection;
+        const scene::Material* material;
+    };
+    std::vector<PrimaryHit> hits;
+    RayCaster ray_caster(camera_options);
+    auto primary_start = Clock::now();
+    for (int i = 0; i < ray_caster.screen_width_; ++i) {
+        for (int j = 0; j < ray_caster.screen_height_; ++j) {
+            auto ray = ray_caster(i, j);
+            auto [intersection, material] = FindClosestIntersectionAndMaterial(*scene, ray);
+            ++benchmark.primary_rays;
+            if (intersection) {
+                hits.push_back({ray, *intersection, material});
+            }
+        }
+    }
+    benchmark.primary_rays_per_second = benchmark.primary_rays / seconds_since(primary_start);
+
+    // Like LightReach: from the light towards the hit, blocked if something is closer.
+    auto shadow_start = Clock::now();
+    for (const auto& hit : hits) {
+        for (const auto& light : scene->GetLights()) {
+            auto direction = hit.intersection.GetPosition() - light.position;
+            (void)scene->Intersect({light.position, direction.Normalize()});
+            ++benchmark.shadow_rays;
+        }
+    }
+    if (benchmark.shadow_rays > 0) {
+        benchmark.shadow_rays_per_second = benchmark.shadow_rays / seconds_since(shadow_start);
+    }
+
+    auto secondary_start = Clock::now();
+    for (const auto& hit : hits) {
+        const auto& normal = hit.intersection.GetNormal();
+        const auto& position = hit.intersection.GetPosition();
+        const auto& direction = hit.ray.GetDirection();
+        auto reflected = geometry::Reflect(direction, normal);
+        (void)scene->Intersect({position + normal * kEpsilon, reflected});
+        ++benchmark.secondary_rays;
+        if (hit.material->refraction_index != 1) {
+            if (auto refracted = geometry::Refract(direction, normal,
+                                                   1 / hit.material->refraction_index)) {
+                (void)scene->Intersect({position - normal * kEpsilon, *refracted});
+                ++benchmark.secondary_rays;
+            }
+        }
+    }
+    if (benchmark.secondary_rays > 0) {
+        benchmark.secondary_rays_per_second =
+            benchmark.secondary_rays / seconds_since(secondary_start);
+    }
+
+    auto frame_start = Clock::now();
+    Raytracer(scene, camera_options, render_options).Render();
+    benchmark.frame_seconds = seconds_since(frame_start);
+    return benchmark;
+}
+
+struct MicroBenchmark {
+    std::string name;
+    size_t calls;
+    double nanoseconds_per_call;
+};
+
+// Times the geometric kernels of shading on a fixed set of varied rays, calls per kernel.
+inline std::vector<MicroBenchmark> RunMicroBenchmarks(size_t calls = 1 << 22) {
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<geometry::Ray<>> rays;
+    for (int i = 0; i < 64; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            double theta = i * 0.1;
+            double phi = 0.2 + j * 0.05;
+            geometry::Vector3D<> direction{std::cos(theta) * std::sin(phi), -std::cos(phi),
+                                           std::sin(theta) * std::sin(phi)};
+            rays.emplace_back(geometry::Vector3D<>{0, 2, 0}, direction);
+        }
+    }
+    geometry::Triangle<> triangle({geometry::Vector3D<>{-1, 0, -1}, geometry::Vector3D<>{1, 0, -1},
+                                   geometry::Vector3D<>{0, 0, 1}});
+    geometry::Sphere<> sphere({0, 0, 0}, 1);
+    geometry::Vector3D<> normal{0, 1, 0};
+    scene::Sky sky(Image(256, 192), scene::Sky::Filtering::kBilinear);
+
+    // Stored to a volatile at the end, so the compiler can't drop the calls.
+    double sink = 0;
+    std::vector<MicroBenchmark> benchmarks;
+    auto measure = [&](const std::string& name, auto&& kernel) {
+        auto start = Clock::now();
+        for (size_t call = 0; call < calls; ++call) {
+            sink += kernel(rays[call % rays.size()]);
+        }
+        std::chrono::duration<double, std::nano> time = Clock::now() - start;
+        benchmarks.push_back({name, calls, time.count() / calls});
+    };
+    measure("GetIntersection(triangle)", [&](const geometry::Ray<>& ray) {
+        auto intersection = geometry::GetIntersection(ray, triangle);
+        return intersection ? intersection->GetDistance() : 0.0;
+    });
+    measure("GetIntersection(sphere)", [&](const geometry::Ray<>& ray) {
+        auto intersection = geometry::GetIntersection(ray, sphere);
+        return intersection ? intersection->GetDistance() : 0.0;
+    });
+    measure("Refract", [&](const geometry::Ray<>& ray) {
+        auto refracted = geometry::Refract(ray.GetDirection(), normal, 1 / 1.5);
+        return refracted ? (*refracted)[0] : 0.0;
+    });
+    measure("Reflect", [&](const geometry::Ray<>& ray) {
+        return geometry::Reflect(ray.GetDirection(), normal)[0];
+    });
+    measure("Sky::Trace", [&](const geometry::Ray<>& ray) { return sky.Trace(ray)[0]; });
+    volatile double result = sink;
+    (void)result;
+    return benchmarks;
+}
+
+inline std::string EscapeJson(const std::string& text) {
+    std::string escaped;
+    for (char character : text) {
+        if (character == '"' || character == '\\') {
+            escaped += '\\';
+            escaped += character;
+        } else if (static_cast<unsigned char>(character) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", character);
+            escaped += code;
+        } else {
+            escaped += character;
+        }
+    }
+    return escaped;
+}
+
+// A number for the JSON output, null where JSON has none, like the rate of a section that took
+// no measurable time.
+struct JsonNumber {
+    double value;
+};
+
+inline std::ostream& operator<<(std::ostream& out, JsonNumber number) {
+    if (!std::isfinite(number.value)) {
+        return out << "null";
+    }
+    return out << number.value;
+}
+
+// {"scenes": [...], "microbenchmarks": [...]}, one object per line for diffable history.
+inline void WriteBenchmarkJson(std::ostream& out, const std::vector<SceneBenchmark>& scenes,
+                               const std::vector<MicroBenchmark>& microbenchmarks) {
+    auto precision = out.precision(6);
+    out << "{\n  \"scenes\": [";
+    for (size_t i = 0; i < scenes.size(); ++i) {
+        const auto& scene = scenes[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << EscapeJson(scene.name) << "\"";
+        if (!scene.error.empty()) {
+            out << ", \"error\": \"" << EscapeJson(scene.error) << "\"}";
+            continue;
+        }
+        out << ", \"load_seconds\": " << JsonNumber{scene.load_seconds}
+            << ", \"memory_bytes\": " << scene.memory_bytes
+            << ", \"primary_rays\": " << scene.primary_rays
+            << ", \"primary_rays_per_second\": " << JsonNumber{scene.primary_rays_per_second}
+            << ", \"shadow_rays\": " << scene.shadow_rays
+            << ", \"shadow_rays_per_second\": " << JsonNumber{scene.shadow_rays_per_second}
+            << ", \"secondary_rays\": " << scene.secondary_rays
+            << ", \"secondary_rays_per_second\": "
+            << JsonNumber{scene.secondary_rays_per_second}
+            << ", \"frame_seconds\": " << JsonNumber{scene.frame_seconds} << "}";
+    }
+    out << "\n  ],\n  \"microbenchmarks\": [";
+    for (size_t i = 0; i < microbenchmarks.size(); ++i) {
+        const auto& benchmark = microbenchmarks[i];
+        out << (i ? ",\n" : "\n") << "    {\"name\": \"" << EscapeJson(benchmark.name)
+            << "\", \"calls\": " << benchmark.calls
+            << ", \"nanoseconds_per_call\": " << JsonNumber{benchmark.nanoseconds_per_call}
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+    out.precision(precision);
+}
+}  // namespace raytracer
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raytracer/raytracer.cpp"
+#include "raytracer/region.h"
+#include "raytracer/serialization.h"
+#include "raytracer/tile_cache.h"
+
+// Checkpointing of long renders: the finished tiles and the float framebuffer are saved to disk
+// periodically, and a render started with the same scene, camera and options resumes from the
+// checkpoint, tracing only the tiles that were missing.
+namespace raytracer {
+struct CheckpointOptions {
+    std::filesystem::path path;
+    double interval_seconds = 60;
+    bool remove_when_done = true;
+    // Checked between tiles, a set flag saves a last checkpoint and throws RenderCancelled.
+    const std::atomic<bool>* cancelled = nullptr;
+    std::function<void(const Region& tile)> on_tile;  // after a tile is traced
+};
+
+struct CheckpointReport {
+    size_t resumed_tiles = 0;
+    size_t traced_tiles = 0;
+    size_t checkpoints = 0;  // snapshots handed to the writer
+};
+
+// Writes snapshots on its own thread, so the render thread only pays for serializing them. A
+// snapshot that arrives while the previous one is still being written replaces the queued one.
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::filesystem::path path)
+        : path_(std::move(path)), thread_([this] { Run(); }) {
+    }
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // Writes the last queued snapshot before returning.
+    ~CheckpointWriter() {
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        ready_.notify_one();
+        thread_.join();
+    }
+
+    void Submit(std::vector<char> snapshot) {
+        {
+            std::lock_guard lock(mutex_);
+            pending_ = std::move(snapshot);
+        }
+        ready_.notify_one();
+    }
+
+private:
+    void Run() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            ready_.wait(lock, [this] { return pending_ || stopping_; });
+            if (!pending_) {
+                return;
+            }
+            auto snapshot = std::move(*pending_);
+            pending_.reset();
+            lock.unlock();
+            WriteFileAtomically(path_, snapshot);
+            lock.lock();
+        }
+    }
+
+private:
+    std::filesystem::path path_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::optional<std::vector<char>> pending_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Renders tile by tile with RenderOptions::tile_size, resuming from options.path if it holds a
+// checkpoint of the same frame. The checkpoint is removed once the image is built unless asked
+// to keep it.
+inline Image RenderWithCheckpoints(const std::string& filename,
+                                   const CameraOptions& camera_options,
+                                   const RenderOptions& render_options,
+                                   const CheckpointOptions& options,
+                                   CheckpointReport* report = nullptr) {
+    constexpr uint32_t kMagic = 0x544b4843;  // "CHKT"
+    constexpr uint32_t kVersion = 1;
+    using Clock = std::chrono::steady_clock;
+
+    int width = camera_options.screen_width;
+    int height = camera_options.screen_height;
+    int tile_size = std::max(render_options.tile_size, 1);
+    auto tiles = SplitIntoTiles(width, height, tile_size);
+    // The whole frame region and the tile size make the key of the tile layout.
+    MessageWriter frame_key;
+    frame_key.PutArray(
+        TileKey(HashScene(filename), camera_options, render_options, {0, 0, width, height}));
+    frame_key.Put(tile_size);
+    const auto& key = frame_key.Payload();
+
+    CheckpointReport local_report;
+    auto& stats = report ? *report : local_report;
+    stats = {};
+
+    // Row-major RGB floats of the frame, like TraceRegion.
+    std::vector<float> frame(static_cast<size_t>(width) * height * 3);
+    std::vector<uint8_t> done(tiles.size(), 0);
+    if (std::ifstream file(options.path, std::ios::binary); file) {
+        std::vector<char> bytes(std::istreambuf_iterator<char>(file), {});
+        try {
+            MessageReader reader(bytes);
+            if (reader.Get<uint32_t>() == kMagic && reader.Get<uint32_t>() == kVersion &&
+                reader.GetArray<char>() == key) {
+                auto saved_done = reader.GetArray<uint8_t>();
+                auto saved_frame = reader.GetArray<float>();
+                if (saved_done.size() == done.size() && saved_frame.size() == frame.size()) {
+                    done = std::move(saved_done);
+                    frame = std::move(saved_frame);
+                    stats.resumed_tiles = std::count(done.begin(), done.end(), 1);
+                }
+            }
+        } catch (const std::runtime_error&) {
+            // A damaged checkpoint is rendered from scratch.
+        }
+    }
+
+    std::optional<CheckpointWriter> writer;
+    auto save = [&] {
+        if (!writer) {
+            writer.emplace(options.path);
+        }
+        MessageWriter snapshot;
+        snapshot.Put(kMagic);
+        snapshot.Put(kVersion);
+        snapshot.PutArray(key);
+        snapshot.PutArray(done);
+        snapshot.PutArray(frame);
+        writer->Submit(snapshot.Payload());
+        ++stats.checkpoints;
+    };
+
+    std::optional<Raytracer> tracer;
+    auto last_checkpoint = Clock::now();
+    for (size_t index = 0; index < tiles.size(); ++index) {
+        if (done[index]) {
+            continue;
+        }
+        if (options.cancelled && options.cancelled->load()) {
+            save();
+            writer.reset();
+            throw RenderCancelled();
+        }
+        if (!tracer) {
+            tracer.emplace(filename, camera_options, render_options);
+        }
+        const auto& tile = tiles[index];
+        auto floats = tracer->TraceRegion(tile);
+        auto value = floats.begin();
+        for (int j = 0; j < tile.height; ++j) {
+            auto row = frame.begin() + (static_cast<size_t>(tile.y + j) * width + tile.x) * 3;
+            std::copy(value, value + tile.width * 3, row);
+            value += tile.width * 3;
+        }
+        done[index] = 1;
+        ++stats.traced_tiles;
+        if (options.on_tile) {
+            options.on_tile(tile);
+        }
+        auto now = Clock::now();
+        if (std::chrono::duration<double>(now - last_checkpoint).count() >=
+            options.interval_seconds) {
+            save();
+            last_checkpoint = now;
+        }
+    }
+
+    writer.reset();
+    if (options.remove_when_done) {
+        std::error_code error;
+        std::filesystem::remove(options.path, error);
+    } else if (stats.traced_tiles > 0) {
+        save();
+        writer.reset();
+    }
+
+    return BuildImageFromFloats(frame, width, height, render_options.mode,
+                                render_options.normalization, render_options.cost_metric,
+                                render_options.color_map);
+}
+}  // namespace raytracer
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <vector>
+
+namespace raytracer {
+// Shading effort of a tile: recursion depth and the fraction 1 / light_stride of the lights.
+struct TileQuality {
+    int depth;
+    size_t light_stride = 1;
+
+    bool operator==(const TileQuality& rhs) const {
+        return depth == rhs.depth && light_stride == rhs.light_stride;
+    }
+};
+
+// Qualities from the requested one down to ambient only: the recursion depth is lowered first,
+// then direct lighting is computed for every second, fourth, ... light.
+inline std::vector<TileQuality> GetQualityLadder(int depth, size_t light_count) {
+    std::vector<TileQuality> ladder;
+    for (int level = depth; level >= 1; --level) {
+        ladder.push_back({level, 1});
+    }
+    for (size_t stride = 2; stride / 2 < light_count; stride *= 2) {
+        ladder.push_back({1, stride});
+    }
+    ladder.push_back({0, 1});
+    return ladder;
+}
+
+struct TileReport {
+    int x, y, width, height;
+    TileQuality quality;
+    double seconds;
+};
+
+struct DeadlineReport {
+    double budget_seconds = 0;
+    double seconds = 0;
+    TileQuality requested{0};
+    std::vector<TileReport> tiles;
+
+    [[nodiscard]] bool Degraded(const TileReport& tile) const {
+        return !(tile.quality == requested);
+    }
+
+    [[nodiscard]] size_t DegradedTileCount() const {
+        return std::count_if(tiles.begin(), tiles.end(),
+                             [&](const TileReport& tile) { return Degraded(tile); });
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const DeadlineReport& report) {
+    out << "rendered in " << report.seconds << " s of " << report.budget_seconds << " s, "
+        << report.DegradedTileCount() << " of " << report.tiles.size() << " tiles degraded\n";
+    for (const auto& tile : report.tiles) {
+        if (report.Degraded(tile)) {
+            out << "  tile " << tile.x << "," << tile.y << " " << tile.width << "x" << tile.height
+                << ": depth " << tile.quality.depth << " of " << report.requested.depth
+                << ", 1/" << tile.quality.light_stride << " of the lights\n";
+        }
+    }
+    return out;
+}
+}  // namespace raytracer
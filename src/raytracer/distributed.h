@@ -0,0 +1,446 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "raytracer/raytracer.cpp"
+#include "raytracer/region.h"
+#include "raytracer/serialization.h"
+
+// Coordinator / worker rendering over stream sockets: socket pairs to forked local workers or TCP
+// connections to remote ones. A worker receives the job once, loads the scene and answers tile
+// requests with raw float values; the coordinator merges the tiles and builds the image. Tiles of
+// a worker that disconnects, sends a malformed answer or stalls are handed to the remaining ones.
+namespace raytracer {
+enum class MessageType : uint32_t { kJob = 1, kTile = 2, kResult = 3 };
+
+struct Message {
+    MessageType type;
+    std::vector<char> payload;
+};
+
+inline bool SendAll(int fd, const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        // A worker that died must not kill the coordinator with SIGPIPE.
+        auto sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+inline bool ReceiveAll(int fd, void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+    while (size > 0) {
+        auto received = recv(fd, bytes, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        size -= received;
+    }
+    return true;
+}
+
+inline bool SendMessage(int fd, MessageType type, const std::vector<char>& payload) {
+    uint32_t header_type = static_cast<uint32_t>(type);
+    uint64_t size = payload.size();
+    return SendAll(fd, &header_type, sizeof(header_type)) && SendAll(fd, &size, sizeof(size)) &&
+           SendAll(fd, payload.data(), payload.size());
+}
+
+// Bound of the job and tile messages a worker accepts.
+inline constexpr uint64_t kMaxRequestSize = uint64_t{1} << 20;
+
+// False once the peer disconnected, broke off in the middle of a message or announced a payload
+// larger than max_size.
+inline bool ReceiveMessage(int fd, Message& message, uint64_t max_size) {
+    uint32_t type;
+    uint64_t size;
+    if (!ReceiveAll(fd, &type, sizeof(type)) || !ReceiveAll(fd, &size, sizeof(size)) ||
+        size > max_size) {
+        return false;
+    }
+    message.type = static_cast<MessageType>(type);
+    message.payload.resize(size);
+    return ReceiveAll(fd, message.payload.data(), size);
+}
+
+// Serves one coordinator on fd until it disconnects: loads the scene of the job, then traces the
+// requested tiles.
+inline void RunWorker(int fd) {
+    Message message;
+    if (!ReceiveMessage(fd, message, kMaxRequestSize) || message.type != MessageType::kJob) {
+        return;
+    }
+    MessageReader job(message.payload);
+    auto filename = job.GetString();
+    auto width = job.Get<int>();
+    auto height = job.Get<int>();
+    auto fov = job.Get<double>();
+    CameraOptions camera_options(width, height, fov);
+    for (int axis = 0; axis < 3; ++axis) {
+        camera_options.look_from[axis] = job.Get<double>();
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        camera_options.look_to[axis] = job.Get<double>();
+    }
+    auto render_options = job.Get<RenderOptions>();
+    Raytracer tracer(filename, camera_options, render_options);
+
+    while (ReceiveMessage(fd, message, kMaxRequestSize) && message.type == MessageType::kTile) {
+        auto region = MessageReader(message.payload).Get<Region>();
+        MessageWriter result;
+        result.Put(region);
+        result.PutArray(tracer.TraceRegion(region));
+        if (!SendMessage(fd, MessageType::kResult, result.Payload())) {
+            return;
+        }
+    }
+}
+
+// Connected worker stream; pid is -1 for remote workers.
+struct WorkerConnection {
+    int fd = -1;
+    pid_t pid = -1;
+};
+
+// Forks a worker process connected by a socket pair.
+inline WorkerConnection SpawnLocalWorker() {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+        throw std::runtime_error("Can't create worker socket pair");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        throw std::runtime_error("Can't fork worker process");
+    }
+    if (pid == 0) {
+        close(sockets[0]);
+        int status = 0;
+        try {
+            RunWorker(sockets[1]);
+        } catch (...) {
+            status = 1;
+        }
+        _exit(status);
+    }
+    close(sockets[1]);
+    return {sockets[0], pid};
+}
+
+// Listening TCP socket on all interfaces; port 0 picks a free one, see GetListeningPort.
+inline int ListenTcp(uint16_t port, int backlog = 16) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("Can't create TCP socket");
+    }
+    int enable = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(fd, backlog) != 0) {
+        close(fd);
+        throw std::runtime_error("Can't listen on TCP port " + std::to_string(port));
+    }
+    return fd;
+}
+
+inline uint16_t GetListeningPort(int listen_fd) {
+    sockaddr_in address{};
+    socklen_t length = sizeof(address);
+    if (getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        throw std::runtime_error("Can't query listening port");
+    }
+    return ntohs(address.sin_port);
+}
+
+// Worker machine side: every accepted coordinator is served by a forked worker process.
+inline void ServeTcpWorkers(int listen_fd, size_t connections = SIZE_MAX) {
+    for (size_t served = 0; served < connections;) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Can't accept coordinator connection");
+        }
+        ++served;
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(listen_fd);
+            int status = 0;
+            try {
+                RunWorker(fd);
+            } catch (...) {
+                status = 1;
+            }
+            _exit(status);
+        }
+        close(fd);
+        while (waitpid(-1, nullptr, WNOHANG) > 0) {
+        }
+    }
+    while (waitpid(-1, nullptr, 0) > 0) {
+    }
+}
+
+inline WorkerConnection ConnectTcpWorker(const std::string& host, uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        throw std::runtime_error("Can't resolve worker " + host);
+    }
+    int fd = -1;
+    for (auto address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        throw std::runtime_error("Can't connect to worker " + host + ":" + std::to_string(port));
+    }
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return {fd, -1};
+}
+
+struct DistributedOptions {
+    int tile_size = 32;
+    size_t tiles_in_flight = 2;  // requests queued per worker, hides the round trip
+    // A worker that owes a tile for longer fails, the first one includes loading the scene.
+    double tile_timeout_seconds = 60;
+    std::function<void(size_t worker, const Region& tile)> on_tile;  // after a tile is merged
+};
+
+struct DistributedReport {
+    std::vector<size_t> tiles_per_worker;
+    std::vector<bool> failed_workers;
+    size_t reassigned_tiles = 0;
+};
+
+// Renders the frame on workers, which it takes ownership of: their sockets are closed and local
+// worker processes reaped on return, failed ones killed first. Throws if every worker failed
+// before the frame was done.
+inline Image RenderDistributed(const std::string& filename, const CameraOptions& camera_options,
+                               const RenderOptions& render_options,
+                               std::vector<WorkerConnection> workers,
+                               const DistributedOptions& options = {},
+                               DistributedReport* report = nullptr) {
+    using Clock = std::chrono::steady_clock;
+    struct WorkerState {
+        WorkerConnection connection;
+        std::deque<Region> pending;
+        bool alive = true;
+        Clock::time_point deadline;  // of the oldest pending tile
+    };
+    struct Workers {
+        std::vector<WorkerState> states;
+
+        ~Workers() {
+            for (auto& state : states) {
+                if (state.alive) {
+                    close(state.connection.fd);
+                }
+            }
+            for (auto& state : states) {
+                if (state.connection.pid >= 0) {
+                    waitpid(state.connection.pid, nullptr, 0);
+                }
+            }
+        }
+    } pool;
+    for (const auto& connection : workers) {
+        pool.states.push_back({connection, {}, true, {}});
+    }
+
+    int width = camera_options.screen_width;
+    int height = camera_options.screen_height;
+    auto tiles = SplitIntoTiles(width, height, options.tile_size);
+    std::deque<Region> queue(tiles.begin(), tiles.end());
+    size_t tile_count = queue.size();
+
+    DistributedReport local_report;
+    auto& stats = report ? *report : local_report;
+    stats = {std::vector<size_t>(workers.size(), 0), std::vector<bool>(workers.size(), false), 0};
+
+    auto fail = [&](size_t index) {
+        auto& state = pool.states[index];
+        state.alive = false;
+        close(state.connection.fd);
+        if (state.connection.pid >= 0) {
+            kill(state.connection.pid, SIGKILL);
+        }
+        stats.failed_workers[index] = true;
+        stats.reassigned_tiles += state.pending.size();
+        queue.insert(queue.begin(), state.pending.begin(), state.pending.end());
+        state.pending.clear();
+    };
+    auto tile_timeout = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.tile_timeout_seconds));
+    auto refill = [&](size_t index) {
+        auto& state = pool.states[index];
+        if (state.pending.empty()) {
+            state.deadline = Clock::now() + tile_timeout;
+        }
+        while (state.alive && state.pending.size() < options.tiles_in_flight && !queue.empty()) {
+            MessageWriter request;
+            request.Put(queue.front());
+            if (!SendMessage(state.connection.fd, MessageType::kTile, request.Payload())) {
+                fail(index);
+                return;
+            }
+            state.pending.push_back(queue.front());
+            queue.pop_front();
+        }
+    };
+
+    MessageWriter job;
+    job.PutString(filename);
+    job.Put(camera_options.screen_width);
+    job.Put(camera_options.screen_height);
+    job.Put(camera_options.fov);
+    for (int axis = 0; axis < 3; ++axis) {
+        job.Put(camera_options.look_from[axis]);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        job.Put(camera_options.look_to[axis]);
+    }
+    job.Put(render_options);
+    for (size_t i = 0; i < pool.states.size(); ++i) {
+        if (!SendMessage(pool.states[i].connection.fd, MessageType::kJob, job.Payload())) {
+            fail(i);
+        }
+    }
+
+    auto tile_floats = static_cast<uint64_t>(options.tile_size) * options.tile_size * 3;
+    auto max_result_size = sizeof(Region) + sizeof(uint64_t) + tile_floats * sizeof(float);
+
+    PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+    size_t merged = 0;
+    while (merged < tile_count) {
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        auto now = Clock::now();
+        auto next_deadline = Clock::time_point::max();
+        for (size_t i = 0; i < pool.states.size(); ++i) {
+            refill(i);
+            auto& state = pool.states[i];
+            if (state.alive && !state.pending.empty() && state.deadline <= now) {
+                fail(i);
+            }
+            if (state.alive && !state.pending.empty()) {
+                fds.push_back({state.connection.fd, POLLIN, 0});
+                owners.push_back(i);
+                next_deadline = std::min(next_deadline, state.deadline);
+            }
+        }
+        if (fds.empty()) {
+            if (!queue.empty() && std::any_of(pool.states.begin(), pool.states.end(),
+                                              [](const auto& state) { return state.alive; })) {
+                continue;
+            }
+            throw std::runtime_error("All render workers failed");
+        }
+        // Rounded up, so that the deadline has passed when poll times out.
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(next_deadline - now).count();
+        timeout = std::min<int64_t>(timeout, std::numeric_limits<int>::max());
+        if (poll(fds.data(), fds.size(), static_cast<int>(timeout)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Can't poll render workers");
+        }
+
+        for (size_t k = 0; k < fds.size(); ++k) {
+            if (fds[k].revents == 0) {
+                continue;
+            }
+            size_t index = owners[k];
+            auto& state = pool.states[index];
+            Message message;
+            if (!ReceiveMessage(state.connection.fd, message, max_result_size) ||
+                message.type != MessageType::kResult) {
+                fail(index);
+                continue;
+            }
+            // Workers answer in request order.
+            auto tile = state.pending.front();
+            Region region;
+            std::vector<float> floats;
+            try {
+                MessageReader result(message.payload);
+                region = result.Get<Region>();
+                floats = result.GetArray<float>();
+            } catch (const std::exception&) {
+                fail(index);
+                continue;
+            }
+            if (region.x != tile.x || region.y != tile.y || region.width != tile.width ||
+                region.height != tile.height ||
+                floats.size() != static_cast<size_t>(tile.width) * tile.height * 3) {
+                fail(index);
+                continue;
+            }
+            auto value = floats.begin();
+            for (int j = 0; j < tile.height; ++j) {
+                for (int i = 0; i < tile.width; ++i) {
+                    auto& pixel = values[tile.x + i][tile.y + j];
+                    for (int channel = 0; channel < 3; ++channel) {
+                        pixel[channel] = *value++;
+                    }
+                }
+            }
+            state.pending.pop_front();
+            state.deadline = Clock::now() + tile_timeout;
+            ++merged;
+            ++stats.tiles_per_worker[index];
+            if (options.on_tile) {
+                options.on_tile(index, tile);
+            }
+        }
+    }
+
+    double normalization = render_options.normalization;
+    return BuildImageFromValues(std::move(values), render_options.mode, normalization,
+                                render_options.cost_metric, render_options.color_map);
+}
+}  // namespace raytracer
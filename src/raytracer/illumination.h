@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "geometry/vector.h"
 #include "geometry/intersection.h"
@@ -10,6 +14,7 @@
 #include "scene/light.h"
 #include "scene/object.h"
 #include "scene/scene.h"
+#include "raytracer/stats.h"
 
 namespace raytracer {
 const double kEpsilon = 0.0001;
@@ -41,55 +46,91 @@ GetIntersectionAndMaterial(const geometry::Ray<>& ray, const scene::SphereObject
     return {GetIntersection(ray, sphere_object.sphere), sphere_object.material};
 }
 
-std::vector<std::pair<geometry::Intersection<>, const scene::Material*>>
-FindAllIntersectionsAndMaterials(const scene::Scene& scene, const geometry::Ray<>& ray) {
-    std::vector<std::pair<geometry::Intersection<>, const scene::Material*>> intersections;
-    for (const auto& object : scene.GetObjects()) {
-        auto [possible_intersection, material] = GetIntersectionAndMaterial(ray, object);
-        if (possible_intersection) {
-            intersections.emplace_back(possible_intersection.value(), material);
-        }
+std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>
+GetIntersectionAndMaterial(const scene::Scene& scene, const scene::Hit& hit) {
+    const auto& mesh = scene.GetHitMesh(hit);
+    auto [intersection, material] =
+        mesh.IsSphere(hit.primitive)
+            ? GetIntersectionAndMaterial(hit.local_ray,
+                                         mesh.sphere_objects[hit.primitive - mesh.objects.size()])
+            : GetIntersectionAndMaterial(hit.local_ray, mesh.objects[hit.primitive]);
+    if (!intersection || hit.instance < 0) {
+        return {intersection, material};
     }
 
-    for (const auto& sphere_object : scene.GetSphereObjects()) {
-        auto [possible_intersection, material] = GetIntersectionAndMaterial(ray, sphere_object);
-        if (possible_intersection) {
-            intersections.emplace_back(possible_intersection.value(), material);
-        }
-    }
-    return intersections;
+    const auto& instance = scene.GetInstances()[hit.instance];
+    auto position = instance.object_to_world.ApplyToPoint(intersection->GetPosition());
+    auto normal = instance.world_to_object.ApplyTransposedToNormal(intersection->GetNormal());
+    return {geometry::Intersection{position, normal.Normalize(), hit.distance}, material};
 }
 
 std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>
-FindClosestIntersectionAndMaterial(
-    std::vector<std::pair<geometry::Intersection<>, const scene::Material*>> intersections) {
-    if (!intersections.empty()) {
-        return *std::min_element(
-            intersections.begin(), intersections.end(),
-            [](auto& lhs, auto& rhs) { return lhs.first.GetDistance() < rhs.first.GetDistance(); });
-
-    } else {
+FindClosestIntersectionAndMaterial(const scene::Scene& scene, const geometry::Ray<>& ray) {
+    auto hit = scene.Intersect(ray);
+    if (!hit) {
         return {{}, nullptr};
     }
-}
-
-std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>
-FindClosestIntersectionAndMaterial(const scene::Scene& scene, const geometry::Ray<>& ray) {
-    return FindClosestIntersectionAndMaterial(FindAllIntersectionsAndMaterials(scene, ray));
+    return GetIntersectionAndMaterial(scene, *hit);
 }
 
 inline bool ReachThroughPossible(const scene::Material* material) {
     return material->refraction_index == 1 && material->albedo[2] != 0;
 }
 
+// What the radiance of a pixel depends on, collected while it is shaded: the materials its paths
+// hit or were shadowed by, and the radiance every reached light contributed. Radiance is linear
+// in each light intensity, so the contributions rescale with it.
+struct ShadingRecord {
+    // The camera ray hit and the light each sampled light reached it with, enough to evaluate
+    // the ambient, diffuse and specular terms there again for another material.
+    struct PrimaryHit {
+        geometry::Intersection<> intersection;
+        const scene::Material* material = nullptr;
+        geometry::Vector3D<> direction;  // of the camera ray
+        double stride = 1;               // of the light sampling
+        std::vector<std::pair<size_t, geometry::Vector3D<>>> light_reach;
+    };
+
+    std::vector<const scene::Material*> materials;
+    std::vector<std::pair<size_t, geometry::Vector3D<>>> light_radiance;
+    geometry::Vector3D<> weight = {1, 1, 1};  // throughput of the path being shaded
+    std::optional<PrimaryHit> primary;
+    size_t primary_material_repeats = 0;  // hits and shadowings by it after the primary hit
+
+    void AddMaterial(const scene::Material* material) {
+        if (primary && material == primary->material) {
+            ++primary_material_repeats;
+        }
+        if (!DependsOn(material)) {
+            materials.push_back(material);
+        }
+    }
+
+    void AddLight(size_t light, const geometry::Vector3D<>& radiance) {
+        auto it = std::find_if(light_radiance.begin(), light_radiance.end(),
+                               [&](const auto& entry) { return entry.first == light; });
+        if (it == light_radiance.end()) {
+            light_radiance.emplace_back(light, weight * radiance);
+        } else {
+            it->second += weight * radiance;
+        }
+    }
+
+    [[nodiscard]] bool DependsOn(const scene::Material* material) const {
+        return std::find(materials.begin(), materials.end(), material) != materials.end();
+    }
+};
+
 geometry::Vector3D<> LightReach(const scene::Scene& scene, const scene::Light& light,
-                                const geometry::Vector3D<>& position, int ttl) {
+                                const geometry::Vector3D<>& position, int ttl,
+                                ShadingRecord* record = nullptr) {
     if (ttl < 0) {
         return {0, 0, 0};
     }
     geometry::Vector3D<> ray_direction = position - light.position;
     ray_direction.Normalize();
     geometry::Ray ray(light.position, ray_direction);
+    RAYTRACER_COUNT(shadow_rays);
     auto [closest_intersection, material] = FindClosestIntersectionAndMaterial(scene, ray);
 
     if (!closest_intersection) {
@@ -100,73 +141,145 @@ geometry::Vector3D<> LightReach(const scene::Scene& scene, const scene::Light& l
         return light.intensity;
     }
 
+    if (record) {
+        record->AddMaterial(material);
+    }
     if (ReachThroughPossible(material)) {
         scene::Light new_light = {closest_intersection.value().GetPosition(),
                                   material->albedo[2] * material->specular_color * light.intensity};
         new_light.position += ray_direction * kEpsilon;
-        return LightReach(scene, new_light, position, ttl - 1);
+        return LightReach(scene, new_light, position, ttl - 1, record);
     } else {
         return {0, 0, 0};
     }
 }
 
-geometry::Vector3D<> CalculateDiffuse(const scene::Scene& scene,
-                                      const geometry::Intersection<>& intersection, int ttl) {
+// Every stride-th light starting at offset is evaluated and weighted by stride to make up for
+// the skipped ones. The default evaluates all of them.
+struct LightSampling {
+    size_t stride = 1;
+    size_t offset = 0;
+};
+
+inline geometry::Vector3D<> GetDiffuse(const scene::Light& light,
+                                       const geometry::Vector3D<>& illumination,
+                                       const geometry::Intersection<>& intersection) {
+    auto light_direction = (light.position - intersection.GetPosition()).Normalize();
+    return illumination * std::max(0.0, DotProduct(light_direction, intersection.GetNormal()));
+}
+
+inline geometry::Vector3D<> GetSpecular(const scene::Light& light,
+                                        const geometry::Vector3D<>& illumination,
+                                        const geometry::Intersection<>& intersection,
+                                        const scene::Material* material,
+                                        const geometry::Vector3D<>& ray_direction) {
+    auto light_direction = (light.position - intersection.GetPosition()).Normalize();
+    auto reflection_direction = Reflect(-light_direction, intersection.GetNormal()).Normalize();
+    double cos_sigma = -DotProduct(reflection_direction, ray_direction);
+    return illumination * pow(std::max(0.0, cos_sigma), material->specular_exponent);
+}
+
+// The light reaching the intersection is stored in reach, if given, for every sampled light
+// that is not shadowed.
+geometry::Vector3D<> CalculateDiffuse(
+    const scene::Scene& scene, const geometry::Intersection<>& intersection, int ttl,
+    const LightSampling& sampling = {}, ShadingRecord* record = nullptr,
+    std::vector<std::pair<size_t, geometry::Vector3D<>>>* reach = nullptr) {
     geometry::Vector3D<> total_diffusive_illumination = {0, 0, 0};
-    for (const auto& light : scene.GetLights()) {
-        auto illumination = LightReach(scene, light, intersection.GetPosition(), ttl);
+    const auto& lights = scene.GetLights();
+    for (size_t i = sampling.offset % sampling.stride; i < lights.size(); i += sampling.stride) {
+        const auto& light = lights[i];
+        auto illumination = LightReach(scene, light, intersection.GetPosition(), ttl, record);
         if (!illumination.Zero()) {
-            auto light_direction = (light.position - intersection.GetPosition()).Normalize();
-            total_diffusive_illumination +=
-                illumination * std::max(0.0, DotProduct(light_direction, intersection.GetNormal()));
+            if (reach) {
+                reach->emplace_back(i, illumination);
+            }
+            auto diffusive_illumination = GetDiffuse(light, illumination, intersection);
+            total_diffusive_illumination += diffusive_illumination;
+            if (record) {
+                record->AddLight(i, diffusive_illumination * static_cast<double>(sampling.stride));
+            }
         }
     }
-    return total_diffusive_illumination;
+    return total_diffusive_illumination * static_cast<double>(sampling.stride);
 }
 
 geometry::Vector3D<> CalculateSpecular(const scene::Scene& scene,
                                        const geometry::Intersection<>& intersection,
                                        const scene::Material* material, const geometry::Ray<>& ray,
-                                       int ttl) {
+                                       int ttl, const LightSampling& sampling = {},
+                                       ShadingRecord* record = nullptr) {
     geometry::Vector3D<> total_specular_illumination{0, 0, 0};
-    for (const auto& light : scene.GetLights()) {
-        auto illumination = LightReach(scene, light, intersection.GetPosition(), ttl);
+    const auto& lights = scene.GetLights();
+    for (size_t i = sampling.offset % sampling.stride; i < lights.size(); i += sampling.stride) {
+        const auto& light = lights[i];
+        auto illumination = LightReach(scene, light, intersection.GetPosition(), ttl, record);
         if (!illumination.Zero()) {
-            auto light_direction = (light.position - intersection.GetPosition()).Normalize();
-            auto reflection_direction =
-                Reflect(-light_direction, intersection.GetNormal()).Normalize();
-            double cos_sigma = -DotProduct(reflection_direction, ray.GetDirection());
-
-            total_specular_illumination +=
-                illumination * pow(std::max(0.0, cos_sigma), material->specular_exponent);
+            auto specular_illumination =
+                GetSpecular(light, illumination, intersection, material, ray.GetDirection());
+            total_specular_illumination += specular_illumination;
+            if (record) {
+                record->AddLight(i, specular_illumination * static_cast<double>(sampling.stride));
+            }
         }
     }
-    return total_specular_illumination;
+    return total_specular_illumination * static_cast<double>(sampling.stride);
 }
 
 geometry::Vector3D<> CalculateIllumination(const scene::Scene& scene, const geometry::Ray<>& ray,
-                                           bool inside, int ttl) {
+                                           bool inside, int ttl, const LightSampling& sampling = {},
+                                           ShadingRecord* record = nullptr);
+
+// Illumination along a ray whose closest intersection is already known.
+geometry::Vector3D<> CalculateIllumination(
+    const scene::Scene& scene, const geometry::Ray<>& ray,
+    const std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>& closest,
+    bool inside, int ttl, const LightSampling& sampling = {}, ShadingRecord* record = nullptr) {
     if (ttl < 0) {
         return geometry::Vector3D<>{0, 0, 0};
     }
 
-    auto [possible_intersection, material] = FindClosestIntersectionAndMaterial(scene, ray);
+    const auto& [possible_intersection, material] = closest;
     if (!possible_intersection) {
+        RAYTRACER_COUNT(sky_misses);
         return scene.sky_.Trace(ray);
     }
     auto intersection = possible_intersection.value();
+    RAYTRACER_COUNT_DEPTH();
+
+    // Terms below are recorded with the path throughput times their own factor.
+    geometry::Vector3D<> path_weight = {1, 1, 1};
+    std::vector<std::pair<size_t, geometry::Vector3D<>>>* reach = nullptr;
+    if (record) {
+        record->AddMaterial(material);
+        path_weight = record->weight;
+        if (!record->primary) {
+            record->primary = ShadingRecord::PrimaryHit{intersection, material, ray.GetDirection(),
+                                                        static_cast<double>(sampling.stride), {}};
+            reach = &record->primary->light_reach;
+        }
+    }
+    auto set_weight = [&](const geometry::Vector3D<>& factor) {
+        if (record) {
+            record->weight = path_weight * factor;
+        }
+    };
 
     // Ambient
     auto illumination_ambient = material->ambient_color + material->intensity;
 
     // Diffusive
+    set_weight(material->diffuse_color * material->albedo[0]);
     auto illumination_diffusive = material->diffuse_color *
-                                  CalculateDiffuse(scene, intersection, ttl - 1) *
+                                  CalculateDiffuse(scene, intersection, ttl - 1, sampling, record,
+                                                   reach) *
                                   material->albedo[0];
 
     // Specular
+    set_weight(material->specular_color * material->albedo[0]);
     auto illumination_specular = material->specular_color *
-                                 CalculateSpecular(scene, intersection, material, ray, ttl - 1) *
+                                 CalculateSpecular(scene, intersection, material, ray, ttl - 1,
+                                                   sampling, record) *
                                  material->albedo[0];
 
     // Reflected
@@ -175,9 +288,12 @@ geometry::Vector3D<> CalculateIllumination(const scene::Scene& scene, const geom
     reflected_ray.Propell(kEpsilon);
     geometry::Vector3D<> illumination_reflected;
     if (material->albedo[1] != 0 && !inside) {
-        illumination_reflected = material->specular_color *
-                                 CalculateIllumination(scene, reflected_ray, false, ttl - 1) *
-                                 material->albedo[1];
+        set_weight(material->specular_color * material->albedo[1]);
+        RAYTRACER_COUNT(reflected_rays);
+        illumination_reflected =
+            material->specular_color *
+            CalculateIllumination(scene, reflected_ray, false, ttl - 1, sampling, record) *
+            material->albedo[1];
     } else {
         illumination_reflected = {0, 0, 0};
     }
@@ -198,9 +314,14 @@ geometry::Vector3D<> CalculateIllumination(const scene::Scene& scene, const geom
         geometry::Ray refracted_ray = {intersection.GetPosition(), refracted_ray_direction.value()};
         refracted_ray.Propell(kEpsilon);
 
-        illumination_refracted = material->specular_color *
-                                 CalculateIllumination(scene, refracted_ray, true, ttl - 1) *
-                                 material->albedo[2];
+        double inside_scale =
+            inside ? (material->albedo[2] + material->albedo[1]) / material->albedo[2] : 1;
+        set_weight(material->specular_color * material->albedo[2] * inside_scale);
+        RAYTRACER_COUNT(refracted_rays);
+        illumination_refracted =
+            material->specular_color *
+            CalculateIllumination(scene, refracted_ray, true, ttl - 1, sampling, record) *
+            material->albedo[2];
     } else {
         illumination_refracted = {0, 0, 0};
     }
@@ -209,7 +330,46 @@ geometry::Vector3D<> CalculateIllumination(const scene::Scene& scene, const geom
         illumination_refracted *= (material->albedo[2] + material->albedo[1]) / material->albedo[2];
     }
 
+    if (record) {
+        record->weight = path_weight;
+    }
     return illumination_ambient + illumination_diffusive + illumination_specular +
            illumination_reflected + illumination_refracted;
 }
+
+// Ambient, diffuse and specular radiance at the primary hit for material, and what each light
+// contributed to it.
+inline geometry::Vector3D<> GetPrimaryDirectRadiance(
+    const scene::Scene& scene, const ShadingRecord::PrimaryHit& primary,
+    const scene::Material& material,
+    std::vector<std::pair<size_t, geometry::Vector3D<>>>* light_radiance) {
+    geometry::Vector3D<> diffuse = {0, 0, 0};
+    geometry::Vector3D<> specular = {0, 0, 0};
+    for (const auto& [index, illumination] : primary.light_reach) {
+        const auto& light = scene.GetLights()[index];
+        auto light_diffuse = GetDiffuse(light, illumination, primary.intersection) * primary.stride;
+        auto light_specular = GetSpecular(light, illumination, primary.intersection, &material,
+                                          primary.direction) *
+                              primary.stride;
+        diffuse += light_diffuse;
+        specular += light_specular;
+        light_radiance->emplace_back(
+            index, (material.diffuse_color * light_diffuse +
+                    material.specular_color * light_specular) *
+                       material.albedo[0]);
+    }
+    return material.ambient_color + material.intensity +
+           material.diffuse_color * diffuse * material.albedo[0] +
+           material.specular_color * specular * material.albedo[0];
+}
+
+geometry::Vector3D<> CalculateIllumination(const scene::Scene& scene, const geometry::Ray<>& ray,
+                                           bool inside, int ttl, const LightSampling& sampling,
+                                           ShadingRecord* record) {
+    if (ttl < 0) {
+        return geometry::Vector3D<>{0, 0, 0};
+    }
+    return CalculateIllumination(scene, ray, FindClosestIntersectionAndMaterial(scene, ray), inside,
+                                 ttl, sampling, record);
+}
 }  // namespace raytracer
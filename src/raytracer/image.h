@@ -5,6 +5,9 @@
 #include <png.h>
 #include <jpeglib.h>
 
+#include "raytracer/stats.h"
+#include "raytracer/timeline.h"
+
 namespace raytracer {
 struct RGB {
     int r, g, b;
@@ -153,7 +156,11 @@ public:
         fclose(infile);
     }
 
-    void Write(const std::string& filename) {
+    // Adds the encoding time to stats if given.
+    void Write(const std::string& filename, RenderStats* stats = nullptr) {
+        double encode_seconds = 0;
+        StageTimer timer(stats ? stats->encode_seconds : encode_seconds);
+        TraceSpan span("png encode");
         FILE* fp = fopen(filename.c_str(), "wb");
         if (!fp) {
             throw std::runtime_error("Can't open file " + filename);
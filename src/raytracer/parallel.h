@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "raytracer/stats.h"
+#include "raytracer/timeline.h"
+
+namespace raytracer {
+inline std::atomic<size_t>& ThreadCountOverride() {
+    static std::atomic<size_t> count = 0;
+    return count;
+}
+
+// Threads of ParallelFor from now on, zero for the hardware concurrency.
+inline void SetThreadCount(size_t count) {
+    ThreadCountOverride() = count;
+}
+
+inline size_t ThreadCount() {
+    if (size_t count = ThreadCountOverride()) {
+        return count;
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Calls function(i) for every i in [0, count), handing indices out to worker threads one by one.
+// The counters of the workers are added to those of the calling thread.
+template <typename Function>
+void ParallelFor(size_t count, Function&& function) {
+    size_t thread_count = std::min(ThreadCount(), count);
+    if (thread_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            function(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_index = 0;
+    auto& caller_stats = ThreadStats();
+    std::mutex stats_mutex;
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count);
+    for (size_t thread = 0; thread < thread_count; ++thread) {
+        threads.emplace_back([&]() {
+            TraceSpan span("parallel worker");
+            for (size_t i = next_index++; i < count; i = next_index++) {
+                function(i);
+            }
+            if constexpr (kStatsEnabled) {
+                std::lock_guard lock(stats_mutex);
+                caller_stats.AddCounters(ThreadStats());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+}  // namespace raytracer
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/ray.h"
+#include "geometry/geometry.h"
+#include "geometry/bounding_box.h"
+#include "geometry/transform.h"
+#include "scene/scene.h"
+#include "raytracer/raycaster.h"
+
+namespace raytracer {
+// Closest primitive per pixel: distances along the normalized camera rays and primitive ids.
+class VisibilityBuffer {
+public:
+    struct Fragment {
+        double distance = std::numeric_limits<double>::infinity();
+        uint32_t primitive = 0;
+        int32_t instance = -1;  // -1 for world geometry
+        bool silhouette = false;
+    };
+
+public:
+    VisibilityBuffer(int width, int height)
+        : width_(width), height_(height), fragments_(static_cast<size_t>(width) * height) {
+    }
+
+    [[nodiscard]] int Width() const {
+        return width_;
+    }
+
+    [[nodiscard]] int Height() const {
+        return height_;
+    }
+
+    [[nodiscard]] const Fragment& Get(int i, int j) const {
+        return fragments_[static_cast<size_t>(j) * width_ + i];
+    }
+
+    Fragment& Get(int i, int j) {
+        return fragments_[static_cast<size_t>(j) * width_ + i];
+    }
+
+    // Whether pixel (i, j) borders a pixel that sees another primitive or nothing. Coverage may
+    // disagree with the ray test there, so such pixels have to be traced.
+    [[nodiscard]] bool OnSilhouette(int i, int j) const {
+        return Get(i, j).silhouette;
+    }
+
+    void MarkSilhouettes() {
+        auto differ = [](const Fragment& a, const Fragment& b) {
+            return std::isinf(a.distance) != std::isinf(b.distance) ||
+                   (!std::isinf(a.distance) &&
+                    (a.primitive != b.primitive || a.instance != b.instance));
+        };
+        for (int j = 0; j < height_; ++j) {
+            for (int i = 0; i < width_; ++i) {
+                auto& fragment = Get(i, j);
+                for (int dj = -1; dj <= 1 && !fragment.silhouette; ++dj) {
+                    for (int di = -1; di <= 1 && !fragment.silhouette; ++di) {
+                        int ni = i + di, nj = j + dj;
+                        fragment.silhouette = ni >= 0 && ni < width_ && nj >= 0 &&
+                                              nj < height_ && differ(fragment, Get(ni, nj));
+                    }
+                }
+            }
+        }
+    }
+
+    // The hit scene.Intersect reports for ray, the camera ray of pixel (i, j), unless the pixel
+    // is on a silhouette.
+    [[nodiscard]] std::optional<scene::Hit> GetHit(const scene::Scene& scene,
+                                                   const geometry::Ray<>& ray, int i,
+                                                   int j) const {
+        const auto& fragment = Get(i, j);
+        if (std::isinf(fragment.distance)) {
+            return {};
+        }
+        geometry::Ray<> local_ray = ray;
+        if (fragment.instance >= 0) {
+            local_ray = scene.GetInstances()[fragment.instance].world_to_object.ApplyToRay(ray);
+            auto direction = local_ray.GetDirection();
+            local_ray = {local_ray.GetOrigin(), direction.Normalize()};
+        }
+        return scene::Hit{fragment.distance, fragment.primitive, fragment.instance, local_ray};
+    }
+
+private:
+    int width_;
+    int height_;
+    std::vector<Fragment> fragments_;
+};
+
+// Primary visibility of the RayCaster pinhole camera by scan conversion. Triangles are clipped
+// to the near plane, projected and covered by edge functions; the depth of a covered pixel is
+// the exact distance along its camera ray to the triangle plane. Spheres are intersected
+// analytically with the camera rays inside their projected bounds.
+class Rasterizer {
+public:
+    explicit Rasterizer(const RayCaster& ray_caster)
+        : ray_caster_(ray_caster),
+          right_(ray_caster.GetRight() / DotProduct(ray_caster.GetRight(), ray_caster.GetRight())),
+          up_(ray_caster.GetUp() / DotProduct(ray_caster.GetUp(), ray_caster.GetUp())) {
+    }
+
+public:
+    [[nodiscard]] VisibilityBuffer Rasterize(const scene::Scene& scene) const {
+        VisibilityBuffer buffer(ray_caster_.screen_width_, ray_caster_.screen_height_);
+        DrawMesh(scene.GetWorld(), -1, nullptr, buffer);
+        const auto& instances = scene.GetInstances();
+        for (size_t i = 0; i < instances.size(); ++i) {
+            DrawMesh(scene.GetMeshes()[instances[i].mesh], static_cast<int32_t>(i), &instances[i],
+                     buffer);
+        }
+        buffer.MarkSilhouettes();
+        return buffer;
+    }
+
+private:
+    static constexpr double kNearPlane = 1e-6;
+
+    void DrawMesh(const scene::Mesh& mesh, int32_t instance_index, const scene::Instance* instance,
+                  VisibilityBuffer& buffer) const {
+        for (size_t i = 0; i < mesh.objects.size(); ++i) {
+            std::array<geometry::Vector3D<>, 3> vertices;
+            for (size_t k = 0; k < 3; ++k) {
+                vertices[k] = mesh.objects[i].polygon.GetVertex(k);
+                if (instance) {
+                    vertices[k] = instance->object_to_world.ApplyToPoint(vertices[k]);
+                }
+            }
+            DrawTriangle(vertices, static_cast<uint32_t>(i), instance_index, buffer);
+        }
+        for (size_t i = 0; i < mesh.sphere_objects.size(); ++i) {
+            DrawSphere(mesh.sphere_objects[i].sphere,
+                       static_cast<uint32_t>(mesh.objects.size() + i), instance_index, instance,
+                       buffer);
+        }
+    }
+
+    // Pixel coordinates scaled by depth, and the depth along the view direction.
+    [[nodiscard]] geometry::Vector3D<> ToCamera(const geometry::Vector3D<>& point) const {
+        auto relative = point - ray_caster_.GetOrigin();
+        return {DotProduct(relative, right_), DotProduct(relative, up_),
+                -DotProduct(relative, ray_caster_.GetBackward())};
+    }
+
+    [[nodiscard]] std::array<double, 2> ToScreen(const geometry::Vector3D<>& camera_point) const {
+        return {camera_point[0] / camera_point[2] + (ray_caster_.screen_width_ - 1) / 2.0,
+                camera_point[1] / camera_point[2] + (ray_caster_.screen_height_ - 1) / 2.0};
+    }
+
+    void DrawTriangle(const std::array<geometry::Vector3D<>, 3>& vertices, uint32_t primitive,
+                      int32_t instance, VisibilityBuffer& buffer) const {
+        // Clipping a triangle to one plane leaves at most a quad.
+        std::array<std::array<double, 2>, 4> polygon;
+        size_t size = 0;
+        for (size_t k = 0; k < 3; ++k) {
+            auto current = ToCamera(vertices[k]);
+            auto next = ToCamera(vertices[(k + 1) % 3]);
+            if (current[2] >= kNearPlane) {
+                polygon[size++] = ToScreen(current);
+            }
+            if ((current[2] >= kNearPlane) != (next[2] >= kNearPlane)) {
+                double t = (kNearPlane - current[2]) / (next[2] - current[2]);
+                polygon[size++] = ToScreen(current + (next - current) * t);
+            }
+        }
+        if (size < 3) {
+            return;
+        }
+
+        double area = 0;
+        std::array<double, 2> min = polygon[0], max = polygon[0];
+        for (size_t k = 0; k < size; ++k) {
+            const auto& a = polygon[k];
+            const auto& b = polygon[(k + 1) % size];
+            area += a[0] * b[1] - b[0] * a[1];
+            for (int axis = 0; axis < 2; ++axis) {
+                min[axis] = std::min(min[axis], a[axis]);
+                max[axis] = std::max(max[axis], a[axis]);
+            }
+        }
+        if (area == 0) {
+            return;  // seen edge on
+        }
+        double orientation = area > 0 ? 1 : -1;
+
+        auto normal = CrossProduct(vertices[1] - vertices[0], vertices[2] - vertices[0]);
+        double plane_offset = DotProduct(normal, vertices[0] - ray_caster_.GetOrigin());
+
+        auto [i_begin, i_end] = GetPixelRange(min[0], max[0], buffer.Width());
+        auto [j_begin, j_end] = GetPixelRange(min[1], max[1], buffer.Height());
+        for (int j = j_begin; j < j_end; ++j) {
+            for (int i = i_begin; i < i_end; ++i) {
+                bool covered = true;
+                for (size_t k = 0; k < size && covered; ++k) {
+                    const auto& a = polygon[k];
+                    const auto& b = polygon[(k + 1) % size];
+                    double edge = (b[0] - a[0]) * (j - a[1]) - (b[1] - a[1]) * (i - a[0]);
+                    covered = edge * orientation >= 0;
+                }
+                if (!covered) {
+                    continue;
+                }
+                double denominator = DotProduct(normal, ray_caster_(i, j).GetDirection());
+                if (denominator == 0) {
+                    continue;
+                }
+                double distance = plane_offset / denominator;
+                auto& fragment = buffer.Get(i, j);
+                if (distance > 0 && distance < fragment.distance) {
+                    fragment = {distance, primitive, instance};
+                }
+            }
+        }
+    }
+
+    void DrawSphere(const geometry::Sphere<>& sphere, uint32_t primitive, int32_t instance_index,
+                    const scene::Instance* instance, VisibilityBuffer& buffer) const {
+        auto bounds = GetBoundingBox(sphere);
+        if (instance) {
+            bounds = instance->object_to_world.ApplyToBox(bounds);
+        }
+
+        // Projected corners of the bounds, or the whole screen if they reach behind the camera.
+        std::array<double, 2> min = {0, 0};
+        std::array<double, 2> max = {static_cast<double>(buffer.Width() - 1),
+                                     static_cast<double>(buffer.Height() - 1)};
+        bool in_front = true;
+        std::array<double, 2> corners_min = {std::numeric_limits<double>::infinity(),
+                                             std::numeric_limits<double>::infinity()};
+        std::array<double, 2> corners_max = {-corners_min[0], -corners_min[1]};
+        for (int corner = 0; corner < 8 && in_front; ++corner) {
+            auto camera_point = ToCamera(
+                {(corner & 1) ? bounds.GetMax()[0] : bounds.GetMin()[0],
+                 (corner & 2) ? bounds.GetMax()[1] : bounds.GetMin()[1],
+                 (corner & 4) ? bounds.GetMax()[2] : bounds.GetMin()[2]});
+            in_front = camera_point[2] >= kNearPlane;
+            auto screen = ToScreen(camera_point);
+            for (int axis = 0; axis < 2; ++axis) {
+                corners_min[axis] = std::min(corners_min[axis], screen[axis]);
+                corners_max[axis] = std::max(corners_max[axis], screen[axis]);
+            }
+        }
+        if (in_front) {
+            min = corners_min;
+            max = corners_max;
+        }
+
+        auto [i_begin, i_end] = GetPixelRange(min[0], max[0], buffer.Width());
+        auto [j_begin, j_end] = GetPixelRange(min[1], max[1], buffer.Height());
+        for (int j = j_begin; j < j_end; ++j) {
+            for (int i = i_begin; i < i_end; ++i) {
+                auto ray = ray_caster_(i, j);
+                double scale = 1;
+                if (instance) {
+                    ray = instance->world_to_object.ApplyToRay(ray);
+                    auto direction = ray.GetDirection();
+                    scale = Length(direction);
+                    ray = {ray.GetOrigin(), direction / scale};
+                }
+                auto intersection = GetIntersection(ray, sphere);
+                if (!intersection) {
+                    continue;
+                }
+                double distance = intersection->GetDistance() / scale;
+                auto& fragment = buffer.Get(i, j);
+                if (distance < fragment.distance) {
+                    fragment = {distance, primitive, instance_index};
+                }
+            }
+        }
+    }
+
+    // Pixel centers sit at integer coordinates.
+    static std::pair<int, int> GetPixelRange(double min, double max, int size) {
+        auto begin = static_cast<int>(std::clamp(std::ceil(min), 0.0, static_cast<double>(size)));
+        auto end =
+            static_cast<int>(std::clamp(std::floor(max) + 1, 0.0, static_cast<double>(size)));
+        return {begin, end};
+    }
+
+private:
+    RayCaster ray_caster_;
+    geometry::Vector3D<> right_;
+    geometry::Vector3D<> up_;
+};
+}  // namespace raytracer
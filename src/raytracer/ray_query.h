@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "geometry/ray.h"
+#include "geometry/vector.h"
+#include "scene/scene.h"
+#include "raytracer/illumination.h"
+#include "raytracer/parallel.h"
+
+// Batch ray queries against a loaded scene for visibility and distance computations outside of
+// rendering. Rays and results are structures of arrays; distances are measured along the
+// normalized direction and a ray only accepts hits with t_min <= distance <= t_max.
+namespace raytracer {
+struct RayBatch {
+    std::vector<double> origin_x;
+    std::vector<double> origin_y;
+    std::vector<double> origin_z;
+    std::vector<double> direction_x;
+    std::vector<double> direction_y;
+    std::vector<double> direction_z;
+    std::vector<double> t_min;
+    std::vector<double> t_max;
+
+    [[nodiscard]] size_t Size() const {
+        return origin_x.size();
+    }
+
+    void Add(const geometry::Vector3D<>& origin, const geometry::Vector3D<>& direction,
+             double min_distance = 0,
+             double max_distance = std::numeric_limits<double>::infinity()) {
+        origin_x.push_back(origin[0]);
+        origin_y.push_back(origin[1]);
+        origin_z.push_back(origin[2]);
+        direction_x.push_back(direction[0]);
+        direction_y.push_back(direction[1]);
+        direction_z.push_back(direction[2]);
+        t_min.push_back(min_distance);
+        t_max.push_back(max_distance);
+    }
+};
+
+// Closest hits; a miss has infinite distance and -1 ids.
+struct HitBatch {
+    std::vector<double> distance;
+    std::vector<int64_t> primitive;  // triangles of the hit mesh first, then its spheres
+    std::vector<int32_t> instance;   // -1 for world geometry
+    std::vector<int32_t> material;   // index into Scene::GetMaterialNames
+    std::vector<double> normal_x;    // shading normal as the renderer sees it
+    std::vector<double> normal_y;
+    std::vector<double> normal_z;
+};
+
+// Rays are handed to the threads in chunks, an index at a time is too fine grained.
+constexpr size_t kRayQueryChunk = 1024;
+
+template <typename Function>
+void ForEachRay(size_t count, Function&& function) {
+    ParallelFor((count + kRayQueryChunk - 1) / kRayQueryChunk, [&](size_t chunk) {
+        auto end = std::min(count, (chunk + 1) * kRayQueryChunk);
+        for (size_t i = chunk * kRayQueryChunk; i < end; ++i) {
+            function(i);
+        }
+    });
+}
+
+// Ray i of the batch moved to start at t_min, hits up to distance length of it count.
+struct BatchRay {
+    geometry::Ray<> ray;
+    double t_min;
+    double length;
+};
+
+inline std::optional<BatchRay> GetBatchRay(const RayBatch& rays, size_t i) {
+    geometry::Vector3D<> direction{rays.direction_x[i], rays.direction_y[i], rays.direction_z[i]};
+    direction.Normalize();
+    geometry::Vector3D<> origin{rays.origin_x[i], rays.origin_y[i], rays.origin_z[i]};
+    double t_min = std::max(rays.t_min[i], 0.0);
+    if (rays.t_max[i] < t_min) {
+        return std::nullopt;
+    }
+    return BatchRay{{origin + direction * t_min, direction}, t_min, rays.t_max[i] - t_min};
+}
+
+inline std::optional<scene::Hit> IntersectBatchRay(const scene::Scene& scene,
+                                                   const RayBatch& rays, size_t i) {
+    auto batch_ray = GetBatchRay(rays, i);
+    if (!batch_ray) {
+        return std::nullopt;
+    }
+    auto hit = scene.Intersect(batch_ray->ray, batch_ray->length);
+    if (hit) {
+        hit->distance += batch_ray->t_min;
+    }
+    return hit;
+}
+
+inline HitBatch IntersectRays(const scene::Scene& scene, const RayBatch& rays) {
+    std::map<const scene::Material*, int32_t> material_ids;
+    auto names = scene.GetMaterialNames();
+    for (size_t id = 0; id < names.size(); ++id) {
+        material_ids[scene.GetMaterial(names[id])] = static_cast<int32_t>(id);
+    }
+
+    size_t count = rays.Size();
+    HitBatch hits{std::vector<double>(count, std::numeric_limits<double>::infinity()),
+                  std::vector<int64_t>(count, -1),
+                  std::vector<int32_t>(count, -1),
+                  std::vector<int32_t>(count, -1),
+                  std::vector<double>(count, 0),
+                  std::vector<double>(count, 0),
+                  std::vector<double>(count, 0)};
+    ForEachRay(count, [&](size_t i) {
+        auto hit = IntersectBatchRay(scene, rays, i);
+        if (!hit) {
+            return;
+        }
+        hits.distance[i] = hit->distance;
+        hits.primitive[i] = static_cast<int64_t>(hit->primitive);
+        hits.instance[i] = hit->instance;
+        auto [intersection, material] = GetIntersectionAndMaterial(scene, *hit);
+        if (auto it = material_ids.find(material); it != material_ids.end()) {
+            hits.material[i] = it->second;
+        }
+        if (intersection) {
+            const auto& normal = intersection->GetNormal();
+            hits.normal_x[i] = normal[0];
+            hits.normal_y[i] = normal[1];
+            hits.normal_z[i] = normal[2];
+        }
+    });
+    return hits;
+}
+
+// Whether anything blocks each ray within [t_min, t_max], for line of sight queries. The search
+// of a ray stops at the first blocker.
+inline std::vector<uint8_t> OccludedRays(const scene::Scene& scene, const RayBatch& rays) {
+    std::vector<uint8_t> occluded(rays.Size(), 0);
+    ForEachRay(rays.Size(), [&](size_t i) {
+        auto batch_ray = GetBatchRay(rays, i);
+        occluded[i] = batch_ray && scene.Occluded(batch_ray->ray, batch_ray->length);
+    });
+    return occluded;
+}
+}  // namespace raytracer
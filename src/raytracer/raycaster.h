@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <optional>
+
 #include "geometry/vector.h"
 #include "raytracer/camera_options.h"
 
@@ -36,15 +39,56 @@ public:
 
 public:
     geometry::Ray<> operator()(int horizontal_pixel_index, int vertical_pixel_index) const {
+        return (*this)(horizontal_pixel_index, vertical_pixel_index, 0, 0);
+    }
+
+    // Ray through the point of the pixel offset from its center by a fraction of the pixel size.
+    geometry::Ray<> operator()(int horizontal_pixel_index, int vertical_pixel_index,
+                               double horizontal_offset, double vertical_offset) const {
         auto direction =
-            (static_cast<double>((2 * horizontal_pixel_index - screen_width_ + 1)) / 2) *
+            (static_cast<double>((2 * horizontal_pixel_index - screen_width_ + 1)) / 2 +
+             horizontal_offset) *
                 right_unit_ +
-            (static_cast<double>((2 * vertical_pixel_index - screen_height_ + 1)) / 2) * up_unit_ -
+            (static_cast<double>((2 * vertical_pixel_index - screen_height_ + 1)) / 2 +
+             vertical_offset) *
+                up_unit_ -
             backward_unit_;
         direction.Normalize();
         return {origin_, direction};
     }
 
+    // Pixel coordinates of the camera ray through point, if the point lies in front of the camera.
+    [[nodiscard]] std::optional<std::array<double, 2>> Project(
+        const geometry::Vector3D<>& point) const {
+        auto relative = point - origin_;
+        double depth = -DotProduct(relative, backward_unit_);
+        if (depth <= 0) {
+            return {};
+        }
+        return std::array<double, 2>{
+            DotProduct(relative, right_unit_) / DotProduct(right_unit_, right_unit_) / depth +
+                (screen_width_ - 1) / 2.0,
+            DotProduct(relative, up_unit_) / DotProduct(up_unit_, up_unit_) / depth +
+                (screen_height_ - 1) / 2.0};
+    }
+
+    // Camera frame: the right and up vectors are one pixel long at unit distance.
+    [[nodiscard]] const geometry::Vector3D<>& GetOrigin() const {
+        return origin_;
+    }
+
+    [[nodiscard]] const geometry::Vector3D<>& GetRight() const {
+        return right_unit_;
+    }
+
+    [[nodiscard]] const geometry::Vector3D<>& GetUp() const {
+        return up_unit_;
+    }
+
+    [[nodiscard]] const geometry::Vector3D<>& GetBackward() const {
+        return backward_unit_;
+    }
+
 public:
     int screen_height_;
     int screen_width_;
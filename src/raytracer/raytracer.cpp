@@ -1,5 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -10,14 +16,26 @@
 #include "raytracer/camera_options.h"
 #include "raytracer/render_options.h"
 #include "raytracer/raycaster.h"
+#include "raytracer/rasterizer.h"
+#include "raytracer/deadline.h"
+#include "raytracer/parallel.h"
+#include "raytracer/region.h"
+#include "raytracer/stats.h"
+#include "raytracer/timeline.h"
 
 namespace raytracer {
-void ToneMappingAndGammaCorrection(std::vector<std::vector<geometry::Vector3D<>>>& pixels) {
-    double coefficient = 0;
-    for (int i = 0; i < pixels.size(); ++i) {
-        for (int j = 0; j < pixels[0].size(); ++j) {
-            for (int color_index = 0; color_index < 3; ++color_index) {
-                coefficient = std::max(coefficient, pixels[i][j][color_index]);
+// Receives a preview image and the number of pixels traced so far.
+using PreviewCallback = std::function<void(const Image&, size_t)>;
+
+// Maps radiance coefficient, by default the brightest one of the pixels, to white.
+void ToneMappingAndGammaCorrection(std::vector<std::vector<geometry::Vector3D<>>>& pixels,
+                                   double coefficient = 0) {
+    if (coefficient == 0) {
+        for (int i = 0; i < pixels.size(); ++i) {
+            for (int j = 0; j < pixels[0].size(); ++j) {
+                for (int color_index = 0; color_index < 3; ++color_index) {
+                    coefficient = std::max(coefficient, pixels[i][j][color_index]);
+                }
             }
         }
     }
@@ -35,157 +53,914 @@ void ToneMappingAndGammaCorrection(std::vector<std::vector<geometry::Vector3D<>>
     }
 }
 
+// Raw per pixel values indexed [column][row]: distance, normal, radiance or the intersection
+// tests, rays and nanoseconds spent depending on mode.
+using PixelValues = std::vector<std::vector<geometry::Vector3D<>>>;
+
+Image BuildDepthImage(PixelValues& depths, double max_depth) {
+    Image image(static_cast<int>(depths.size()), static_cast<int>(depths[0].size()));
+    for (int i = 0; i < image.Width(); ++i) {
+        for (int j = 0; j < image.Height(); ++j) {
+            // Normalize, misses are white
+            double depth = depths[i][j][0] == 0 ? 1 : depths[i][j][0] / max_depth;
+            int brightness = static_cast<int>((depth - kEpsilon) * 256);
+            image.SetPixel({brightness, brightness, brightness}, j, i);
+        }
+    }
+    return image;
+}
+
+Image BuildNormalImage(PixelValues& normals) {
+    Image image(static_cast<int>(normals.size()), static_cast<int>(normals[0].size()));
+    for (int i = 0; i < image.Width(); ++i) {
+        for (int j = 0; j < image.Height(); ++j) {
+            // Normalize
+            auto normal = normals[i][j] / 2 + geometry::Vector3D<>{0.5, 0.5, 0.5};
+
+            int red = static_cast<int>((normal[0] - kEpsilon) * 256);
+            int green = static_cast<int>((normal[1] - kEpsilon) * 256);
+            int blue = static_cast<int>((normal[2] - kEpsilon) * 256);
+            image.SetPixel({red, green, blue}, j, i);
+        }
+    }
+    return image;
+}
+
+Image BuildFullImage(PixelValues& pseudo_pixels, double white) {
+    Image image(static_cast<int>(pseudo_pixels.size()),
+                static_cast<int>(pseudo_pixels[0].size()));
+    // Normalize
+    ToneMappingAndGammaCorrection(pseudo_pixels, white);
+    // Build pixels
+    for (int i = 0; i < image.Width(); ++i) {
+        for (int j = 0; j < image.Height(); ++j) {
+            auto pseudo_pixel = pseudo_pixels[i][j];
+
+            int red = static_cast<int>((pseudo_pixel[0] - kEpsilon) * 256);
+            int green = static_cast<int>((pseudo_pixel[1] - kEpsilon) * 256);
+            int blue = static_cast<int>((pseudo_pixel[2] - kEpsilon) * 256);
+            image.SetPixel({red, green, blue}, j, i);
+        }
+    }
+    return image;
+}
+
+// Color of t in [0, 1], interpolated between the stops of the map.
+RGB ApplyColorMap(ColorMap map, double t) {
+    static const std::vector<geometry::Vector3D<>> kGrayscale = {{0, 0, 0}, {1, 1, 1}};
+    static const std::vector<geometry::Vector3D<>> kHeat = {
+        {0, 0, 0}, {0.5, 0, 0.6}, {0.9, 0.1, 0.1}, {1, 0.8, 0}, {1, 1, 1}};
+    static const std::vector<geometry::Vector3D<>> kViridis = {{0.267, 0.005, 0.329},
+                                                               {0.231, 0.322, 0.545},
+                                                               {0.128, 0.567, 0.551},
+                                                               {0.369, 0.789, 0.383},
+                                                               {0.993, 0.906, 0.144}};
+    const auto& stops = map == ColorMap::kGrayscale ? kGrayscale
+                        : map == ColorMap::kHeat    ? kHeat
+                                                    : kViridis;
+    double position = std::clamp(t, 0.0, 1.0) * static_cast<double>(stops.size() - 1);
+    auto index = std::min(static_cast<size_t>(position), stops.size() - 2);
+    double fraction = position - static_cast<double>(index);
+    auto color = stops[index] * (1 - fraction) + stops[index + 1] * fraction;
+    return {static_cast<int>((color[0] - kEpsilon) * 256),
+            static_cast<int>((color[1] - kEpsilon) * 256),
+            static_cast<int>((color[2] - kEpsilon) * 256)};
+}
+
+// Channel of the cost values of a pixel holding metric.
+size_t GetCostChannel(CostMetric metric) {
+    return static_cast<size_t>(metric);
+}
+
+Image BuildCostImage(PixelValues& costs, CostMetric metric, double max_cost, ColorMap map) {
+    Image image(static_cast<int>(costs.size()), static_cast<int>(costs[0].size()));
+    auto channel = GetCostChannel(metric);
+    for (int i = 0; i < image.Width(); ++i) {
+        for (int j = 0; j < image.Height(); ++j) {
+            image.SetPixel(ApplyColorMap(map, max_cost == 0 ? 0 : costs[i][j][channel] / max_cost),
+                           j, i);
+        }
+    }
+    return image;
+}
+
+// Image of raw per pixel values. A zero normalization is replaced by the maximum of the values,
+// the distance, radiance or cost mapped to white or the end of the color map.
+Image BuildImageFromValues(PixelValues values, RenderMode mode, double& normalization,
+                           CostMetric metric = CostMetric::kNanoseconds,
+                           ColorMap map = ColorMap::kHeat) {
+    if (normalization == 0) {
+        for (const auto& column : values) {
+            for (const auto& value : column) {
+                switch (mode) {
+                    case RenderMode::kDepth:
+                        normalization = std::max(normalization, value[0]);
+                        break;
+                    case RenderMode::kCost:
+                        normalization = std::max(normalization, value[GetCostChannel(metric)]);
+                        break;
+                    default:
+                        normalization = std::max({normalization, value[0], value[1], value[2]});
+                }
+            }
+        }
+    }
+    switch (mode) {
+        case RenderMode::kDepth:
+            return BuildDepthImage(values, normalization);
+        case RenderMode::kNormal:
+            return BuildNormalImage(values);
+        case RenderMode::kFull:
+            return BuildFullImage(values, normalization);
+        case RenderMode::kCost:
+            return BuildCostImage(values, metric, normalization, map);
+        default:
+            throw std::runtime_error("Bad render mode");
+    }
+}
+
+// Image of row-major RGB floats as produced by Raytracer::TraceRegion for the whole frame.
+Image BuildImageFromFloats(const std::vector<float>& floats, int width, int height,
+                           RenderMode mode, double normalization,
+                           CostMetric metric = CostMetric::kNanoseconds,
+                           ColorMap map = ColorMap::kHeat) {
+    PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+    auto value = floats.begin();
+    for (int j = 0; j < height; ++j) {
+        for (int i = 0; i < width; ++i) {
+            for (int channel = 0; channel < 3; ++channel) {
+                values[i][j][channel] = *value++;
+            }
+        }
+    }
+    return BuildImageFromValues(std::move(values), mode, normalization, metric, map);
+}
+
+// Raw cost values indexed [column][row] as CSV lines "x,y,intersection_tests,rays,nanoseconds".
+void WriteCostValues(std::ostream& out, const PixelValues& costs) {
+    out << "x,y,intersection_tests,rays,nanoseconds\n";
+    for (size_t j = 0; j < (costs.empty() ? 0 : costs[0].size()); ++j) {
+        for (size_t i = 0; i < costs.size(); ++i) {
+            out << i << ',' << j << ',' << costs[i][j][0] << ',' << costs[i][j][1] << ','
+                << costs[i][j][2] << '\n';
+        }
+    }
+}
+
+// Thrown by Render once its cancellation flag is set.
+class RenderCancelled : public std::runtime_error {
+public:
+    RenderCancelled() : std::runtime_error("Render cancelled") {
+    }
+};
+
 class Raytracer {
 public:
     Raytracer(const std::string& filename, const CameraOptions& camera_options,
               const RenderOptions& render_options)
-        : scene_(scene::ReadScene(filename)),
+        : owned_scene_(LoadScene(filename, render_options)),
+          scene_(*owned_scene_),
+          render_options_(render_options),
+          ray_caster_(camera_options) {
+        stats_.load_seconds = ThreadStats().load_seconds;
+        stats_.build_seconds = ThreadStats().build_seconds;
+    }
+
+    // Renders a scene loaded before, which several raytracers may share as long as none of them
+    // edits it.
+    Raytracer(std::shared_ptr<scene::Scene> scene, const CameraOptions& camera_options,
+              const RenderOptions& render_options)
+        : owned_scene_(std::move(scene)),
+          scene_(*owned_scene_),
           render_options_(render_options),
           ray_caster_(camera_options) {
     }
 
 public:
     Image Render() {
-        switch (render_options_.mode) {
-            case RenderMode::kDepth:
-                return RenderDepth();
-            case RenderMode::kNormal:
-                return RenderNormal();
-            case RenderMode::kFull:
-                return RenderFull();
-            default:
-                throw std::runtime_error("Bad render mode");
+        ThrowIfCancelled();
+        TraceSpan span("render");
+        ThreadStats() = {};
+        stats_.tone_map_seconds = 0;
+        auto trace_start = std::chrono::steady_clock::now();
+        PrepareFrame();
+        int width = ray_caster_.screen_width_;
+        int height = ray_caster_.screen_height_;
+        PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+        std::vector<std::vector<Surface>> surfaces(width, std::vector<Surface>(height));
+        bool full = render_options_.mode == RenderMode::kFull;
+        bool track = render_options_.track_dependencies && full;
+        bool reuse = render_options_.temporal_reuse && full && !track;
+        reused_pixels_ = 0;
+        records_.clear();
+        if (track) {
+            records_.assign(width, std::vector<ShadingRecord>(height));
+        }
+        std::vector<CachedSample> reprojected;
+        if (reuse) {
+            reprojected = Reproject();
+            history_.assign(static_cast<size_t>(width) * height, {});
+        } else {
+            history_.clear();
         }
-    }
 
-private:
-    Image RenderDepth() {
-        Image image(ray_caster_.screen_width_, ray_caster_.screen_height_);
-        image.PrepareImage(image.Width(), image.Height());
-
-        std::vector<std::vector<double>> depths(image.Width(), std::vector<double>(image.Width()));
-        double max_depth = 0;
-
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                auto cast_ray = ray_caster_(i, j);
-                auto possible_intersection =
-                    FindClosestIntersectionAndMaterial(scene_, cast_ray).first;
-
-                if (possible_intersection) {
-                    depths[i][j] = possible_intersection.value().GetDistance();
-                    max_depth = std::max(depths[i][j], max_depth);
-                } else {
-                    depths[i][j] = 0;
+        // Tiles go to the worker threads; pixels are traced independently, so the image does
+        // not depend on their number. Workers skip their tiles once cancelled.
+        auto tiles = SplitIntoTiles(width, height, render_options_.tile_size);
+        std::atomic<size_t> reused_pixels = 0;
+        ParallelFor(tiles.size(), [&](size_t index) {
+            if (IsCancelled()) {
+                return;
+            }
+            TraceSpan tile_span("tile");
+            const auto& tile = tiles[index];
+            size_t reused = 0;
+            for (int i = tile.x; i < tile.x + tile.width; ++i) {
+                for (int j = tile.y; j < tile.y + tile.height; ++j) {
+                    if (reuse) {
+                        size_t pixel = static_cast<size_t>(j) * width + i;
+                        values[i][j] = TraceOrReusePixel(i, j, reprojected[pixel],
+                                                         history_[pixel], &surfaces[i][j], reused);
+                    } else {
+                        values[i][j] = TracePixel(i, j, RequestedQuality(), &surfaces[i][j],
+                                                  track ? &records_[i][j] : nullptr);
+                    }
                 }
             }
+            reused_pixels += reused;
+        });
+        ThrowIfCancelled();
+        reused_pixels_ = reused_pixels;
+        if (track) {
+            shaded_values_ = values;
         }
-        // Normalize
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                if (depths[i][j] == 0) {
-                    depths[i][j] = 1;
-                } else {
-                    depths[i][j] /= max_depth;
+        if (render_options_.mode == RenderMode::kCost) {
+            cost_values_ = values;
+        }
+        antialiased_pixels_ = 0;
+        if (Antialiased()) {
+            Antialias(values, surfaces, {0, 0, width, height}, {0, 0, width, height});
+        }
+        stats_.trace_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - trace_start).count();
+        stats_.TakeCounters(ThreadStats());
+        return BuildImage(values);
+    }
+
+    // Traces every pixel exactly once, in passes over grids of halving step. After each pass the
+    // pixels traced so far are upsampled to a full preview, the last one being the final image.
+    Image RenderProgressive(const PreviewCallback& on_preview, int initial_step = 8) {
+        PrepareFrame();
+        int width = ray_caster_.screen_width_;
+        int height = ray_caster_.screen_height_;
+        PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+        size_t traced_pixels = 0;
+
+        int first_step = 1;
+        while (first_step < initial_step) {
+            first_step *= 2;
+        }
+        for (int step = first_step; step >= 1; step /= 2) {
+            for (int i = 0; i < width; i += step) {
+                for (int j = 0; j < height; j += step) {
+                    bool traced_before =
+                        step < first_step && i % (2 * step) == 0 && j % (2 * step) == 0;
+                    if (!traced_before) {
+                        values[i][j] = TracePixel(i, j, RequestedQuality());
+                        ++traced_pixels;
+                    }
                 }
             }
+            if (step == 1) {
+                break;
+            }
+
+            auto preview = values;
+            for (int i = 0; i < width; ++i) {
+                for (int j = 0; j < height; ++j) {
+                    preview[i][j] = values[i - i % step][j - j % step];
+                }
+            }
+            on_preview(BuildImage(preview), traced_pixels);
         }
 
-        // Build pixels
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                int brightness = static_cast<int>((depths[i][j] - kEpsilon) * 256);
-                image.SetPixel({brightness, brightness, brightness}, j, i);
+        auto image = BuildImage(values);
+        on_preview(image, traced_pixels);
+        return image;
+    }
+
+    // Renders tile by tile within budget_seconds of wall-clock time. Every tile gets its share of
+    // the remaining budget and the best quality of GetQualityLadder whose measured cost per pixel
+    // fits into it; qualities not measured yet are tried when the previous tile left room. Only
+    // full renders have anything to degrade.
+    Image RenderWithDeadline(double budget_seconds, DeadlineReport& report) {
+        using Clock = std::chrono::steady_clock;
+        auto start = Clock::now();
+        auto elapsed = [&] { return std::chrono::duration<double>(Clock::now() - start).count(); };
+
+        PrepareFrame();
+        int width = ray_caster_.screen_width_;
+        int height = ray_caster_.screen_height_;
+        PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+        auto ladder = render_options_.mode == RenderMode::kFull
+                          ? GetQualityLadder(render_options_.depth, scene_.GetLights().size())
+                          : std::vector<TileQuality>{RequestedQuality()};
+        report = {budget_seconds, 0, RequestedQuality(), {}};
+
+        // Seconds per pixel last measured for every quality, zero if not tried yet.
+        std::vector<double> costs(ladder.size(), 0);
+        double tile_budget_left = budget_seconds * (1 - kFinishingReserve);
+        size_t level = 0;
+        auto remaining_pixels = static_cast<double>(width) * height;
+        for (int y = 0; y < height; y += render_options_.tile_size) {
+            for (int x = 0; x < width; x += render_options_.tile_size) {
+                int tile_width = std::min(render_options_.tile_size, width - x);
+                int tile_height = std::min(render_options_.tile_size, height - y);
+                double tile_pixels = tile_width * tile_height;
+                double tile_start = elapsed();
+                double tile_budget =
+                    std::max(0.0, tile_budget_left - tile_start) * tile_pixels / remaining_pixels;
+
+                if (tile_budget == 0) {
+                    level = ladder.size() - 1;
+                }
+                while (level + 1 < ladder.size() && costs[level] * tile_pixels > tile_budget) {
+                    ++level;
+                }
+                while (level > 0 && costs[level - 1] * tile_pixels < tile_budget) {
+                    --level;
+                }
+
+                {
+                    TraceSpan span("tile");
+                    for (int i = x; i < x + tile_width; ++i) {
+                        for (int j = y; j < y + tile_height; ++j) {
+                            values[i][j] = TracePixel(i, j, ladder[level]);
+                        }
+                    }
+                }
+                double tile_seconds = elapsed() - tile_start;
+                costs[level] = tile_seconds / tile_pixels;
+                report.tiles.push_back(
+                    {x, y, tile_width, tile_height, ladder[level], tile_seconds});
+                remaining_pixels -= tile_pixels;
             }
         }
 
+        auto image = BuildImage(values);
+        report.seconds = elapsed();
         return image;
     }
 
-    Image RenderNormal() {
-        Image image(ray_caster_.screen_width_, ray_caster_.screen_height_);
-        image.PrepareImage(image.Width(), image.Height());
+    // Traces only the camera rays of region, with the same camera as the full frame, and returns
+    // the crop. Antialiasing traces a one pixel border as well.
+    Image RenderRegion(const Region& region) {
+        if (!region.Inside(ray_caster_.screen_width_, ray_caster_.screen_height_)) {
+            throw std::runtime_error("Region outside the image");
+        }
+        return BuildImage(TraceRegionValues(region));
+    }
+
+    // Raw values of region row by row, three floats per pixel, for distributed rendering.
+    [[nodiscard]] std::vector<float> TraceRegion(const Region& region) {
+        if (!region.Inside(ray_caster_.screen_width_, ray_caster_.screen_height_)) {
+            throw std::runtime_error("Region outside the image");
+        }
+        auto values = TraceRegionValues(region);
+        std::vector<float> floats;
+        floats.reserve(static_cast<size_t>(region.width) * region.height * 3);
+        for (int j = 0; j < region.height; ++j) {
+            for (int i = 0; i < region.width; ++i) {
+                for (int k = 0; k < 3; ++k) {
+                    floats.push_back(static_cast<float>(values[i][j][k]));
+                }
+            }
+        }
+        return floats;
+    }
 
-        std::vector<std::vector<geometry::Vector3D<>>> normals(
-            image.Width(), std::vector<geometry::Vector3D<>>(image.Width()));
+    // Renders region into its place of frame, a full size image.
+    void RenderRegion(const Region& region, Image& frame) {
+        if (frame.Width() != ray_caster_.screen_width_ ||
+            frame.Height() != ray_caster_.screen_height_) {
+            throw std::runtime_error("Frame size differs from the camera image");
+        }
+        auto crop = RenderRegion(region);
+        for (int i = 0; i < region.width; ++i) {
+            for (int j = 0; j < region.height; ++j) {
+                frame.SetPixel(crop.GetPixel(j, i), region.y + j, region.x + i);
+            }
+        }
+    }
 
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                auto cast_ray = ray_caster_(i, j);
-                // Check all possible intersections
-                auto possible_intersection =
-                    FindClosestIntersectionAndMaterial(scene_, cast_ray).first;
+    // Normalization the last image was built with, to render matching crops.
+    [[nodiscard]] double GetNormalization() const {
+        return normalization_;
+    }
 
-                if (possible_intersection) {
-                    // Save pixel value
-                    normals[i][j] = possible_intersection.value().GetNormal();
+    // Changes a material and re-shades the pixels whose paths hit it or were shadowed by it.
+    // Pixels that only see it at their primary hit get their ambient, diffuse and specular terms
+    // evaluated again from the recorded light reach, unless the edit changes the reflected or
+    // refracted rays.
+    Image UpdateMaterial(const std::string& name, const scene::Material& material) {
+        const auto* edited = scene_.GetMaterial(name);
+        auto previous = *edited;
+        scene_.SetMaterial(name, material);
+        if (records_.empty()) {
+            return Render();
+        }
+        bool direct_only = ChangesDirectTermsOnly(previous, material);
+        reshaded_pixels_ = 0;
+        for (int i = 0; i < ray_caster_.screen_width_; ++i) {
+            for (int j = 0; j < ray_caster_.screen_height_; ++j) {
+                auto& record = records_[i][j];
+                if (!record.DependsOn(edited)) {
+                    continue;
+                }
+                if (direct_only && record.primary && record.primary->material == edited &&
+                    record.primary_material_repeats == 0) {
+                    ReshadePrimary(record, previous, material, shaded_values_[i][j]);
                 } else {
-                    normals[i][j] = {-1, -1, -1};
+                    record = {};
+                    shaded_values_[i][j] = TracePixel(i, j, RequestedQuality(), nullptr, &record);
+                    ++reshaded_pixels_;
+                }
+            }
+        }
+        return BuildImage(shaded_values_);
+    }
+
+    // Changes a light. An intensity change rescales the recorded contributions of the light
+    // without tracing; moving a light, or scaling an intensity up from zero, renders anew.
+    Image UpdateLight(size_t index, const scene::Light& light) {
+        auto previous = scene_.GetLights().at(index);
+        scene_.SetLight(index, light);
+        bool rescalable = !records_.empty() && Length(previous.position - light.position) == 0;
+        geometry::Vector3D<> ratio;
+        for (int k = 0; k < 3 && rescalable; ++k) {
+            rescalable = previous.intensity[k] != 0;
+            ratio[k] = rescalable ? light.intensity[k] / previous.intensity[k] : 0;
+        }
+        if (!rescalable) {
+            return Render();
+        }
+
+        reshaded_pixels_ = 0;
+        for (int i = 0; i < ray_caster_.screen_width_; ++i) {
+            for (int j = 0; j < ray_caster_.screen_height_; ++j) {
+                for (auto& [light_index, radiance] : records_[i][j].light_radiance) {
+                    if (light_index == index) {
+                        shaded_values_[i][j] += radiance * ratio - radiance;
+                        radiance = radiance * ratio;
+                    }
                 }
             }
         }
-        // Normalize
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                normals[i][j] /= 2;
-                normals[i][j] += geometry::Vector3D<>{0.5, 0.5, 0.5};
+        return BuildImage(shaded_values_);
+    }
+
+    // Pixels the last UpdateMaterial or UpdateLight traced again.
+    [[nodiscard]] size_t GetReshadedPixelCount() const {
+        return reshaded_pixels_;
+    }
+
+    // Moves the camera, Render then reuses what it can of the previous frame. The shading records
+    // belong to the old view, so the next edit renders anew.
+    void SetCamera(const CameraOptions& camera_options) {
+        ray_caster_ = RayCaster(camera_options);
+        ClearShadingRecords();
+    }
+
+    // Pixels the last Render took from the previous frame instead of shading them.
+    [[nodiscard]] size_t GetReusedPixelCount() const {
+        return reused_pixels_;
+    }
+
+    // Render checks the flag once per tile and throws RenderCancelled when it is set.
+    void SetCancellationFlag(const std::atomic<bool>* cancelled) {
+        cancelled_ = cancelled;
+    }
+
+    // Pixels the last Render supersampled.
+    [[nodiscard]] size_t GetAntialiasedPixelCount() const {
+        return antialiased_pixels_;
+    }
+
+    // Per pixel costs of the last Render in kCost mode, for WriteCostValues.
+    [[nodiscard]] const PixelValues& GetCostValues() const {
+        return cost_values_;
+    }
+
+    // Stage times and, with RAYTRACER_STATS, the hot path counters of the last Render. Loading
+    // and building are those of the constructor reading the scene.
+    [[nodiscard]] const RenderStats& GetStats() const {
+        return stats_;
+    }
+
+    // Next frame of an animated sequence: same topology as the loaded scene, moved vertices.
+    bool LoadFrame(const std::string& filename) {
+        history_.clear();
+        ClearShadingRecords();
+        return scene_.UpdateVertices(scene::ReadVertices(filename));
+    }
+
+private:
+    // Share of the deadline budget kept for tone mapping and building the image.
+    static constexpr double kFinishingReserve = 0.02;
+
+    // Leaves the loading and building times in ThreadStats, loading without the building.
+    static std::shared_ptr<scene::Scene> LoadScene(const std::string& filename,
+                                                   const RenderOptions& render_options) {
+        auto& stats = ThreadStats();
+        stats = {};
+        double total_seconds = 0;
+        std::shared_ptr<scene::Scene> scene;
+        {
+            StageTimer timer(total_seconds);
+            scene.reset(new scene::Scene(scene::ReadScene(filename, render_options.accelerator)));
+        }
+        stats.load_seconds = total_seconds - stats.build_seconds;
+        return scene;
+    }
+
+    // Whether the edit leaves the reflected and refracted rays and their radiance alone. The
+    // specular color scales them, unless the material neither reflects nor refracts.
+    static bool ChangesDirectTermsOnly(const scene::Material& previous,
+                                       const scene::Material& material) {
+        bool traced = previous.albedo[1] != 0 || previous.albedo[2] != 0;
+        return previous.albedo[1] == material.albedo[1] &&
+               previous.albedo[2] == material.albedo[2] &&
+               previous.refraction_index == material.refraction_index &&
+               (!traced || Length(previous.specular_color - material.specular_color) == 0);
+    }
+
+    // Swaps the direct terms of previous at the primary hit of record for those of material.
+    void ReshadePrimary(ShadingRecord& record, const scene::Material& previous,
+                        const scene::Material& material, geometry::Vector3D<>& value) const {
+        std::vector<std::pair<size_t, geometry::Vector3D<>>> old_radiance, new_radiance;
+        value += GetPrimaryDirectRadiance(scene_, *record.primary, material, &new_radiance) -
+                 GetPrimaryDirectRadiance(scene_, *record.primary, previous, &old_radiance);
+        for (size_t k = 0; k < new_radiance.size(); ++k) {
+            auto contribution = new_radiance[k].second - old_radiance[k].second;
+            for (auto& [light_index, radiance] : record.light_radiance) {
+                if (light_index == new_radiance[k].first) {
+                    radiance += contribution;
+                }
             }
         }
+    }
+
+    void ClearShadingRecords() {
+        records_.clear();
+        shaded_values_.clear();
+    }
+
+    // What the camera ray of a pixel hit, nullptr material for misses.
+    struct Surface {
+        const scene::Material* material = nullptr;
+        double distance = 0;
+    };
+
+    // Shaded camera ray hit kept for the next frame, only for view independent surfaces.
+    struct CachedSample {
+        bool valid = false;
+        geometry::Vector3D<> position;
+        size_t primitive = 0;
+        int instance = -1;
+        geometry::Vector3D<> radiance;
+    };
+
+    [[nodiscard]] TileQuality RequestedQuality() const {
+        return {render_options_.depth, 1};
+    }
+
+    [[nodiscard]] bool IsCancelled() const {
+        return cancelled_ && cancelled_->load(std::memory_order_relaxed);
+    }
+
+    void ThrowIfCancelled() const {
+        if (IsCancelled()) {
+            throw RenderCancelled();
+        }
+    }
 
-        // Build pixels
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                auto normal = normals[i][j];
+    PixelValues TraceRegionValues(const Region& region) {
+        TraceSpan span("tile");
+        // The rasterizer covers the whole frame, a crop is cheaper to trace.
+        visibility_.reset();
+        if (!Antialiased()) {
+            PixelValues values(region.width, std::vector<geometry::Vector3D<>>(region.height));
+            for (int i = 0; i < region.width; ++i) {
+                for (int j = 0; j < region.height; ++j) {
+                    values[i][j] = TracePixel(region.x + i, region.y + j, RequestedQuality());
+                }
+            }
+            return values;
+        }
 
-                int red = static_cast<int>((normal[0] - kEpsilon) * 256);
-                int green = static_cast<int>((normal[1] - kEpsilon) * 256);
-                int blue = static_cast<int>((normal[2] - kEpsilon) * 256);
-                image.SetPixel({red, green, blue}, j, i);
+        // Edges depend on the neighbouring pixels, a one pixel border is traced with the region
+        // so that it is antialiased like the full frame.
+        int x_begin = std::max(region.x - 1, 0);
+        int y_begin = std::max(region.y - 1, 0);
+        int x_end = std::min(region.x + region.width + 1, ray_caster_.screen_width_);
+        int y_end = std::min(region.y + region.height + 1, ray_caster_.screen_height_);
+        Region traced{x_begin, y_begin, x_end - x_begin, y_end - y_begin};
+        PixelValues values(traced.width, std::vector<geometry::Vector3D<>>(traced.height));
+        std::vector<std::vector<Surface>> surfaces(traced.width,
+                                                   std::vector<Surface>(traced.height));
+        for (int i = 0; i < traced.width; ++i) {
+            for (int j = 0; j < traced.height; ++j) {
+                values[i][j] =
+                    TracePixel(traced.x + i, traced.y + j, RequestedQuality(), &surfaces[i][j]);
             }
         }
+        Antialias(values, surfaces, traced, region);
+        PixelValues cropped(region.width);
+        for (int i = 0; i < region.width; ++i) {
+            auto column = values[region.x - traced.x + i].begin() + (region.y - traced.y);
+            cropped[i].assign(column, column + region.height);
+        }
+        return cropped;
+    }
 
-        return image;
+    void PrepareFrame() {
+        visibility_.reset();
+        if (render_options_.rasterize_primary) {
+            visibility_ = Rasterizer(ray_caster_).Rasterize(scene_);
+        }
+    }
+
+    std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>
+    FindPrimaryIntersectionAndMaterial(const geometry::Ray<>& ray, int i, int j) const {
+        if (!visibility_ || visibility_->OnSilhouette(i, j)) {
+            return FindClosestIntersectionAndMaterial(scene_, ray);
+        }
+        auto hit = visibility_->GetHit(scene_, ray, i, j);
+        if (!hit) {
+            return {{}, nullptr};
+        }
+        auto closest = GetIntersectionAndMaterial(scene_, *hit);
+        // A hit the ray test would miss at the primitive is traced as well.
+        return closest.first ? closest : FindClosestIntersectionAndMaterial(scene_, ray);
+    }
+
+    geometry::Vector3D<> TracePixel(int i, int j, const TileQuality& quality,
+                                    Surface* surface = nullptr,
+                                    ShadingRecord* record = nullptr) const {
+        if (render_options_.mode == RenderMode::kCost) {
+            return MeasurePixelCost(i, j, quality);
+        }
+        auto cast_ray = ray_caster_(i, j);
+        // Neighbouring pixels sample different subsets of the lights.
+        return TraceRay(cast_ray, FindPrimaryIntersectionAndMaterial(cast_ray, i, j), quality,
+                        static_cast<size_t>(i + j) % quality.light_stride, surface, record);
     }
 
-    Image RenderFull() {
-        Image image(ray_caster_.screen_width_, ray_caster_.screen_height_);
-        image.PrepareImage(image.Width(), image.Height());
+    geometry::Vector3D<> TraceRay(
+        const geometry::Ray<>& cast_ray,
+        const std::pair<std::optional<geometry::Intersection<>>, const scene::Material*>& primary,
+        const TileQuality& quality, size_t light_offset, Surface* surface,
+        ShadingRecord* record = nullptr) const {
+        RAYTRACER_COUNT(camera_rays);
+        const auto& [intersection, material] = primary;
+        if (surface) {
+            *surface = {intersection ? material : nullptr,
+                        intersection ? intersection->GetDistance() : 0};
+        }
+        switch (render_options_.mode) {
+            case RenderMode::kDepth:
+                return {intersection ? intersection->GetDistance() : 0, 0, 0};
+            case RenderMode::kNormal:
+                return intersection ? intersection->GetNormal() : geometry::Vector3D<>{-1, -1, -1};
+            case RenderMode::kFull:
+                return CalculateIllumination(scene_, cast_ray, primary, false, quality.depth,
+                                             {quality.light_stride, light_offset}, record);
+            default:
+                throw std::runtime_error("Bad render mode");
+        }
+    }
 
-        std::vector<std::vector<geometry::Vector3D<>>> pseudo_pixels(
-            image.Width(), std::vector<geometry::Vector3D<>>(image.Width()));
+    // Traces the pixel like kFull does, returning the intersection tests, rays and nanoseconds
+    // it took.
+    geometry::Vector3D<> MeasurePixelCost(int i, int j, const TileQuality& quality) const {
+        if (!kStatsEnabled && render_options_.cost_metric != CostMetric::kNanoseconds) {
+            throw std::runtime_error("Cost metric needs RAYTRACER_STATS");
+        }
+        RAYTRACER_COUNT(camera_rays);
+        auto before = ThreadStats();
+        auto start = std::chrono::steady_clock::now();
+        auto cast_ray = ray_caster_(i, j);
+        CalculateIllumination(scene_, cast_ray, FindPrimaryIntersectionAndMaterial(cast_ray, i, j),
+                              false, quality.depth,
+                              {quality.light_stride, static_cast<size_t>(i + j) %
+                                                         quality.light_stride});
+        std::chrono::duration<double, std::nano> nanoseconds =
+            std::chrono::steady_clock::now() - start;
+        const auto& after = ThreadStats();
+        auto tests = after.triangle_tests + after.sphere_tests - before.triangle_tests -
+                     before.sphere_tests;
+        auto rays = 1 + after.shadow_rays + after.reflected_rays + after.refracted_rays -
+                    before.shadow_rays - before.reflected_rays - before.refracted_rays;
+        return {static_cast<double>(tests), static_cast<double>(rays), nanoseconds.count()};
+    }
 
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                auto cast_ray = ray_caster_(i, j);
-                pseudo_pixels[i][j] =
-                    CalculateIllumination(scene_, cast_ray, false, render_options_.depth);
+    // Without specular color a material has neither highlights nor reflections nor refractions,
+    // its radiance does not depend on the direction it is seen from.
+    static bool IsViewIndependent(const scene::Material* material) {
+        return material->specular_color.Zero();
+    }
+
+    // The previous frame's samples splatted to the nearest pixel of the current camera, the
+    // closest one wins. Disoccluded pixels are left invalid.
+    [[nodiscard]] std::vector<CachedSample> Reproject() const {
+        int width = ray_caster_.screen_width_;
+        int height = ray_caster_.screen_height_;
+        std::vector<CachedSample> reprojected(static_cast<size_t>(width) * height);
+        std::vector<double> distances(reprojected.size(), std::numeric_limits<double>::infinity());
+        for (const auto& sample : history_) {
+            if (!sample.valid) {
+                continue;
+            }
+            auto pixel = ray_caster_.Project(sample.position);
+            if (!pixel) {
+                continue;
+            }
+            auto i = static_cast<int>(std::lround((*pixel)[0]));
+            auto j = static_cast<int>(std::lround((*pixel)[1]));
+            if (i < 0 || i >= width || j < 0 || j >= height) {
+                continue;
+            }
+            size_t index = static_cast<size_t>(j) * width + i;
+            double distance = Length(sample.position - ray_caster_.GetOrigin());
+            if (distance < distances[index]) {
+                distances[index] = distance;
+                reprojected[index] = sample;
             }
         }
-        // Normalize
-        ToneMappingAndGammaCorrection(pseudo_pixels);
-        // Build pixels
-        for (int i = 0; i < image.Width(); ++i) {
-            for (int j = 0; j < image.Height(); ++j) {
-                auto pseudo_pixel = pseudo_pixels[i][j];
+        return reprojected;
+    }
+
+    // Reuses the reprojected radiance if the camera ray hits the same primitive within a pixel of
+    // the position it was shaded at, shades the pixel otherwise.
+    geometry::Vector3D<> TraceOrReusePixel(int i, int j, const CachedSample& reprojected,
+                                           CachedSample& cached, Surface* surface,
+                                           size_t& reused) const {
+        auto cast_ray = ray_caster_(i, j);
+        auto hit = visibility_ && !visibility_->OnSilhouette(i, j)
+                       ? visibility_->GetHit(scene_, cast_ray, i, j)
+                       : scene_.Intersect(cast_ray);
+        if (!hit) {
+            return TraceRay(cast_ray, {{}, nullptr}, RequestedQuality(), 0, surface);
+        }
+        auto primary = GetIntersectionAndMaterial(scene_, *hit);
+        if (!primary.first) {
+            return TracePixel(i, j, RequestedQuality(), surface);
+        }
+        const auto& [intersection, material] = primary;
+        *surface = {material, intersection->GetDistance()};
+
+        double pixel_footprint = Length(ray_caster_.GetRight()) * hit->distance;
+        if (reprojected.valid && reprojected.primitive == hit->primitive &&
+            reprojected.instance == hit->instance &&
+            Length(reprojected.position - intersection->GetPosition()) <= pixel_footprint) {
+            cached = reprojected;
+            ++reused;
+            return reprojected.radiance;
+        }
+
+        auto radiance = TraceRay(cast_ray, primary, RequestedQuality(), 0, nullptr);
+        if (IsViewIndependent(material)) {
+            cached = {true, intersection->GetPosition(), hit->primitive, hit->instance, radiance};
+        }
+        return radiance;
+    }
 
-                int red = static_cast<int>((pseudo_pixel[0] - kEpsilon) * 256);
-                int green = static_cast<int>((pseudo_pixel[1] - kEpsilon) * 256);
-                int blue = static_cast<int>((pseudo_pixel[2] - kEpsilon) * 256);
-                image.SetPixel({red, green, blue}, j, i);
+    // Whether two neighbouring pixels straddle an edge worth supersampling.
+    [[nodiscard]] bool IsEdge(const geometry::Vector3D<>& lhs_value, const Surface& lhs,
+                              const geometry::Vector3D<>& rhs_value, const Surface& rhs) const {
+        double threshold = render_options_.antialiasing_threshold;
+        if (lhs.material != rhs.material ||
+            std::abs(lhs.distance - rhs.distance) >
+                threshold * std::max(lhs.distance, rhs.distance)) {
+            return true;
+        }
+        for (int k = 0; k < 3; ++k) {
+            double lhs_component = lhs_value[k];
+            double rhs_component = rhs_value[k];
+            if (render_options_.mode == RenderMode::kFull) {
+                // Compare radiance after compressing it to [0, 1) like the tone mapping does.
+                lhs_component /= 1 + lhs_component;
+                rhs_component /= 1 + rhs_component;
+            }
+            if (std::abs(lhs_component - rhs_component) > threshold) {
+                return true;
             }
         }
+        return false;
+    }
 
-        return image;
+    // Replaces the center sample of every edge pixel by the average of a stratified subpixel grid.
+    [[nodiscard]] bool Antialiased() const {
+        return render_options_.antialiasing > 1 && render_options_.mode != RenderMode::kCost;
+    }
+
+    // Resamples the edge pixels of target. values and surfaces hold the pixels of traced, which
+    // contains target and the neighbours of its pixels.
+    void Antialias(PixelValues& values, const std::vector<std::vector<Surface>>& surfaces,
+                   const Region& traced, const Region& target) {
+        int width = traced.width;
+        int height = traced.height;
+        std::vector<std::vector<bool>> edges(width, std::vector<bool>(height, false));
+        for (int i = 0; i < width; ++i) {
+            for (int j = 0; j < height; ++j) {
+                if (i + 1 < width &&
+                    IsEdge(values[i][j], surfaces[i][j], values[i + 1][j], surfaces[i + 1][j])) {
+                    edges[i][j] = edges[i + 1][j] = true;
+                }
+                if (j + 1 < height &&
+                    IsEdge(values[i][j], surfaces[i][j], values[i][j + 1], surfaces[i][j + 1])) {
+                    edges[i][j] = edges[i][j + 1] = true;
+                }
+            }
+        }
+
+        int samples = render_options_.antialiasing;
+        for (int i = target.x - traced.x; i < target.x - traced.x + target.width; ++i) {
+            for (int j = target.y - traced.y; j < target.y - traced.y + target.height; ++j) {
+                if (!edges[i][j]) {
+                    continue;
+                }
+                geometry::Vector3D<> sum;
+                for (int u = 0; u < samples; ++u) {
+                    for (int v = 0; v < samples; ++v) {
+                        auto ray = ray_caster_(traced.x + i, traced.y + j,
+                                               (u + 0.5) / samples - 0.5,
+                                               (v + 0.5) / samples - 0.5);
+                        sum += TraceRay(ray, FindClosestIntersectionAndMaterial(scene_, ray),
+                                        RequestedQuality(), 0, nullptr);
+                    }
+                }
+                values[i][j] = sum / (samples * samples);
+                ++antialiased_pixels_;
+            }
+        }
+    }
+
+    Image BuildImage(PixelValues values) {
+        StageTimer timer(stats_.tone_map_seconds);
+        TraceSpan span("tone map");
+        normalization_ = render_options_.normalization;
+        return BuildImageFromValues(std::move(values), render_options_.mode, normalization_,
+                                    render_options_.cost_metric, render_options_.color_map);
     }
 
 private:
-    scene::Scene scene_;
+    std::shared_ptr<scene::Scene> owned_scene_;
+    scene::Scene& scene_;
     RenderOptions render_options_;
     RayCaster ray_caster_;
+    std::optional<VisibilityBuffer> visibility_;
+    size_t antialiased_pixels_ = 0;
+    std::vector<CachedSample> history_;  // previous frame indexed [row * width + column]
+    size_t reused_pixels_ = 0;
+    // Shading records and raw values of the last Render when dependencies are tracked.
+    std::vector<std::vector<ShadingRecord>> records_;
+    PixelValues shaded_values_;
+    size_t reshaded_pixels_ = 0;
+    double normalization_ = 0;
+    const std::atomic<bool>* cancelled_ = nullptr;
+    RenderStats stats_;
+    PixelValues cost_values_;
 };
 
 Image Render(const std::string& filename, const CameraOptions& camera_options,
              const RenderOptions& render_options) {
     return Raytracer(filename, camera_options, render_options).Render();
 }
+
+// Also reports the statistics of the render, Image::Write adds the encoding time.
+Image Render(const std::string& filename, const CameraOptions& camera_options,
+             const RenderOptions& render_options, RenderStats& stats) {
+    Raytracer tracer(filename, camera_options, render_options);
+    auto image = tracer.Render();
+    stats = tracer.GetStats();
+    return image;
+}
+
+Image RenderProgressive(const std::string& filename, const CameraOptions& camera_options,
+                        const RenderOptions& render_options, const PreviewCallback& on_preview) {
+    return Raytracer(filename, camera_options, render_options).RenderProgressive(on_preview);
+}
+
+Image RenderRegion(const std::string& filename, const CameraOptions& camera_options,
+                   const RenderOptions& render_options, const Region& region) {
+    return Raytracer(filename, camera_options, render_options).RenderRegion(region);
+}
+
+Image RenderWithDeadline(const std::string& filename, const CameraOptions& camera_options,
+                         const RenderOptions& render_options, double budget_seconds,
+                         DeadlineReport& report) {
+    return Raytracer(filename, camera_options, render_options)
+        .RenderWithDeadline(budget_seconds, report);
+}
 }  // namespace raytracer
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace raytracer {
+// Pixel rectangle of the camera image: columns [x, x + width), rows [y, y + height).
+struct Region {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    [[nodiscard]] bool Inside(int screen_width, int screen_height) const {
+        return x >= 0 && y >= 0 && width > 0 && height > 0 && x + width <= screen_width &&
+               y + height <= screen_height;
+    }
+};
+
+// Row by row tiles of side tile_size covering the image, narrower at the right and bottom edges.
+inline std::vector<Region> SplitIntoTiles(int screen_width, int screen_height, int tile_size) {
+    std::vector<Region> tiles;
+    for (int y = 0; y < screen_height; y += tile_size) {
+        for (int x = 0; x < screen_width; x += tile_size) {
+            tiles.push_back({x, y, std::min(tile_size, screen_width - x),
+                             std::min(tile_size, screen_height - y)});
+        }
+    }
+    return tiles;
+}
+}  // namespace raytracer
@@ -1,9 +1,35 @@
 #pragma once
 
+#include "scene/accelerator.h"
+
 namespace raytracer {
-enum class RenderMode { kDepth, kNormal, kFull };
+// kCost traces like kFull but its values are the work spent on each pixel.
+enum class RenderMode { kDepth, kNormal, kFull, kCost };
+// Cost the kCost image shows. Intersection tests and rays need the RAYTRACER_STATS counters.
+enum class CostMetric { kIntersectionTests, kRays, kNanoseconds };
+enum class ColorMap { kGrayscale, kHeat, kViridis };
 struct RenderOptions {
     int depth = 4;
     RenderMode mode = RenderMode::kFull;
+    scene::AcceleratorType accelerator = scene::AcceleratorType::kBvh;
+    bool rasterize_primary = false;  // camera ray hits from the rasterizer instead of tracing
+    int tile_size = 16;              // side of the tiles the renderer hands to its threads
+    // Edge pixels, whose neighbours differ in material, depth or value by more than the
+    // threshold, are resampled on an antialiasing x antialiasing subpixel grid; 1 disables it.
+    int antialiasing = 1;
+    // Render reuses the radiance of view independent surfaces of the previous frame that are
+    // still visible after the camera moved, the scene has to stay static.
+    bool temporal_reuse = false;
+    // Render keeps per pixel shading records, so UpdateMaterial and UpdateLight re-shade only the
+    // pixels an edit affects. Takes precedence over temporal reuse; edited frames show the pixel
+    // center samples without antialiasing.
+    bool track_dependencies = false;
+    // Value mapped to full brightness: the radiance for tone mapping, the distance in depth mode.
+    // Zero takes the maximum of the rendered pixels; crops match the full frame with its value.
+    double normalization = 0;
+    double antialiasing_threshold = 0.05;
+    // Cost mode: the metric normalization applies to and the colors it is shown with.
+    CostMetric cost_metric = CostMetric::kNanoseconds;
+    ColorMap color_map = ColorMap::kHeat;
 };
 }  // namespace raytracer
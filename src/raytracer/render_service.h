@@ -0,0 +1,504 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "scene/accelerator.h"
+#include "scene/reader.cpp"
+#include "raytracer/raytracer.cpp"
+
+namespace raytracer {
+// Loaded scenes by file and accelerator, least recently used first out once their estimated
+// memory exceeds the budget. Evicted scenes live on in the jobs still rendering them.
+class SceneCache {
+public:
+    explicit SceneCache(size_t memory_budget) : memory_budget_(memory_budget) {
+    }
+
+public:
+    std::shared_ptr<scene::Scene> Get(const std::string& filename,
+                                      scene::AcceleratorType accelerator, bool* hit = nullptr) {
+        {
+            std::lock_guard lock(mutex_);
+            if (auto it = Find(filename, accelerator); it != entries_.end()) {
+                entries_.splice(entries_.begin(), entries_, it);
+                if (hit) {
+                    *hit = true;
+                }
+                return it->scene;
+            }
+        }
+        if (hit) {
+            *hit = false;
+        }
+
+        // Loading does not block other jobs; a scene loaded twice concurrently is cached once.
+        std::shared_ptr<scene::Scene> scene(
+            new scene::Scene(scene::ReadScene(filename, accelerator)));
+        std::lock_guard lock(mutex_);
+        if (auto it = Find(filename, accelerator); it != entries_.end()) {
+            return it->scene;
+        }
+        size_t memory = scene->MemoryUsage();
+        entries_.push_front({filename, accelerator, scene, memory});
+        memory_usage_ += memory;
+        while (memory_usage_ > memory_budget_ && entries_.size() > 1) {
+            memory_usage_ -= entries_.back().memory;
+            entries_.pop_back();
+        }
+        return scene;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        std::lock_guard lock(mutex_);
+        return entries_.size();
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const {
+        std::lock_guard lock(mutex_);
+        return memory_usage_;
+    }
+
+private:
+    struct Entry {
+        std::string filename;
+        scene::AcceleratorType accelerator;
+        std::shared_ptr<scene::Scene> scene;
+        size_t memory;
+    };
+
+    std::list<Entry>::iterator Find(const std::string& filename,
+                                    scene::AcceleratorType accelerator) {
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->filename == filename && it->accelerator == accelerator) {
+                return it;
+            }
+        }
+        return entries_.end();
+    }
+
+private:
+    size_t memory_budget_;
+    size_t memory_usage_ = 0;
+    std::list<Entry> entries_;  // most recently used first
+    mutable std::mutex mutex_;
+};
+
+struct RenderJob {
+    uint64_t id = 0;
+    int priority = 0;  // larger runs first, equal ones in submission order
+    std::string scene;
+    CameraOptions camera = CameraOptions(0, 0);
+    RenderOptions render;
+    std::string output;  // png written there unless empty
+};
+
+enum class JobStatus { kDone, kCancelled, kFailed };
+
+struct JobResult {
+    uint64_t id = 0;
+    JobStatus status = JobStatus::kDone;
+    bool scene_cached = false;
+    double load_seconds = 0;
+    double render_seconds = 0;
+    std::string message;
+    std::shared_ptr<Image> image;
+};
+
+using JobCallback = std::function<void(const JobResult&)>;
+
+// Long-lived render daemon: a priority queue of jobs served by a pool of threads that share the
+// scenes of a SceneCache, so warm requests cost only their tracing time. Jobs are cancelled out
+// of the queue or, while rendering, at the next tile.
+class RenderService {
+public:
+    explicit RenderService(size_t threads = 2, size_t scene_memory_budget = size_t{1} << 30)
+        : scenes_(scene_memory_budget) {
+        for (size_t i = 0; i < std::max<size_t>(threads, 1); ++i) {
+            threads_.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    // Cancels the running jobs and drops the queued ones, both reporting kCancelled.
+    ~RenderService() {
+        std::map<std::pair<int, uint64_t>, QueuedJob> dropped;
+        {
+            std::lock_guard lock(mutex_);
+            stopping_ = true;
+            dropped.swap(queue_);
+            for (auto& [id, cancelled] : running_) {
+                *cancelled = true;
+            }
+        }
+        ready_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+        for (auto& [key, queued] : dropped) {
+            queued.on_done(CancelledResult(queued.job.id));
+        }
+    }
+
+public:
+    // False, and on_done is never called, if a job with the same id is queued or running.
+    bool Submit(RenderJob job, JobCallback on_done) {
+        {
+            std::lock_guard lock(mutex_);
+            auto same_id = [&](const auto& entry) { return entry.second.job.id == job.id; };
+            if (running_.count(job.id) || std::any_of(queue_.begin(), queue_.end(), same_id)) {
+                return false;
+            }
+            auto sequence = next_sequence_++;
+            queue_.emplace(std::pair{-job.priority, sequence},
+                           QueuedJob{std::move(job), std::move(on_done)});
+        }
+        ready_.notify_one();
+        return true;
+    }
+
+    // False if no job with the id is queued or running.
+    bool Cancel(uint64_t id) {
+        JobCallback on_done;
+        {
+            std::lock_guard lock(mutex_);
+            if (auto it = running_.find(id); it != running_.end()) {
+                *it->second = true;
+                return true;
+            }
+            for (auto it = queue_.begin(); it != queue_.end(); ++it) {
+                if (it->second.job.id == id) {
+                    on_done = std::move(it->second.on_done);
+                    queue_.erase(it);
+                    break;
+                }
+            }
+        }
+        if (!on_done) {
+            return false;
+        }
+        on_done(CancelledResult(id));
+        return true;
+    }
+
+    [[nodiscard]] SceneCache& GetSceneCache() {
+        return scenes_;
+    }
+
+    // Line protocol over file descriptors, e.g. stdin and stdout or a Unix socket connection:
+    //   render <id> <scene> <width> <height> [priority=P] [fov=F] [from=X,Y,Z] [to=X,Y,Z]
+    //          [depth=D] [mode=full|depth|normal] [accelerator=NAME] [output=PATH]
+    //   cancel <id>
+    //   quit
+    // Ids have to be unique among the queued and running jobs.
+    // Replies are "queued <id>", "cancelling <id>", "unknown <id>" and "error <message>" right
+    // away, and "done <id> cached=<0|1> load=<s> render=<s>", "cancelled <id>" or
+    // "failed <id> <message>" when a job ends. Returns at quit or end of input once the jobs it
+    // submitted have ended.
+    void Serve(int input_fd, int output_fd) {
+        struct Connection {
+            std::mutex mutex;
+            std::condition_variable idle;
+            size_t jobs = 0;
+            int fd;
+
+            void Reply(const std::string& line) {
+                std::lock_guard lock(mutex);
+                WriteLine(line);
+            }
+
+            void WriteLine(const std::string& line) const {
+                auto text = line + "\n";
+                for (size_t written = 0; written < text.size();) {
+                    auto result = write(fd, text.data() + written, text.size() - written);
+                    if (result < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (result <= 0) {
+                        return;
+                    }
+                    written += result;
+                }
+            }
+        };
+        auto connection = std::make_shared<Connection>();
+        connection->fd = output_fd;
+
+        std::string buffer;
+        std::string line;
+        while (ReadLine(input_fd, buffer, line)) {
+            std::istringstream words(line);
+            std::string command;
+            words >> command;
+            if (command.empty()) {
+                continue;
+            }
+            if (command == "quit") {
+                break;
+            }
+            if (command == "cancel") {
+                uint64_t id;
+                if (!(words >> id)) {
+                    connection->Reply("error bad cancel request");
+                    continue;
+                }
+                connection->Reply((Cancel(id) ? "cancelling " : "unknown ") + std::to_string(id));
+                continue;
+            }
+            if (command != "render") {
+                connection->Reply("error unknown command " + command);
+                continue;
+            }
+
+            RenderJob job;
+            try {
+                job = ParseRenderRequest(words);
+            } catch (const std::exception& error) {
+                connection->Reply(std::string("error ") + error.what());
+                continue;
+            }
+            // Held while submitting, so that "queued" is written before the job's result.
+            std::lock_guard lock(connection->mutex);
+            auto id = std::to_string(job.id);
+            bool queued = Submit(std::move(job), [connection](const JobResult& result) {
+                std::lock_guard lock(connection->mutex);
+                connection->WriteLine(FormatResult(result));
+                --connection->jobs;
+                connection->idle.notify_all();
+            });
+            if (queued) {
+                ++connection->jobs;
+                connection->WriteLine("queued " + id);
+            } else {
+                connection->WriteLine("error duplicate id " + id);
+            }
+        }
+
+        std::unique_lock lock(connection->mutex);
+        connection->idle.wait(lock, [&] { return connection->jobs == 0; });
+    }
+
+    // Accepts connections on a Unix domain socket and serves each of them on its own thread,
+    // until a connection cannot be accepted.
+    void ServeUnixSocket(const std::string& path) {
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (listen_fd < 0 || path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Can't create socket " + path);
+        }
+        path.copy(address.sun_path, path.size());
+        unlink(path.c_str());
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, 16) != 0) {
+            close(listen_fd);
+            throw std::runtime_error("Can't listen on " + path);
+        }
+        std::vector<std::thread> connections;
+        for (int fd; (fd = accept(listen_fd, nullptr, nullptr)) >= 0;) {
+            connections.emplace_back([this, fd] {
+                Serve(fd, fd);
+                close(fd);
+            });
+        }
+        close(listen_fd);
+        for (auto& connection : connections) {
+            connection.join();
+        }
+    }
+
+private:
+    struct QueuedJob {
+        RenderJob job;
+        JobCallback on_done;
+    };
+
+    static JobResult CancelledResult(uint64_t id) {
+        JobResult result;
+        result.id = id;
+        result.status = JobStatus::kCancelled;
+        return result;
+    }
+
+    void WorkerLoop() {
+        while (true) {
+            QueuedJob queued;
+            auto cancelled = std::make_shared<std::atomic<bool>>(false);
+            {
+                std::unique_lock lock(mutex_);
+                ready_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                if (stopping_) {
+                    return;
+                }
+                queued = std::move(queue_.begin()->second);
+                queue_.erase(queue_.begin());
+                running_[queued.job.id] = cancelled;
+            }
+            auto result = Run(queued.job, *cancelled);
+            {
+                std::lock_guard lock(mutex_);
+                running_.erase(queued.job.id);
+            }
+            queued.on_done(result);
+        }
+    }
+
+    JobResult Run(const RenderJob& job, const std::atomic<bool>& cancelled) {
+        using Clock = std::chrono::steady_clock;
+        JobResult result;
+        result.id = job.id;
+        try {
+            auto start = Clock::now();
+            auto scene = scenes_.Get(job.scene, job.render.accelerator, &result.scene_cached);
+            auto loaded = Clock::now();
+            result.load_seconds = std::chrono::duration<double>(loaded - start).count();
+
+            Raytracer tracer(std::move(scene), job.camera, job.render);
+            tracer.SetCancellationFlag(&cancelled);
+            result.image.reset(new Image(tracer.Render()));
+            result.render_seconds = std::chrono::duration<double>(Clock::now() - loaded).count();
+            if (!job.output.empty()) {
+                result.image->Write(job.output);
+            }
+        } catch (const RenderCancelled&) {
+            result.status = JobStatus::kCancelled;
+        } catch (const std::exception& error) {
+            result.status = JobStatus::kFailed;
+            result.message = error.what();
+        }
+        return result;
+    }
+
+    static bool ReadLine(int fd, std::string& buffer, std::string& line) {
+        while (true) {
+            if (auto end = buffer.find('\n'); end != std::string::npos) {
+                line = buffer.substr(0, end);
+                buffer.erase(0, end + 1);
+                return true;
+            }
+            char chunk[4096];
+            auto size = read(fd, chunk, sizeof(chunk));
+            if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            if (size <= 0) {
+                line = buffer;
+                buffer.clear();
+                return !line.empty();
+            }
+            buffer.append(chunk, size);
+        }
+    }
+
+    static geometry::Vector3D<> ParseVector(const std::string& text) {
+        geometry::Vector3D<> vector;
+        std::istringstream input(text);
+        char comma;
+        if (!(input >> vector[0] >> comma >> vector[1] >> comma >> vector[2])) {
+            throw std::runtime_error("bad vector " + text);
+        }
+        return vector;
+    }
+
+    static RenderJob ParseRenderRequest(std::istringstream& words) {
+        RenderJob job;
+        int width, height;
+        if (!(words >> job.id >> job.scene >> width >> height) || width <= 0 || height <= 0) {
+            throw std::runtime_error("bad render request");
+        }
+        job.camera = CameraOptions(width, height);
+        for (std::string option; words >> option;) {
+            auto separator = option.find('=');
+            if (separator == std::string::npos) {
+                throw std::runtime_error("bad option " + option);
+            }
+            auto key = option.substr(0, separator);
+            auto value = option.substr(separator + 1);
+            if (key == "priority") {
+                job.priority = std::stoi(value);
+            } else if (key == "fov") {
+                job.camera.fov = std::stod(value);
+            } else if (key == "from") {
+                job.camera.look_from = ParseVector(value);
+            } else if (key == "to") {
+                job.camera.look_to = ParseVector(value);
+            } else if (key == "depth") {
+                job.render.depth = std::stoi(value);
+            } else if (key == "mode") {
+                if (value == "full") {
+                    job.render.mode = RenderMode::kFull;
+                } else if (value == "depth") {
+                    job.render.mode = RenderMode::kDepth;
+                } else if (value == "normal") {
+                    job.render.mode = RenderMode::kNormal;
+                } else if (value == "cost") {
+                    job.render.mode = RenderMode::kCost;
+                } else {
+                    throw std::runtime_error("bad mode " + value);
+                }
+            } else if (key == "accelerator") {
+                bool known = false;
+                for (auto type : {scene::AcceleratorType::kBvh, scene::AcceleratorType::kWideBvh,
+                                  scene::AcceleratorType::kGrid, scene::AcceleratorType::kKdTree,
+                                  scene::AcceleratorType::kBruteForce}) {
+                    if (scene::GetAcceleratorName(type) == value) {
+                        job.render.accelerator = type;
+                        known = true;
+                    }
+                }
+                if (!known) {
+                    throw std::runtime_error("bad accelerator " + value);
+                }
+            } else if (key == "output") {
+                job.output = value;
+            } else {
+                throw std::runtime_error("bad option " + option);
+            }
+        }
+        return job;
+    }
+
+    static std::string FormatResult(const JobResult& result) {
+        auto id = std::to_string(result.id);
+        switch (result.status) {
+            case JobStatus::kDone: {
+                std::ostringstream line;
+                line << "done " << id << " cached=" << result.scene_cached
+                     << " load=" << result.load_seconds << " render=" << result.render_seconds;
+                return line.str();
+            }
+            case JobStatus::kCancelled:
+                return "cancelled " + id;
+            default:
+                return "failed " + id + " " + result.message;
+        }
+    }
+
+private:
+    SceneCache scenes_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    bool stopping_ = false;
+    uint64_t next_sequence_ = 0;
+    std::map<std::pair<int, uint64_t>, QueuedJob> queue_;  // by descending priority, then age
+    std::map<uint64_t, std::shared_ptr<std::atomic<bool>>> running_;
+    std::vector<std::thread> threads_;
+};
+}  // namespace raytracer
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace raytracer {
+// Serialization of trivially copyable fields in host byte order for worker messages and cache
+// files: the machines exchanging them are expected to share the architecture.
+class MessageWriter {
+public:
+    template <typename T>
+    void Put(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        auto bytes = reinterpret_cast<const char*>(&value);
+        payload_.insert(payload_.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    void PutArray(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        Put<uint64_t>(values.size());
+        auto bytes = reinterpret_cast<const char*>(values.data());
+        payload_.insert(payload_.end(), bytes, bytes + values.size() * sizeof(T));
+    }
+
+    void PutString(const std::string& value) {
+        PutArray(std::vector<char>(value.begin(), value.end()));
+    }
+
+    [[nodiscard]] const std::vector<char>& Payload() const {
+        return payload_;
+    }
+
+private:
+    std::vector<char> payload_;
+};
+
+class MessageReader {
+public:
+    explicit MessageReader(const std::vector<char>& payload) : payload_(payload) {
+    }
+
+    template <typename T>
+    T Get() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        T value;
+        std::memcpy(&value, Take(sizeof(T)), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    std::vector<T> GetArray() {
+        auto size = Get<uint64_t>();
+        if (size > (payload_.size() - position_) / sizeof(T)) {
+            throw std::runtime_error("Truncated message");
+        }
+        std::vector<T> values(size);
+        std::memcpy(values.data(), Take(size * sizeof(T)), size * sizeof(T));
+        return values;
+    }
+
+    std::string GetString() {
+        auto characters = GetArray<char>();
+        return {characters.begin(), characters.end()};
+    }
+
+private:
+    const char* Take(size_t size) {
+        if (size > payload_.size() - position_) {
+            throw std::runtime_error("Truncated message");
+        }
+        position_ += size;
+        return payload_.data() + position_ - size;
+    }
+
+private:
+    const std::vector<char>& payload_;
+    size_t position_ = 0;
+};
+}  // namespace raytracer
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "raytracer/raytracer.cpp"
+#include "raytracer/region.h"
+
+// Live framebuffer in a POSIX shared memory segment: a header, one sequence number per tile and
+// the row-major RGB float values of the frame. Viewers map the segment read-only and display the
+// values in place; a tile whose sequence number is odd is being written, an even one changes every
+// time the tile is published.
+namespace raytracer {
+struct SharedFramebufferHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t tile_size;
+    RenderMode mode;
+    std::atomic<uint64_t> frame;            // incremented when a render starts
+    std::atomic<uint64_t> completed_frame;  // equals frame once every tile of it is published
+};
+
+class SharedFramebuffer {
+public:
+    // Creates the segment name ("/something") for a frame, it is unlinked on destruction.
+    SharedFramebuffer(const std::string& name, int width, int height, int tile_size,
+                      RenderMode mode = RenderMode::kFull)
+        : name_(name), owner_(true) {
+        if (width <= 0 || height <= 0 || tile_size <= 0) {
+            throw std::runtime_error("Bad framebuffer size");
+        }
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("Can't create shared memory " + name);
+        }
+        tiles_ = SplitIntoTiles(width, height, tile_size);
+        size_ = Layout(width, height, tiles_.size());
+        if (ftruncate(fd, static_cast<off_t>(size_)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Can't size shared memory " + name);
+        }
+        Map(fd, PROT_READ | PROT_WRITE);
+        // The segment is zero filled: no tile is published yet.
+        header_ = new (data_)
+            SharedFramebufferHeader{kMagic, kVersion, width, height, tile_size, mode, {0}, {0}};
+        sequences_ = reinterpret_cast<std::atomic<uint64_t>*>(data_ + sizeof(*header_));
+    }
+
+    // Maps the segment of a running render read-only.
+    explicit SharedFramebuffer(const std::string& name) : name_(name), owner_(false) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Can't open shared memory " + name);
+        }
+        struct stat status;
+        if (fstat(fd, &status) != 0 ||
+            static_cast<size_t>(status.st_size) < sizeof(SharedFramebufferHeader)) {
+            close(fd);
+            throw std::runtime_error("Bad shared framebuffer " + name);
+        }
+        size_ = status.st_size;
+        Map(fd, PROT_READ);
+        header_ = reinterpret_cast<SharedFramebufferHeader*>(data_);
+        if (header_->magic != kMagic || header_->version != kVersion) {
+            Unmap();
+            throw std::runtime_error("Bad shared framebuffer " + name);
+        }
+        tiles_ = SplitIntoTiles(header_->width, header_->height, header_->tile_size);
+        if (Layout(header_->width, header_->height, tiles_.size()) > size_) {
+            Unmap();
+            throw std::runtime_error("Bad shared framebuffer " + name);
+        }
+        sequences_ = reinterpret_cast<std::atomic<uint64_t>*>(data_ + sizeof(*header_));
+    }
+
+    SharedFramebuffer(const SharedFramebuffer&) = delete;
+    SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+    ~SharedFramebuffer() {
+        Unmap();
+        if (owner_) {
+            shm_unlink(name_.c_str());
+        }
+    }
+
+public:
+    [[nodiscard]] int Width() const {
+        return header_->width;
+    }
+
+    [[nodiscard]] int Height() const {
+        return header_->height;
+    }
+
+    [[nodiscard]] RenderMode Mode() const {
+        return header_->mode;
+    }
+
+    [[nodiscard]] const std::vector<Region>& Tiles() const {
+        return tiles_;
+    }
+
+    [[nodiscard]] uint64_t GetFrame() const {
+        return header_->frame.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] bool IsFrameComplete() const {
+        auto frame = GetFrame();
+        return frame > 0 && header_->completed_frame.load(std::memory_order_acquire) == frame;
+    }
+
+    [[nodiscard]] uint64_t GetTileSequence(size_t index) const {
+        return sequences_[index].load(std::memory_order_acquire);
+    }
+
+    // Row-major RGB floats of the frame, for zero copy display.
+    [[nodiscard]] const float* Values() const {
+        return reinterpret_cast<const float*>(data_ + ValuesOffset(tiles_.size()));
+    }
+
+    void BeginFrame() {
+        header_->frame.fetch_add(1, std::memory_order_acq_rel);
+    }
+
+    void CompleteFrame() {
+        header_->completed_frame.store(GetFrame(), std::memory_order_release);
+    }
+
+    // Publishes the values of tile index, row by row three floats per pixel like
+    // Raytracer::TraceRegion.
+    void Publish(size_t index, const std::vector<float>& values) {
+        const auto& tile = tiles_[index];
+        auto& sequence = sequences_[index];
+        auto start = sequence.load(std::memory_order_relaxed);
+        sequence.store(start + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto frame = const_cast<float*>(Values());
+        for (int j = 0; j < tile.height; ++j) {
+            std::memcpy(frame + (static_cast<size_t>(tile.y + j) * Width() + tile.x) * 3,
+                        values.data() + static_cast<size_t>(j) * tile.width * 3,
+                        sizeof(float) * tile.width * 3);
+        }
+        sequence.store(start + 2, std::memory_order_release);
+    }
+
+    // Copies a consistent state of every tile, tiles never published stay zero. Returns the
+    // sequence numbers the copies correspond to.
+    std::vector<uint64_t> Snapshot(std::vector<float>& values) const {
+        values.assign(static_cast<size_t>(Width()) * Height() * 3, 0);
+        std::vector<uint64_t> sequences(tiles_.size());
+        for (size_t index = 0; index < tiles_.size(); ++index) {
+            const auto& tile = tiles_[index];
+            while (true) {
+                auto before = GetTileSequence(index);
+                if (before % 2 == 1) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (int j = 0; j < tile.height; ++j) {
+                    auto offset = (static_cast<size_t>(tile.y + j) * Width() + tile.x) * 3;
+                    std::memcpy(values.data() + offset, Values() + offset,
+                                sizeof(float) * tile.width * 3);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequences_[index].load(std::memory_order_relaxed) == before) {
+                    sequences[index] = before;
+                    break;
+                }
+            }
+        }
+        return sequences;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x46524d42;  // "BMRF"
+    static constexpr uint32_t kVersion = 1;
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    static size_t ValuesOffset(size_t tile_count) {
+        return sizeof(SharedFramebufferHeader) + tile_count * sizeof(std::atomic<uint64_t>);
+    }
+
+    static size_t Layout(int width, int height, size_t tile_count) {
+        return ValuesOffset(tile_count) + static_cast<size_t>(width) * height * 3 * sizeof(float);
+    }
+
+    void Map(int fd, int protection) {
+        void* data = mmap(nullptr, size_, protection, MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            if (owner_) {
+                shm_unlink(name_.c_str());
+            }
+            throw std::runtime_error("Can't map shared memory " + name_);
+        }
+        data_ = static_cast<char*>(data);
+    }
+
+    void Unmap() {
+        if (data_) {
+            munmap(data_, size_);
+            data_ = nullptr;
+        }
+    }
+
+private:
+    std::string name_;
+    bool owner_;
+    size_t size_ = 0;
+    char* data_ = nullptr;
+    SharedFramebufferHeader* header_ = nullptr;
+    std::atomic<uint64_t>* sequences_ = nullptr;
+    std::vector<Region> tiles_;
+};
+
+// Renders the frame tile by tile into the shared framebuffer, whose size has to match the camera,
+// publishing every tile as soon as it is traced.
+inline Image RenderToSharedFramebuffer(const std::string& filename,
+                                       const CameraOptions& camera_options,
+                                       const RenderOptions& render_options,
+                                       SharedFramebuffer& framebuffer) {
+    if (framebuffer.Width() != camera_options.screen_width ||
+        framebuffer.Height() != camera_options.screen_height ||
+        framebuffer.Mode() != render_options.mode) {
+        throw std::runtime_error("Framebuffer doesn't match the camera");
+    }
+    Raytracer tracer(filename, camera_options, render_options);
+    framebuffer.BeginFrame();
+    const auto& tiles = framebuffer.Tiles();
+    for (size_t index = 0; index < tiles.size(); ++index) {
+        framebuffer.Publish(index, tracer.TraceRegion(tiles[index]));
+    }
+    framebuffer.CompleteFrame();
+
+    std::vector<float> values(framebuffer.Values(),
+                              framebuffer.Values() + static_cast<size_t>(framebuffer.Width()) *
+                                                         framebuffer.Height() * 3);
+    return BuildImageFromFloats(values, framebuffer.Width(), framebuffer.Height(),
+                                render_options.mode, render_options.normalization,
+                                render_options.cost_metric, render_options.color_map);
+}
+}  // namespace raytracer
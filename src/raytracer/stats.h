@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Per-render statistics. Stage times are always measured, they cost a few clock reads per frame.
+// The hot path counters only exist when RAYTRACER_STATS is defined: they count into plain
+// thread-local fields that a render resets when it starts and collects when it ends, otherwise
+// the counting macros expand to nothing. ParallelFor workers add their counters to the thread
+// that started them before they finish.
+namespace raytracer {
+#ifdef RAYTRACER_STATS
+inline constexpr bool kStatsEnabled = true;
+#else
+inline constexpr bool kStatsEnabled = false;
+#endif
+
+struct RenderStats {
+    static constexpr size_t kDepthBuckets = 16;
+
+    uint64_t camera_rays = 0;
+    uint64_t shadow_rays = 0;
+    uint64_t reflected_rays = 0;
+    uint64_t refracted_rays = 0;
+    uint64_t triangle_tests = 0;
+    uint64_t sphere_tests = 0;
+    uint64_t hits = 0;  // scene intersections that found a primitive
+    uint64_t sky_misses = 0;
+    // Shaded intersections by recursion depth, deeper ones in the last bucket.
+    std::array<uint64_t, kDepthBuckets> depth_histogram{};
+    int current_depth = 0;
+
+    double load_seconds = 0;  // reading the scene files, without building accelerators
+    double build_seconds = 0;
+    double trace_seconds = 0;
+    double tone_map_seconds = 0;
+    double encode_seconds = 0;
+
+    // Counters of a finished frame, the stage times stay.
+    void TakeCounters(const RenderStats& counters) {
+        camera_rays = counters.camera_rays;
+        shadow_rays = counters.shadow_rays;
+        reflected_rays = counters.reflected_rays;
+        refracted_rays = counters.refracted_rays;
+        triangle_tests = counters.triangle_tests;
+        sphere_tests = counters.sphere_tests;
+        hits = counters.hits;
+        sky_misses = counters.sky_misses;
+        depth_histogram = counters.depth_histogram;
+    }
+
+    void AddCounters(const RenderStats& counters) {
+        camera_rays += counters.camera_rays;
+        shadow_rays += counters.shadow_rays;
+        reflected_rays += counters.reflected_rays;
+        refracted_rays += counters.refracted_rays;
+        triangle_tests += counters.triangle_tests;
+        sphere_tests += counters.sphere_tests;
+        hits += counters.hits;
+        sky_misses += counters.sky_misses;
+        for (size_t i = 0; i < kDepthBuckets; ++i) {
+            depth_histogram[i] += counters.depth_histogram[i];
+        }
+    }
+};
+
+// Statistics of the calling thread.
+inline RenderStats& ThreadStats() {
+    thread_local RenderStats stats;
+    return stats;
+}
+
+// Adds the seconds of its lifetime to a stage time.
+class StageTimer {
+public:
+    explicit StageTimer(double& seconds)
+        : seconds_(seconds), start_(std::chrono::steady_clock::now()) {
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    ~StageTimer() {
+        seconds_ +=
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    double& seconds_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// One level of shading recursion, recorded in the depth histogram.
+class DepthScope {
+public:
+    DepthScope() {
+        auto& stats = ThreadStats();
+        ++stats.depth_histogram[std::min<size_t>(stats.current_depth,
+                                                 RenderStats::kDepthBuckets - 1)];
+        ++stats.current_depth;
+    }
+
+    DepthScope(const DepthScope&) = delete;
+    DepthScope& operator=(const DepthScope&) = delete;
+
+    ~DepthScope() {
+        --ThreadStats().current_depth;
+    }
+};
+}  // namespace raytracer
+
+#ifdef RAYTRACER_STATS
+#define RAYTRACER_COUNT(counter) (++::raytracer::ThreadStats().counter)
+#define RAYTRACER_COUNT_DEPTH() ::raytracer::DepthScope raytracer_depth_scope
+#else
+#define RAYTRACER_COUNT(counter) ((void)0)
+#define RAYTRACER_COUNT_DEPTH() ((void)0)
+#endif
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include "raytracer/raytracer.cpp"
+#include "raytracer/region.h"
+#include "raytracer/serialization.h"
+
+// On-disk cache of traced tiles keyed by the content of the scene files, the camera, the render
+// options and the tile rectangle. Tiles are written to a temporary file and renamed into place,
+// so several processes can share one directory; the least recently used tiles are evicted once
+// it outgrows the size limit.
+namespace raytracer {
+inline void HashBytes(uint64_t& hash, const char* data, size_t size) {
+    // FNV-1a
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+}
+
+inline uint64_t HashBytes(const std::vector<char>& bytes) {
+    uint64_t hash = 14695981039346656037ULL;
+    HashBytes(hash, bytes.data(), bytes.size());
+    return hash;
+}
+
+// Only the content counts, so a copied or moved scene keeps its tiles.
+inline std::vector<char> HashFile(uint64_t& hash, const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Can't open " + filename);
+    }
+    std::vector<char> bytes(std::istreambuf_iterator<char>(file), {});
+    uint64_t size = bytes.size();
+    HashBytes(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+    HashBytes(hash, bytes.data(), bytes.size());
+    return bytes;
+}
+
+// A file the scene references, keyed by the name the scene file gives it.
+inline std::vector<char> HashReferencedFile(uint64_t& hash, const std::string& folder,
+                                            const std::string& name) {
+    HashBytes(hash, name.data(), name.size() + 1);
+    return HashFile(hash, folder + "/" + name);
+}
+
+// Writes a temporary file next to path and renames it over path, so that readers in other
+// processes see either the old or the new content. False if anything failed.
+inline bool WriteFileAtomically(const std::filesystem::path& path, const std::vector<char>& bytes) {
+    static std::atomic<size_t> temporary_count = 0;
+    auto temporary = path;
+    temporary += "." + std::to_string(getpid()) + "." + std::to_string(temporary_count++);
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        if (!file) {
+            std::error_code error;
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+// Hashes the scene file together with the material libraries, sky images and instanced meshes
+// it references, without parsing the geometry.
+inline void HashSceneFile(uint64_t& hash, const std::string& filename,
+                          const std::vector<char>& bytes) {
+    auto path = GetFolderPathFromFilePath(filename);
+    std::istringstream lines(std::string(bytes.begin(), bytes.end()));
+    std::vector<std::string> instanced;
+    for (std::string line; std::getline(lines, line);) {
+        auto attributes = ParseLine(line);
+        if (attributes.size() > 1 && attributes[0] == "mtllib") {
+            HashReferencedFile(hash, path, attributes[1]);
+        } else if (attributes.size() > 3 && attributes[0] == "Sky") {
+            HashReferencedFile(hash, path, attributes[3]);
+        } else if (attributes.size() > 1 && attributes[0] == "I" &&
+                   std::find(instanced.begin(), instanced.end(), attributes[1]) ==
+                       instanced.end()) {
+            instanced.push_back(attributes[1]);
+            HashSceneFile(hash, path + "/" + attributes[1],
+                          HashReferencedFile(hash, path, attributes[1]));
+        }
+    }
+}
+
+inline uint64_t HashScene(const std::string& filename) {
+    uint64_t hash = 14695981039346656037ULL;
+    HashSceneFile(hash, filename, HashFile(hash, filename));
+    return hash;
+}
+
+// Everything that decides the values of a tile.
+inline std::vector<char> TileKey(uint64_t scene_hash, const CameraOptions& camera_options,
+                                 const RenderOptions& render_options, const Region& region) {
+    MessageWriter key;
+    key.Put(scene_hash);
+    key.Put(camera_options.screen_width);
+    key.Put(camera_options.screen_height);
+    key.Put(camera_options.fov);
+    for (int axis = 0; axis < 3; ++axis) {
+        key.Put(camera_options.look_from[axis]);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        key.Put(camera_options.look_to[axis]);
+    }
+    // Normalization and colors apply when the image is built from the tiles.
+    key.Put(render_options.depth);
+    key.Put(render_options.mode);
+    key.Put(render_options.accelerator);
+    key.Put(render_options.antialiasing);
+    key.Put(render_options.antialiasing_threshold);
+    key.Put(region);
+    return key.Payload();
+}
+
+struct TileCacheStats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evicted = 0;
+};
+
+class TileCache {
+public:
+    // size_limit in bytes of tile files, zero for no limit.
+    explicit TileCache(std::filesystem::path directory, uintmax_t size_limit = 0)
+        : directory_(std::move(directory)), size_limit_(size_limit) {
+        std::filesystem::create_directories(directory_);
+        size_ = DirectorySize();
+    }
+
+    // The tile values stored under key; a missing, truncated or colliding file is a miss.
+    std::optional<std::vector<float>> Load(const std::vector<char>& key) {
+        auto path = TilePath(key);
+        std::ifstream file(path, std::ios::binary);
+        if (file) {
+            std::vector<char> bytes(std::istreambuf_iterator<char>(file), {});
+            try {
+                MessageReader reader(bytes);
+                if (reader.Get<uint32_t>() == kMagic && reader.Get<uint32_t>() == kVersion &&
+                    reader.GetArray<char>() == key) {
+                    auto values = reader.GetArray<float>();
+                    // Recently used tiles survive eviction.
+                    std::error_code error;
+                    std::filesystem::last_write_time(
+                        path, std::filesystem::file_time_type::clock::now(), error);
+                    ++stats_.hits;
+                    return values;
+                }
+            } catch (const std::runtime_error&) {
+            }
+        }
+        ++stats_.misses;
+        return std::nullopt;
+    }
+
+    void Store(const std::vector<char>& key, const std::vector<float>& values) {
+        MessageWriter writer;
+        writer.Put(kMagic);
+        writer.Put(kVersion);
+        writer.PutArray(key);
+        writer.PutArray(values);
+        const auto& bytes = writer.Payload();
+
+        if (!WriteFileAtomically(TilePath(key), bytes)) {
+            return;
+        }
+        size_ += bytes.size();
+        if (size_limit_ > 0 && size_ > size_limit_) {
+            Evict();
+        }
+    }
+
+    [[nodiscard]] const TileCacheStats& GetStats() const {
+        return stats_;
+    }
+
+    [[nodiscard]] const std::filesystem::path& GetDirectory() const {
+        return directory_;
+    }
+
+private:
+    static constexpr uint32_t kMagic = 0x454c4954;  // "TILE"
+    static constexpr uint32_t kVersion = 1;
+
+    [[nodiscard]] std::filesystem::path TilePath(const std::vector<char>& key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.tile",
+                      static_cast<unsigned long long>(HashBytes(key)));
+        return directory_ / name;
+    }
+
+    // Counts the tiles of earlier runs; other processes sharing the directory keep adding
+    // tiles, so Evict recounts.
+    [[nodiscard]] uintmax_t DirectorySize() const {
+        uintmax_t size = 0;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory_, error)) {
+            if (entry.path().extension() == ".tile") {
+                size += entry.file_size(error);
+            }
+        }
+        return size;
+    }
+
+    // Removes the least recently used tiles until the cache is down to three quarters of the
+    // limit, leaving room for the tiles of the next frames.
+    void Evict() {
+        struct Entry {
+            std::filesystem::file_time_type time;
+            uintmax_t size;
+            std::filesystem::path path;
+        };
+        std::vector<Entry> entries;
+        std::error_code error;
+        for (const auto& entry : std::filesystem::directory_iterator(directory_, error)) {
+            if (entry.path().extension() == ".tile") {
+                entries.push_back({entry.last_write_time(error), entry.file_size(error),
+                                   entry.path()});
+            }
+        }
+        std::sort(entries.begin(), entries.end(),
+                  [](const Entry& lhs, const Entry& rhs) { return lhs.time < rhs.time; });
+        size_ = 0;
+        for (const auto& entry : entries) {
+            size_ += entry.size;
+        }
+        for (const auto& entry : entries) {
+            if (size_ <= size_limit_ / 4 * 3) {
+                break;
+            }
+            if (std::filesystem::remove(entry.path, error)) {
+                size_ -= entry.size;
+                ++stats_.evicted;
+            }
+        }
+    }
+
+private:
+    std::filesystem::path directory_;
+    uintmax_t size_limit_;
+    uintmax_t size_ = 0;
+    TileCacheStats stats_;
+};
+
+// Renders the frame tile by tile, tracing only the tiles missing from the cache; the scene is
+// loaded on the first miss, so a fully cached frame costs hashing the scene files.
+inline Image RenderCached(const std::string& filename, const CameraOptions& camera_options,
+                          const RenderOptions& render_options, TileCache& cache) {
+    auto scene_hash = HashScene(filename);
+    int width = camera_options.screen_width;
+    int height = camera_options.screen_height;
+    int tile_size = std::max(render_options.tile_size, 1);
+    std::optional<Raytracer> tracer;
+
+    PixelValues values(width, std::vector<geometry::Vector3D<>>(height));
+    for (const auto& tile : SplitIntoTiles(width, height, tile_size)) {
+        auto key = TileKey(scene_hash, camera_options, render_options, tile);
+        auto floats = cache.Load(key);
+        if (!floats || floats->size() != static_cast<size_t>(tile.width) * tile.height * 3) {
+            if (!tracer) {
+                tracer.emplace(filename, camera_options, render_options);
+            }
+            floats = tracer->TraceRegion(tile);
+            cache.Store(key, *floats);
+        }
+        auto value = floats->begin();
+        for (int j = 0; j < tile.height; ++j) {
+            for (int i = 0; i < tile.width; ++i) {
+                auto& pixel = values[tile.x + i][tile.y + j];
+                for (int channel = 0; channel < 3; ++channel) {
+                    pixel[channel] = *value++;
+                }
+            }
+        }
+    }
+
+    double normalization = render_options.normalization;
+    return BuildImageFromValues(std::move(values), render_options.mode, normalization,
+                                render_options.cost_metric, render_options.color_map);
+}
+}  // namespace raytracer
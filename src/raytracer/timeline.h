@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Optional timeline of scoped spans for trace viewers. Spans are written into a ring buffer of
+// the thread that records them, without locks; a disabled timeline costs a relaxed load per span.
+// Start, Stop and the dumps are meant to be called between renders.
+namespace raytracer {
+struct TimelineEvent {
+    const char* name = nullptr;  // a string literal
+    uint64_t start_nanoseconds = 0;
+    uint64_t duration_nanoseconds = 0;
+    uint32_t thread = 0;
+};
+
+class Timeline {
+public:
+    // Events a thread keeps, older ones are overwritten.
+    static constexpr size_t kCapacity = size_t{1} << 14;
+
+    static Timeline& Instance() {
+        static Timeline timeline;
+        return timeline;
+    }
+
+    // Drops the recorded events and starts recording, times are relative to this call.
+    void Start() {
+        std::lock_guard lock(mutex_);
+        for (auto& buffer : buffers_) {
+            buffer->first = buffer->written.load(std::memory_order_acquire);
+        }
+        origin_ = std::chrono::steady_clock::now();
+        enabled_.store(true, std::memory_order_release);
+    }
+
+    void Stop() {
+        enabled_.store(false, std::memory_order_release);
+    }
+
+    [[nodiscard]] bool IsEnabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint64_t Now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - origin_)
+            .count();
+    }
+
+    void Record(const char* name, uint64_t start_nanoseconds, uint64_t end_nanoseconds) {
+        auto& local = LocalBuffer();
+        auto index = local.buffer->written.load(std::memory_order_relaxed);
+        local.buffer->events[index % kCapacity] = {name, start_nanoseconds,
+                                                   end_nanoseconds - start_nanoseconds,
+                                                   local.thread};
+        local.buffer->written.store(index + 1, std::memory_order_release);
+    }
+
+    // Events since Start ordered by start time, the ones of every thread.
+    [[nodiscard]] std::vector<TimelineEvent> GetEvents() const {
+        std::vector<TimelineEvent> events;
+        std::lock_guard lock(mutex_);
+        for (const auto& buffer : buffers_) {
+            auto written = buffer->written.load(std::memory_order_acquire);
+            auto first = std::max(buffer->first, written > kCapacity ? written - kCapacity : 0);
+            for (auto index = first; index < written; ++index) {
+                events.push_back(buffer->events[index % kCapacity]);
+            }
+        }
+        std::sort(events.begin(), events.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.start_nanoseconds < rhs.start_nanoseconds;
+        });
+        return events;
+    }
+
+    // Chrome trace event JSON of the events, for chrome://tracing or Perfetto.
+    void WriteChromeTrace(std::ostream& out) const {
+        auto events = GetEvents();
+        std::vector<uint32_t> threads;
+        for (const auto& event : events) {
+            threads.push_back(event.thread);
+        }
+        std::sort(threads.begin(), threads.end());
+        threads.erase(std::unique(threads.begin(), threads.end()), threads.end());
+
+        out << "{\"traceEvents\": [";
+        const char* separator = "\n";
+        for (auto thread : threads) {
+            out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+                << thread << ", \"args\": {\"name\": \"thread " << thread << "\"}}";
+            separator = ",\n";
+        }
+        for (const auto& event : events) {
+            out << separator << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"ts\": ";
+            WriteMicroseconds(out, event.start_nanoseconds);
+            out << ", \"dur\": ";
+            WriteMicroseconds(out, event.duration_nanoseconds);
+            out << ", \"pid\": 1, \"tid\": " << event.thread << "}";
+            separator = ",\n";
+        }
+        out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    }
+
+private:
+    struct Buffer {
+        std::array<TimelineEvent, kCapacity> events;
+        std::atomic<uint64_t> written = 0;
+        uint64_t first = 0;  // index of the first event since Start
+        std::atomic<bool> in_use = false;
+    };
+
+    // Buffer of the calling thread, handed back for reuse when the thread exits so short lived
+    // worker threads don't keep allocating.
+    struct LocalSlot {
+        Buffer* buffer = nullptr;
+        uint32_t thread = 0;
+
+        ~LocalSlot() {
+            if (buffer) {
+                buffer->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    Timeline() = default;
+
+    LocalSlot& LocalBuffer() {
+        thread_local LocalSlot local;
+        if (!local.buffer) {
+            local.thread = next_thread_.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard lock(mutex_);
+            for (auto& buffer : buffers_) {
+                if (!buffer->in_use.exchange(true, std::memory_order_acquire)) {
+                    local.buffer = buffer.get();
+                    break;
+                }
+            }
+            if (!local.buffer) {
+                buffers_.push_back(std::make_unique<Buffer>());
+                local.buffer = buffers_.back().get();
+                local.buffer->in_use.store(true, std::memory_order_relaxed);
+            }
+        }
+        return local;
+    }
+
+    // Trace event times are microseconds, written with nanosecond precision.
+    static void WriteMicroseconds(std::ostream& out, uint64_t nanoseconds) {
+        auto fraction = nanoseconds % 1000;
+        out << nanoseconds / 1000 << '.' << fraction / 100 << fraction / 10 % 10 << fraction % 10;
+    }
+
+private:
+    std::atomic<bool> enabled_ = false;
+    std::atomic<uint32_t> next_thread_ = 1;
+    std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+};
+
+// Records its lifetime as an event named name, a string literal, while the timeline is enabled.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name_(name) {
+        auto& timeline = Timeline::Instance();
+        if (timeline.IsEnabled()) {
+            start_ = timeline.Now();
+            recording_ = true;
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan() {
+        if (recording_) {
+            auto& timeline = Timeline::Instance();
+            timeline.Record(name_, start_, timeline.Now());
+        }
+    }
+
+private:
+    const char* name_;
+    uint64_t start_ = 0;
+    bool recording_ = false;
+};
+}  // namespace raytracer
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+
+namespace scene {
+enum class AcceleratorType { kBvh, kWideBvh, kGrid, kKdTree, kBruteForce };
+
+inline std::string GetAcceleratorName(AcceleratorType type) {
+    switch (type) {
+        case AcceleratorType::kBvh:
+            return "bvh";
+        case AcceleratorType::kWideBvh:
+            return "wide-bvh";
+        case AcceleratorType::kGrid:
+            return "grid";
+        case AcceleratorType::kKdTree:
+            return "kd-tree";
+        case AcceleratorType::kBruteForce:
+            return "brute-force";
+    }
+    return "unknown";
+}
+
+// Non-owning reference to a callable (primitive, max_distance) -> std::optional<double> that
+// returns the distance to the primitive if it is hit closer than max_distance.
+class PrimitiveIntersector {
+public:
+    template <typename Function>
+    PrimitiveIntersector(const Function& function)
+        : function_(&function), call_([](const void* function, size_t primitive,
+                                         double max_distance) -> std::optional<double> {
+              return (*static_cast<const Function*>(function))(primitive, max_distance);
+          }) {
+    }
+
+    std::optional<double> operator()(size_t primitive, double max_distance) const {
+        return call_(function_, primitive, max_distance);
+    }
+
+private:
+    const void* function_;
+    std::optional<double> (*call_)(const void*, size_t, double);
+};
+
+// Spatial index over an indexed set of primitives of which it only knows the bounds. Distances
+// are ray parameters, so rays are expected to be normalized by the caller.
+class Accelerator {
+public:
+    virtual ~Accelerator() = default;
+
+    virtual void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) = 0;
+
+    // Adapts to moved primitives. Structures that can not be updated in place are rebuilt.
+    // Returns whether a full rebuild happened.
+    virtual bool Refit(const std::vector<geometry::BoundingBox<>>& primitive_bounds,
+                       double /*rebuild_threshold*/) {
+        Build(primitive_bounds);
+        return true;
+    }
+
+    // Returns the closest distance below max_distance and the primitive index.
+    [[nodiscard]] virtual std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const = 0;
+
+    // Whether any primitive is hit below max_distance, traversal stops at the first one.
+    [[nodiscard]] virtual bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                            const PrimitiveIntersector& intersect) const = 0;
+
+    [[nodiscard]] virtual const geometry::BoundingBox<>& Bounds() const = 0;
+
+    [[nodiscard]] virtual size_t MemoryUsage() const = 0;
+};
+}  // namespace scene
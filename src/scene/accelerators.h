@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+
+#include "scene/accelerator.h"
+#include "scene/bvh.h"
+#include "scene/wide_bvh.h"
+#include "scene/grid.h"
+#include "scene/kd_tree.h"
+#include "scene/brute_force.h"
+
+namespace scene {
+inline std::unique_ptr<Accelerator> MakeAccelerator(AcceleratorType type) {
+    switch (type) {
+        case AcceleratorType::kBvh:
+            return std::make_unique<Bvh>();
+        case AcceleratorType::kWideBvh:
+            return std::make_unique<WideBvh>();
+        case AcceleratorType::kGrid:
+            return std::make_unique<Grid>();
+        case AcceleratorType::kKdTree:
+            return std::make_unique<KdTree>();
+        case AcceleratorType::kBruteForce:
+            return std::make_unique<BruteForce>();
+        default:
+            throw std::runtime_error("Bad accelerator type");
+    }
+}
+}  // namespace scene
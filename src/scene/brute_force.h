@@ -0,0 +1,68 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+#include "scene/accelerator.h"
+
+namespace scene {
+// Tests every primitive. Reference for the other accelerators.
+class BruteForce : public Accelerator {
+public:
+    void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) override {
+        bounds_ = {};
+        for (const auto& box : primitive_bounds) {
+            bounds_.Extend(box);
+        }
+        primitive_count_ = primitive_bounds.size();
+    }
+
+    bool Refit(const std::vector<geometry::BoundingBox<>>& primitive_bounds, double) override {
+        Build(primitive_bounds);
+        return false;
+    }
+
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const override {
+        return Search<false>(ray, max_distance, intersect);
+    }
+
+    [[nodiscard]] bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                    const PrimitiveIntersector& intersect) const override {
+        return Search<true>(ray, max_distance, intersect).has_value();
+    }
+
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const override {
+        return bounds_;
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const override {
+        return 0;
+    }
+
+private:
+    // The closest hit, or with kAnyHit the first one.
+    template <bool kAnyHit>
+    std::optional<std::pair<double, size_t>> Search(const geometry::Ray<>&, double max_distance,
+                                                    const PrimitiveIntersector& intersect) const {
+        std::optional<std::pair<double, size_t>> closest;
+        for (size_t primitive = 0; primitive < primitive_count_; ++primitive) {
+            auto distance = intersect(primitive, max_distance);
+            if (distance && *distance < max_distance) {
+                max_distance = *distance;
+                closest = {*distance, primitive};
+                if constexpr (kAnyHit) {
+                    return closest;
+                }
+            }
+        }
+        return closest;
+    }
+
+    geometry::BoundingBox<> bounds_;
+    size_t primitive_count_ = 0;
+};
+}  // namespace scene
@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+#include "scene/accelerator.h"
+#include "raytracer/parallel.h"
+
+namespace scene {
+// Binary bounding volume hierarchy over an indexed set of primitives. It only knows primitive
+// bounds; the caller supplies the actual primitive test during traversal, so the same structure
+// serves mesh triangles and scene instances alike.
+class Bvh : public Accelerator {
+public:
+    struct Node {
+        geometry::BoundingBox<> bounds;
+        uint32_t first = 0;  // left child for inner nodes (right one follows it), else primitive
+        uint32_t count = 0;  // number of primitives in a leaf, zero for inner nodes
+    };
+
+public:
+    Bvh() = default;
+
+    explicit Bvh(const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        Build(primitive_bounds);
+    }
+
+    void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) override {
+        nodes_.clear();
+        primitive_indices_.resize(primitive_bounds.size());
+        std::iota(primitive_indices_.begin(), primitive_indices_.end(), 0);
+        if (primitive_bounds.empty()) {
+            return;
+        }
+
+        std::vector<geometry::Vector3D<>> centers;
+        centers.reserve(primitive_bounds.size());
+        for (const auto& box : primitive_bounds) {
+            centers.push_back(box.Center());
+        }
+
+        nodes_.reserve(2 * primitive_bounds.size());
+        nodes_.emplace_back();
+        BuildNode(0, 0, primitive_bounds.size(), primitive_bounds, centers);
+        build_cost_ = Cost();
+    }
+
+    // Recomputes node bounds for moved primitives keeping the topology and rebuilds once the
+    // refitted tree got rebuild_threshold times more expensive than a freshly built one.
+    bool Refit(const std::vector<geometry::BoundingBox<>>& primitive_bounds,
+               double rebuild_threshold) override {
+        RefitBounds(primitive_bounds);
+        if (Cost() > rebuild_threshold * build_cost_) {
+            Build(primitive_bounds);
+            return true;
+        }
+        return false;
+    }
+
+    // Subtrees below the first few levels are refitted in parallel, the levels above them after.
+    void RefitBounds(const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        if (nodes_.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> top_nodes;
+        std::vector<uint32_t> subtree_roots = {0};
+        while (subtree_roots.size() < kRefitTasksPerThread * raytracer::ThreadCount()) {
+            std::vector<uint32_t> next_roots;
+            for (auto node : subtree_roots) {
+                if (nodes_[node].count > 0) {
+                    next_roots.push_back(node);
+                } else {
+                    top_nodes.push_back(node);
+                    next_roots.push_back(nodes_[node].first);
+                    next_roots.push_back(nodes_[node].first + 1);
+                }
+            }
+            if (next_roots.size() == subtree_roots.size()) {
+                break;
+            }
+            subtree_roots = std::move(next_roots);
+        }
+
+        raytracer::ParallelFor(subtree_roots.size(), [&](size_t i) {
+            RefitNode(subtree_roots[i], primitive_bounds);
+        });
+        for (auto it = top_nodes.rbegin(); it != top_nodes.rend(); ++it) {
+            auto& node = nodes_[*it];
+            node.bounds = nodes_[node.first].bounds;
+            node.bounds.Extend(nodes_[node.first + 1].bounds);
+        }
+    }
+
+    // Surface area heuristic cost of the hierarchy relative to its root box. Refitting keeps the
+    // topology, so comparing it against BuildCost tells how much the tree has degraded.
+    [[nodiscard]] double Cost() const {
+        if (nodes_.empty() || nodes_[0].bounds.SurfaceArea() == 0) {
+            return 0;
+        }
+        double cost = 0;
+        for (const auto& node : nodes_) {
+            cost += node.bounds.SurfaceArea() *
+                    (node.count > 0 ? kIntersectionCost * node.count : kTraversalCost);
+        }
+        return cost / nodes_[0].bounds.SurfaceArea();
+    }
+
+    [[nodiscard]] double BuildCost() const {
+        return build_cost_;
+    }
+
+public:
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const override {
+        return Traverse(ray, max_distance, intersect);
+    }
+
+    [[nodiscard]] bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                    const PrimitiveIntersector& intersect) const override {
+        return Traverse<true>(ray, max_distance, intersect).has_value();
+    }
+
+    // Statically dispatched version of Intersect: intersect(primitive, max_distance) has to
+    // return the distance to the primitive if it is hit closer than max_distance. With kAnyHit
+    // the first such hit is returned instead of the closest one.
+    template <bool kAnyHit = false, typename Intersector>
+    std::optional<std::pair<double, size_t>> Traverse(const geometry::Ray<>& ray,
+                                                      double max_distance,
+                                                      Intersector&& intersect) const {
+        if (nodes_.empty()) {
+            return {};
+        }
+        auto inverse_direction = GetInverseDirection(ray);
+        if (!GetEntryDistance(ray, inverse_direction, nodes_[0].bounds, max_distance)) {
+            return {};
+        }
+
+        std::optional<std::pair<double, size_t>> closest;
+        std::array<uint32_t, kMaxDepth> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+
+        while (stack_size > 0) {
+            const Node& node = nodes_[stack[--stack_size]];
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                    auto distance = intersect(primitive_indices_[i], max_distance);
+                    if (distance && *distance < max_distance) {
+                        max_distance = *distance;
+                        closest = {*distance, primitive_indices_[i]};
+                        if constexpr (kAnyHit) {
+                            return closest;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            auto left_entry =
+                GetEntryDistance(ray, inverse_direction, nodes_[node.first].bounds, max_distance);
+            auto right_entry = GetEntryDistance(ray, inverse_direction,
+                                                nodes_[node.first + 1].bounds, max_distance);
+            if (left_entry && right_entry) {
+                // Visit the nearer child first so that it shortens max_distance for the other one.
+                bool left_first = *left_entry <= *right_entry;
+                stack[stack_size++] = left_first ? node.first + 1 : node.first;
+                stack[stack_size++] = left_first ? node.first : node.first + 1;
+            } else if (left_entry) {
+                stack[stack_size++] = node.first;
+            } else if (right_entry) {
+                stack[stack_size++] = node.first + 1;
+            }
+        }
+        return closest;
+    }
+
+public:
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const override {
+        static const geometry::BoundingBox<> kEmpty;
+        return nodes_.empty() ? kEmpty : nodes_[0].bounds;
+    }
+
+    [[nodiscard]] const std::vector<Node>& GetNodes() const {
+        return nodes_;
+    }
+
+    [[nodiscard]] const std::vector<uint32_t>& GetPrimitiveIndices() const {
+        return primitive_indices_;
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const override {
+        return nodes_.capacity() * sizeof(Node) + primitive_indices_.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    static constexpr size_t kMaxDepth = 64;
+    static constexpr size_t kMaxLeafSize = 4;
+    static constexpr size_t kBinCount = 16;
+    static constexpr size_t kRefitTasksPerThread = 4;
+    static constexpr double kTraversalCost = 1;
+    static constexpr double kIntersectionCost = 1;
+
+    void RefitNode(uint32_t node_index,
+                   const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        auto& node = nodes_[node_index];
+        node.bounds = {};
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                node.bounds.Extend(primitive_bounds[primitive_indices_[i]]);
+            }
+            return;
+        }
+        RefitNode(node.first, primitive_bounds);
+        RefitNode(node.first + 1, primitive_bounds);
+        node.bounds.Extend(nodes_[node.first].bounds);
+        node.bounds.Extend(nodes_[node.first + 1].bounds);
+    }
+
+    void BuildNode(size_t node_index, size_t begin, size_t end,
+                   const std::vector<geometry::BoundingBox<>>& primitive_bounds,
+                   const std::vector<geometry::Vector3D<>>& centers, size_t depth = 1) {
+        geometry::BoundingBox<> bounds;
+        geometry::BoundingBox<> center_bounds;
+        for (size_t i = begin; i < end; ++i) {
+            bounds.Extend(primitive_bounds[primitive_indices_[i]]);
+            center_bounds.Extend(centers[primitive_indices_[i]]);
+        }
+        nodes_[node_index].bounds = bounds;
+
+        size_t count = end - begin;
+        int axis = center_bounds.LongestAxis();
+        double axis_min = center_bounds.GetMin()[axis];
+        double axis_extent = center_bounds.GetMax()[axis] - axis_min;
+        if (count <= kMaxLeafSize || axis_extent <= 0 || depth + 1 >= kMaxDepth) {
+            MakeLeaf(node_index, begin, count);
+            return;
+        }
+
+        // Binned surface area heuristic along the longest axis of the centers.
+        auto bin_of = [&](uint32_t primitive) {
+            auto bin = static_cast<size_t>((centers[primitive][axis] - axis_min) / axis_extent *
+                                           kBinCount);
+            return std::min(bin, kBinCount - 1);
+        };
+        std::array<geometry::BoundingBox<>, kBinCount> bin_bounds;
+        std::array<size_t, kBinCount> bin_counts{};
+        for (size_t i = begin; i < end; ++i) {
+            auto bin = bin_of(primitive_indices_[i]);
+            bin_bounds[bin].Extend(primitive_bounds[primitive_indices_[i]]);
+            ++bin_counts[bin];
+        }
+
+        std::array<double, kBinCount> left_costs{};
+        geometry::BoundingBox<> accumulated;
+        size_t accumulated_count = 0;
+        for (size_t bin = 0; bin + 1 < kBinCount; ++bin) {
+            accumulated.Extend(bin_bounds[bin]);
+            accumulated_count += bin_counts[bin];
+            left_costs[bin] = accumulated.SurfaceArea() * accumulated_count;
+        }
+        double best_cost = std::numeric_limits<double>::infinity();
+        size_t best_split = 0;
+        accumulated = {};
+        accumulated_count = 0;
+        for (size_t bin = kBinCount - 1; bin > 0; --bin) {
+            accumulated.Extend(bin_bounds[bin]);
+            accumulated_count += bin_counts[bin];
+            double cost = left_costs[bin - 1] + accumulated.SurfaceArea() * accumulated_count;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = bin;
+            }
+        }
+
+        if (best_cost >= bounds.SurfaceArea() * count && count <= 2 * kMaxLeafSize) {
+            MakeLeaf(node_index, begin, count);
+            return;
+        }
+
+        auto middle = std::partition(
+            primitive_indices_.begin() + begin, primitive_indices_.begin() + end,
+            [&](uint32_t primitive) { return bin_of(primitive) < best_split; });
+        size_t split = middle - primitive_indices_.begin();
+        if (split == begin || split == end) {
+            split = begin + count / 2;
+        }
+
+        auto left = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+        nodes_.emplace_back();
+        nodes_[node_index].first = left;
+        nodes_[node_index].count = 0;
+        BuildNode(left, begin, split, primitive_bounds, centers, depth + 1);
+        BuildNode(left + 1, split, end, primitive_bounds, centers, depth + 1);
+    }
+
+    void MakeLeaf(size_t node_index, size_t begin, size_t count) {
+        nodes_[node_index].first = static_cast<uint32_t>(begin);
+        nodes_[node_index].count = static_cast<uint32_t>(count);
+    }
+
+private:
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> primitive_indices_;
+    double build_cost_ = 0;
+};
+}  // namespace scene
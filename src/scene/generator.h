@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "geometry/vector.h"
+
+// Synthetic OBJ/MTL scenes of any size for scaling benchmarks: a soup of small randomly oriented
+// triangles plus spheres and point lights, written in the dialect ReadScene accepts.
+namespace scene {
+enum class SceneDistribution {
+    kUniform,    // evenly spread over a cube
+    kClustered,  // dense gaussian blobs in the cube, mostly empty space around them
+    kLongThin,   // a long thin box along x, like a corridor or a cable
+};
+
+struct SyntheticSceneOptions {
+    size_t triangles = 100000;
+    size_t spheres = 0;
+    size_t lights = 1;
+    double transparent_ratio = 0;  // share of the triangles and spheres made of glass
+    SceneDistribution distribution = SceneDistribution::kUniform;
+    uint64_t seed = 1;
+};
+
+// Half sizes of the box around the origin the primitives of a distribution are placed in.
+inline geometry::Vector3D<> GetSyntheticSceneExtent(SceneDistribution distribution) {
+    return distribution == SceneDistribution::kLongThin ? geometry::Vector3D<>{16, 0.25, 0.25}
+                                                        : geometry::Vector3D<>{1, 1, 1};
+}
+
+// Writes the scene to obj_path and its materials next to it with the extension .mtl. Lines are
+// formatted by hand, tens of millions of triangles take a while through iostreams otherwise.
+inline void WriteSyntheticScene(const std::filesystem::path& obj_path,
+                                const SyntheticSceneOptions& options) {
+    constexpr int kClusters = 16;
+    constexpr double kClusterSigma = 0.08;  // relative to the extent
+    const std::array<const char*, 4> diffuse = {"diffuse0", "diffuse1", "diffuse2", "diffuse3"};
+
+    auto mtl_path = obj_path;
+    mtl_path.replace_extension(".mtl");
+    {
+        std::ofstream mtl(mtl_path);
+        const std::array<const char*, 4> colors = {"0.8 0.8 0.8", "0.8 0.3 0.2", "0.2 0.6 0.3",
+                                                   "0.2 0.3 0.8"};
+        for (size_t i = 0; i < diffuse.size(); ++i) {
+            mtl << "newmtl " << diffuse[i] << "\nNs 10\nNi 1\nKa 0 0 0\nKd " << colors[i]
+                << "\nKs 0.1 0.1 0.1\nal 0.9 0.1 0\n\n";
+        }
+        mtl << "newmtl glass\nNs 50\nNi 1.5\nKa 0 0 0\nKd 0.9 0.9 1\nKs 0.9 0.9 1\n"
+               "al 0.1 0.2 0.8\n";
+        if (!mtl) {
+            throw std::runtime_error("Can't write " + mtl_path.string());
+        }
+    }
+
+    std::ofstream obj(obj_path, std::ios::binary);
+    if (!obj) {
+        throw std::runtime_error("Can't write " + obj_path.string());
+    }
+    obj << "# " << options.triangles << " triangles, " << options.spheres << " spheres, "
+        << options.lights << " lights\nmtllib " << mtl_path.filename().string() << "\n";
+
+    std::mt19937_64 random(options.seed);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::normal_distribution<double> normal(0, kClusterSigma);
+    std::bernoulli_distribution transparent(std::clamp(options.transparent_ratio, 0.0, 1.0));
+    std::uniform_int_distribution<size_t> pick_diffuse(0, diffuse.size() - 1);
+
+    auto extent = GetSyntheticSceneExtent(options.distribution);
+    std::vector<geometry::Vector3D<>> clusters;
+    for (int i = 0; i < kClusters; ++i) {
+        clusters.push_back({uniform(random) * 0.8, uniform(random) * 0.8, uniform(random) * 0.8});
+    }
+    // A point of the distribution in unit coordinates, scaled by the extent.
+    auto sample_position = [&] {
+        geometry::Vector3D<> point;
+        if (options.distribution == SceneDistribution::kClustered) {
+            const auto& center = clusters[random() % clusters.size()];
+            for (int k = 0; k < 3; ++k) {
+                point[k] = std::clamp(center[k] + normal(random), -1.0, 1.0);
+            }
+        } else {
+            point = {uniform(random), uniform(random), uniform(random)};
+        }
+        return point * extent;
+    };
+    // Spacing of count primitives spread over the volume they occupy.
+    auto spacing = [&](size_t count) {
+        double volume = 8 * extent[0] * extent[1] * extent[2];
+        if (options.distribution == SceneDistribution::kClustered) {
+            volume = kClusters * std::pow(4 * kClusterSigma, 3) * extent[0] * extent[1] * extent[2];
+        }
+        return std::cbrt(volume / static_cast<double>(std::max<size_t>(count, 1)));
+    };
+
+    char line[160];
+    std::string current_material;
+    auto use_material = [&] {
+        std::string material = transparent(random) ? "glass" : diffuse[pick_diffuse(random)];
+        if (material != current_material) {
+            obj << "usemtl " << material << "\n";
+            current_material = std::move(material);
+        }
+    };
+    auto write_numbers = [&](const char* directive, std::initializer_list<double> numbers) {
+        char* end = line + sizeof(line);
+        char* position = std::copy(directive, directive + std::char_traits<char>::length(directive),
+                                   line);
+        for (double number : numbers) {
+            *position++ = ' ';
+            position = std::to_chars(position, end, number, std::chars_format::fixed, 5).ptr;
+        }
+        *position++ = '\n';
+        obj.write(line, position - line);
+    };
+
+    // Triangles about as large as their spacing, so rays meet a few of them on the way through.
+    double size = 1.5 * spacing(options.triangles);
+    for (size_t i = 0; i < options.triangles; ++i) {
+        use_material();
+        auto center = sample_position();
+        for (int corner = 0; corner < 3; ++corner) {
+            geometry::Vector3D<> offset = {uniform(random), uniform(random), uniform(random)};
+            auto vertex = center + offset * (size / 2);
+            write_numbers("v", {vertex[0], vertex[1], vertex[2]});
+        }
+        obj << "f -3 -2 -1\n";
+    }
+
+    double radius = 0.25 * spacing(options.spheres);
+    for (size_t i = 0; i < options.spheres; ++i) {
+        use_material();
+        auto center = sample_position();
+        write_numbers("S", {center[0], center[1], center[2], radius});
+    }
+
+    // Lights in a row above the scene sharing a total intensity of one.
+    for (size_t i = 0; i < options.lights; ++i) {
+        double x = options.lights == 1
+                       ? 0
+                       : extent[0] * (2.0 * static_cast<double>(i) / (options.lights - 1) - 1);
+        double intensity = 1.0 / static_cast<double>(options.lights);
+        write_numbers("P", {x, extent[1] + 1, extent[2] + 1, intensity, intensity, intensity});
+    }
+    if (!obj) {
+        throw std::runtime_error("Can't write " + obj_path.string());
+    }
+}
+}  // namespace scene
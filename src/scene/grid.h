@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+#include "scene/accelerator.h"
+
+namespace scene {
+// Uniform grid traversed with a 3D-DDA. Every cell lists the primitives whose bounds overlap it;
+// the lists are stored back to back with per cell offsets.
+class Grid : public Accelerator {
+public:
+    void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) override {
+        bounds_ = {};
+        for (const auto& box : primitive_bounds) {
+            bounds_.Extend(box);
+        }
+        cell_offsets_.clear();
+        cell_primitives_.clear();
+        if (primitive_bounds.empty()) {
+            return;
+        }
+
+        // About kDensity primitives per cell with roughly cubic cells.
+        auto extent = bounds_.Extent();
+        double volume = 1;
+        int flat_axes = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (extent[axis] > 0) {
+                volume *= extent[axis];
+            } else {
+                ++flat_axes;
+            }
+        }
+        double cell_side = std::pow(volume / (kDensity * primitive_bounds.size()),
+                                    1.0 / std::max(1, 3 - flat_axes));
+        for (int axis = 0; axis < 3; ++axis) {
+            resolution_[axis] =
+                extent[axis] > 0 && cell_side > 0
+                    ? std::clamp(static_cast<int>(extent[axis] / cell_side), 1, kMaxResolution)
+                    : 1;
+            cell_size_[axis] = extent[axis] > 0 ? extent[axis] / resolution_[axis] : 1;
+        }
+
+        // Count, then fill the cell lists.
+        std::vector<uint32_t> counts(CellCount() + 1, 0);
+        ForEachOverlappedCell(primitive_bounds, [&](size_t cell, size_t) { ++counts[cell + 1]; });
+        for (size_t cell = 1; cell < counts.size(); ++cell) {
+            counts[cell] += counts[cell - 1];
+        }
+        cell_offsets_ = counts;
+        cell_primitives_.resize(cell_offsets_.back());
+        ForEachOverlappedCell(primitive_bounds, [&](size_t cell, size_t primitive) {
+            cell_primitives_[counts[cell]++] = static_cast<uint32_t>(primitive);
+        });
+    }
+
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const override {
+        return Search<false>(ray, max_distance, intersect);
+    }
+
+    [[nodiscard]] bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                    const PrimitiveIntersector& intersect) const override {
+        return Search<true>(ray, max_distance, intersect).has_value();
+    }
+
+    // The closest hit, or with kAnyHit the first one.
+    template <bool kAnyHit>
+    std::optional<std::pair<double, size_t>> Search(const geometry::Ray<>& ray,
+                                                    double max_distance,
+                                                    const PrimitiveIntersector& intersect) const {
+        if (cell_primitives_.empty()) {
+            return {};
+        }
+        auto inverse_direction = GetInverseDirection(ray);
+        auto entry = GetEntryDistance(ray, inverse_direction, bounds_, max_distance);
+        if (!entry) {
+            return {};
+        }
+
+        std::array<int, 3> cell;
+        std::array<int, 3> step;
+        std::array<double, 3> next_crossing;
+        std::array<double, 3> crossing_delta;
+        auto entry_point = ray.GetOrigin() + ray.GetDirection() * *entry;
+        for (int axis = 0; axis < 3; ++axis) {
+            cell[axis] = CellCoordinate(entry_point[axis], axis);
+            double direction = ray.GetDirection()[axis];
+            if (direction == 0) {
+                step[axis] = 0;
+                next_crossing[axis] = std::numeric_limits<double>::infinity();
+                crossing_delta[axis] = std::numeric_limits<double>::infinity();
+                continue;
+            }
+            step[axis] = direction > 0 ? 1 : -1;
+            double boundary =
+                bounds_.GetMin()[axis] + (cell[axis] + (direction > 0 ? 1 : 0)) * cell_size_[axis];
+            next_crossing[axis] = (boundary - ray.GetOrigin()[axis]) * inverse_direction[axis];
+            crossing_delta[axis] = cell_size_[axis] * std::fabs(inverse_direction[axis]);
+        }
+
+        std::optional<std::pair<double, size_t>> closest;
+        while (true) {
+            size_t cell_index = CellIndex(cell[0], cell[1], cell[2]);
+            for (uint32_t i = cell_offsets_[cell_index]; i < cell_offsets_[cell_index + 1]; ++i) {
+                auto primitive = cell_primitives_[i];
+                auto distance = intersect(primitive, max_distance);
+                if (distance && *distance < max_distance) {
+                    max_distance = *distance;
+                    closest = {*distance, primitive};
+                    if constexpr (kAnyHit) {
+                        return closest;
+                    }
+                }
+            }
+
+            int axis = next_crossing[0] < next_crossing[1]
+                           ? (next_crossing[0] < next_crossing[2] ? 0 : 2)
+                           : (next_crossing[1] < next_crossing[2] ? 1 : 2);
+            // Anything hit before leaving the cell can not be occluded by later cells.
+            if (next_crossing[axis] >= max_distance) {
+                break;
+            }
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= resolution_[axis]) {
+                break;
+            }
+            next_crossing[axis] += crossing_delta[axis];
+        }
+        return closest;
+    }
+
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const override {
+        return bounds_;
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const override {
+        return cell_offsets_.capacity() * sizeof(uint32_t) +
+               cell_primitives_.capacity() * sizeof(uint32_t);
+    }
+
+    [[nodiscard]] const std::array<int, 3>& GetResolution() const {
+        return resolution_;
+    }
+
+private:
+    static constexpr double kDensity = 2;
+    static constexpr int kMaxResolution = 256;
+
+    [[nodiscard]] size_t CellCount() const {
+        return static_cast<size_t>(resolution_[0]) * resolution_[1] * resolution_[2];
+    }
+
+    [[nodiscard]] size_t CellIndex(int x, int y, int z) const {
+        return (static_cast<size_t>(z) * resolution_[1] + y) * resolution_[0] + x;
+    }
+
+    [[nodiscard]] int CellCoordinate(double position, int axis) const {
+        auto coordinate = static_cast<int>((position - bounds_.GetMin()[axis]) / cell_size_[axis]);
+        return std::clamp(coordinate, 0, resolution_[axis] - 1);
+    }
+
+    template <typename Callback>
+    void ForEachOverlappedCell(const std::vector<geometry::BoundingBox<>>& primitive_bounds,
+                               Callback&& callback) const {
+        for (size_t primitive = 0; primitive < primitive_bounds.size(); ++primitive) {
+            const auto& box = primitive_bounds[primitive];
+            std::array<int, 3> from, to;
+            for (int axis = 0; axis < 3; ++axis) {
+                from[axis] = CellCoordinate(box.GetMin()[axis], axis);
+                to[axis] = CellCoordinate(box.GetMax()[axis], axis);
+            }
+            for (int z = from[2]; z <= to[2]; ++z) {
+                for (int y = from[1]; y <= to[1]; ++y) {
+                    for (int x = from[0]; x <= to[0]; ++x) {
+                        callback(CellIndex(x, y, z), primitive);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    geometry::BoundingBox<> bounds_;
+    std::array<int, 3> resolution_ = {1, 1, 1};
+    geometry::Vector3D<> cell_size_ = {1, 1, 1};
+    std::vector<uint32_t> cell_offsets_;
+    std::vector<uint32_t> cell_primitives_;
+};
+}  // namespace scene
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "geometry/bounding_box.h"
+#include "geometry/transform.h"
+
+namespace scene {
+// A placement of a shared mesh in the world.
+struct Instance {
+public:
+    Instance(size_t mesh, const geometry::Transform<>& object_to_world)
+        : mesh(mesh),
+          object_to_world(object_to_world),
+          world_to_object(object_to_world.Inverse()) {
+    }
+
+    void SetTransform(const geometry::Transform<>& transform,
+                      const geometry::BoundingBox<>& mesh_bounds) {
+        object_to_world = transform;
+        world_to_object = transform.Inverse();
+        bounds = object_to_world.ApplyToBox(mesh_bounds);
+    }
+
+public:
+    size_t mesh;
+    geometry::Transform<> object_to_world;
+    geometry::Transform<> world_to_object;
+    geometry::BoundingBox<> bounds;
+};
+}  // namespace scene
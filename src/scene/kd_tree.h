@@ -0,0 +1,252 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+#include "scene/accelerator.h"
+
+namespace scene {
+// Kd-tree with binned surface area heuristic splits. Primitives straddling a split plane are
+// referenced from both sides.
+class KdTree : public Accelerator {
+public:
+    struct Node {
+        double split = 0;
+        uint32_t axis = kLeaf;  // kLeaf for leaves
+        uint32_t first = 0;     // above child for inner nodes (below one follows the node)
+        uint32_t count = 0;     // number of primitives in a leaf
+    };
+
+public:
+    void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) override {
+        nodes_.clear();
+        primitive_indices_.clear();
+        bounds_ = {};
+        for (const auto& box : primitive_bounds) {
+            bounds_.Extend(box);
+        }
+        if (primitive_bounds.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> primitives(primitive_bounds.size());
+        for (size_t i = 0; i < primitives.size(); ++i) {
+            primitives[i] = static_cast<uint32_t>(i);
+        }
+        auto max_depth = static_cast<int>(8 + 1.3 * std::log2(primitive_bounds.size()));
+        BuildNode(bounds_, std::move(primitives), primitive_bounds,
+                  std::min(max_depth, static_cast<int>(kMaxDepth) - 1));
+    }
+
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const override {
+        return Search<false>(ray, max_distance, intersect);
+    }
+
+    [[nodiscard]] bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                    const PrimitiveIntersector& intersect) const override {
+        return Search<true>(ray, max_distance, intersect).has_value();
+    }
+
+    // The closest hit, or with kAnyHit the first one.
+    template <bool kAnyHit>
+    std::optional<std::pair<double, size_t>> Search(const geometry::Ray<>& ray,
+                                                    double max_distance,
+                                                    const PrimitiveIntersector& intersect) const {
+        if (nodes_.empty()) {
+            return {};
+        }
+        auto inverse_direction = GetInverseDirection(ray);
+        auto interval = GetEntryExitDistances(ray, inverse_direction, bounds_, max_distance);
+        if (!interval) {
+            return {};
+        }
+
+        struct Task {
+            uint32_t node;
+            double t_min, t_max;
+        };
+        std::array<Task, kMaxDepth> stack;
+        size_t stack_size = 0;
+        uint32_t node_index = 0;
+        auto [t_min, t_max] = *interval;
+
+        std::optional<std::pair<double, size_t>> closest;
+        while (true) {
+            if (closest && closest->first <= t_min) {
+                break;
+            }
+            const Node& node = nodes_[node_index];
+            if (node.axis != kLeaf) {
+                double origin = ray.GetOrigin()[node.axis];
+                double t_split = (node.split - origin) * inverse_direction[node.axis];
+                bool below_first =
+                    origin < node.split ||
+                    (origin == node.split && ray.GetDirection()[node.axis] <= 0);
+                uint32_t first_child = below_first ? node_index + 1 : node.first;
+                uint32_t second_child = below_first ? node.first : node_index + 1;
+
+                if (t_split > t_max || t_split <= 0 || std::isnan(t_split)) {
+                    node_index = first_child;
+                } else if (t_split < t_min) {
+                    node_index = second_child;
+                } else {
+                    stack[stack_size++] = {second_child, t_split, t_max};
+                    node_index = first_child;
+                    t_max = t_split;
+                }
+                continue;
+            }
+
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                auto primitive = primitive_indices_[i];
+                auto distance = intersect(primitive, max_distance);
+                if (distance && *distance < max_distance) {
+                    max_distance = *distance;
+                    closest = {*distance, primitive};
+                    if constexpr (kAnyHit) {
+                        return closest;
+                    }
+                }
+            }
+            // A hit inside this leaf's interval can not be beaten by the leaves behind it.
+            if (stack_size == 0 || (closest && closest->first <= t_max)) {
+                break;
+            }
+            auto task = stack[--stack_size];
+            node_index = task.node;
+            t_min = task.t_min;
+            t_max = task.t_max;
+        }
+        return closest;
+    }
+
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const override {
+        return bounds_;
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const override {
+        return nodes_.capacity() * sizeof(Node) + primitive_indices_.capacity() * sizeof(uint32_t);
+    }
+
+    [[nodiscard]] const std::vector<Node>& GetNodes() const {
+        return nodes_;
+    }
+
+private:
+    static constexpr uint32_t kLeaf = 3;
+    static constexpr size_t kMaxDepth = 64;
+    static constexpr size_t kMaxLeafSize = 2;
+    static constexpr size_t kBinCount = 32;
+    static constexpr double kTraversalCost = 1;
+    static constexpr double kIntersectionCost = 1.5;
+    static constexpr double kEmptyBonus = 0.5;
+
+    void BuildNode(const geometry::BoundingBox<>& bounds, std::vector<uint32_t> primitives,
+                   const std::vector<geometry::BoundingBox<>>& primitive_bounds, int depth) {
+        auto node_index = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+
+        auto split = FindSplit(bounds, primitives, primitive_bounds);
+        if (primitives.size() <= kMaxLeafSize || depth <= 0 || !split) {
+            nodes_[node_index].first = static_cast<uint32_t>(primitive_indices_.size());
+            nodes_[node_index].count = static_cast<uint32_t>(primitives.size());
+            primitive_indices_.insert(primitive_indices_.end(), primitives.begin(),
+                                      primitives.end());
+            return;
+        }
+
+        auto [axis, position] = *split;
+        std::vector<uint32_t> below, above;
+        for (auto primitive : primitives) {
+            const auto& box = primitive_bounds[primitive];
+            if (box.GetMin()[axis] <= position) {
+                below.push_back(primitive);
+            }
+            if (box.GetMax()[axis] >= position) {
+                above.push_back(primitive);
+            }
+        }
+        primitives.clear();
+        primitives.shrink_to_fit();
+
+        auto below_max = bounds.GetMax();
+        below_max[axis] = position;
+        auto above_min = bounds.GetMin();
+        above_min[axis] = position;
+
+        nodes_[node_index].axis = axis;
+        nodes_[node_index].split = position;
+        BuildNode({bounds.GetMin(), below_max}, std::move(below), primitive_bounds, depth - 1);
+        nodes_[node_index].first = static_cast<uint32_t>(nodes_.size());
+        BuildNode({above_min, bounds.GetMax()}, std::move(above), primitive_bounds, depth - 1);
+    }
+
+    // Best SAH split plane over all axes, or nothing if a leaf is cheaper.
+    static std::optional<std::pair<int, double>> FindSplit(
+        const geometry::BoundingBox<>& bounds, const std::vector<uint32_t>& primitives,
+        const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        double area = bounds.SurfaceArea();
+        if (area <= 0) {
+            return {};
+        }
+        double best_cost = kIntersectionCost * primitives.size();
+        std::optional<std::pair<int, double>> best;
+        auto extent = bounds.Extent();
+
+        for (int axis = 0; axis < 3; ++axis) {
+            if (extent[axis] <= 0) {
+                continue;
+            }
+            double axis_min = bounds.GetMin()[axis];
+            auto bin_of = [&](double position) {
+                auto bin = static_cast<int>((position - axis_min) / extent[axis] * kBinCount);
+                return std::clamp(bin, 0, static_cast<int>(kBinCount) - 1);
+            };
+            // starts[b] primitives begin in bin b, ends[b] primitives end in bin b.
+            std::array<size_t, kBinCount> starts{}, ends{};
+            for (auto primitive : primitives) {
+                ++starts[bin_of(primitive_bounds[primitive].GetMin()[axis])];
+                ++ends[bin_of(primitive_bounds[primitive].GetMax()[axis])];
+            }
+
+            size_t below_count = 0;
+            size_t above_count = primitives.size();
+            auto other_a = extent[(axis + 1) % 3];
+            auto other_b = extent[(axis + 2) % 3];
+            for (size_t plane = 1; plane < kBinCount; ++plane) {
+                below_count += starts[plane - 1];
+                above_count -= ends[plane - 1];
+                double position = axis_min + extent[axis] * plane / kBinCount;
+                double below_length = position - axis_min;
+                double above_length = extent[axis] - below_length;
+                double below_area = 2 * (other_a * other_b + below_length * (other_a + other_b));
+                double above_area = 2 * (other_a * other_b + above_length * (other_a + other_b));
+                double bonus = (below_count == 0 || above_count == 0) ? kEmptyBonus : 0;
+                double cost = kTraversalCost +
+                              kIntersectionCost * (1 - bonus) *
+                                  (below_area * below_count + above_area * above_count) / area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = std::pair{axis, position};
+                }
+            }
+        }
+        return best;
+    }
+
+private:
+    geometry::BoundingBox<> bounds_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> primitive_indices_;
+};
+}  // namespace scene
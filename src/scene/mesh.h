@@ -0,0 +1,217 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "geometry/geometry.h"
+#include "geometry/bounding_box.h"
+#include "scene/object.h"
+#include "scene/accelerators.h"
+#include "raytracer/parallel.h"
+#include "raytracer/stats.h"
+
+namespace scene {
+// Outcome of the load time preprocessing, see PreprocessMesh. Locality is the mean distance
+// between the centroids of consecutive triangles relative to the diagonal of the mesh.
+struct PreprocessStats {
+    size_t triangles_before = 0;
+    size_t triangles_after = 0;
+    size_t vertices_before = 0;
+    size_t vertices_after = 0;
+    double locality_before = 0;
+    double locality_after = 0;
+};
+
+// Triangles of zero area, which no ray can hit.
+inline bool IsDegenerate(const geometry::Triangle<>& triangle) {
+    return CrossProduct(triangle.GetVertex(1) - triangle.GetVertex(0),
+                        triangle.GetVertex(2) - triangle.GetVertex(0))
+        .Zero();
+}
+
+// A set of primitives sharing one coordinate frame together with its acceleration structure.
+// Primitives are numbered triangles first, then spheres.
+struct Mesh {
+public:
+    void Build(AcceleratorType type = AcceleratorType::kBvh) {
+        std::vector<geometry::BoundingBox<>> bounds;
+        bounds.reserve(PrimitiveCount());
+        for (size_t i = 0; i < PrimitiveCount(); ++i) {
+            bounds.push_back(GetPrimitiveBounds(i));
+        }
+        accelerator = MakeAccelerator(type);
+        accelerator->Build(bounds);
+    }
+
+    // Moves the triangles to new vertex positions. The buffer has to be laid out like the one the
+    // mesh was read from. Triangles that collapse are set aside and ones that open up again come
+    // back, which makes the next Refit rebuild.
+    void UpdateVertices(const std::vector<geometry::Vector3D<>>& vertices) {
+        if (vertices.size() != vertex_count || vertex_remap.size() != vertex_count ||
+            vertex_indices.size() != objects.size() ||
+            degenerate_vertex_indices.size() != degenerate_objects.size()) {
+            throw std::runtime_error("Vertex buffer does not match mesh topology");
+        }
+        WeldVertices(vertices);
+        bool changed = SetVertices(objects, vertex_indices, false);
+        changed |= SetVertices(degenerate_objects, degenerate_vertex_indices, true);
+        if (!changed) {
+            return;
+        }
+        primitives_changed_ = true;
+        std::vector<Object> all_objects = std::move(objects);
+        std::vector<std::array<uint32_t, 3>> all_indices = std::move(vertex_indices);
+        all_objects.insert(all_objects.end(), degenerate_objects.begin(),
+                           degenerate_objects.end());
+        all_indices.insert(all_indices.end(), degenerate_vertex_indices.begin(),
+                           degenerate_vertex_indices.end());
+        objects.clear();
+        vertex_indices.clear();
+        degenerate_objects.clear();
+        degenerate_vertex_indices.clear();
+        for (size_t i = 0; i < all_objects.size(); ++i) {
+            bool degenerate = IsDegenerate(all_objects[i].polygon);
+            (degenerate ? degenerate_objects : objects).push_back(all_objects[i]);
+            (degenerate ? degenerate_vertex_indices : vertex_indices).push_back(all_indices[i]);
+        }
+    }
+
+    // Adapts the accelerator to the current primitives, see Accelerator::Refit.
+    bool Refit(double rebuild_threshold) {
+        std::vector<geometry::BoundingBox<>> bounds(PrimitiveCount());
+        raytracer::ParallelFor(bounds.size(), [&](size_t i) { bounds[i] = GetPrimitiveBounds(i); });
+        if (primitives_changed_) {
+            primitives_changed_ = false;
+            accelerator->Build(bounds);
+            return true;
+        }
+        return accelerator->Refit(bounds, rebuild_threshold);
+    }
+
+    [[nodiscard]] size_t PrimitiveCount() const {
+        return objects.size() + sphere_objects.size();
+    }
+
+    [[nodiscard]] bool IsSphere(size_t primitive) const {
+        return primitive >= objects.size();
+    }
+
+    [[nodiscard]] geometry::BoundingBox<> GetPrimitiveBounds(size_t primitive) const {
+        if (IsSphere(primitive)) {
+            return GetBoundingBox(sphere_objects[primitive - objects.size()].sphere);
+        }
+        return GetBoundingBox(objects[primitive].polygon);
+    }
+
+    [[nodiscard]] std::optional<double> IntersectPrimitive(size_t primitive,
+                                                           const geometry::Ray<>& ray) const {
+        std::optional<geometry::Intersection<>> intersection;
+        if (IsSphere(primitive)) {
+            RAYTRACER_COUNT(sphere_tests);
+            intersection = GetIntersection(ray, sphere_objects[primitive - objects.size()].sphere);
+        } else {
+            RAYTRACER_COUNT(triangle_tests);
+            intersection = GetIntersection(ray, objects[primitive].polygon);
+        }
+        if (!intersection) {
+            return {};
+        }
+        return intersection->GetDistance();
+    }
+
+    // The ray direction is expected to be normalized, so distances match ray parameters.
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(const geometry::Ray<>& ray,
+                                                                     double max_distance) const {
+        return accelerator->Intersect(ray, max_distance, [&](size_t primitive, double) {
+            return IntersectPrimitive(primitive, ray);
+        });
+    }
+
+    // Whether anything is hit closer than max_distance, see Intersect.
+    [[nodiscard]] bool Occluded(const geometry::Ray<>& ray, double max_distance) const {
+        return accelerator->IntersectAny(ray, max_distance, [&](size_t primitive, double) {
+            return IntersectPrimitive(primitive, ray);
+        });
+    }
+
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const {
+        return accelerator->Bounds();
+    }
+
+    // Bytes held by the primitives, the topology and the acceleration structure.
+    [[nodiscard]] size_t MemoryUsage() const {
+        return objects.capacity() * sizeof(Object) +
+               sphere_objects.capacity() * sizeof(SphereObject) +
+               vertex_indices.capacity() * sizeof(vertex_indices[0]) +
+               welded_vertices.capacity() * sizeof(geometry::Vector3D<>) +
+               vertex_remap.capacity() * sizeof(uint32_t) +
+               degenerate_objects.capacity() * sizeof(Object) +
+               degenerate_vertex_indices.capacity() * sizeof(degenerate_vertex_indices[0]) +
+               (accelerator ? accelerator->MemoryUsage() : 0);
+    }
+
+private:
+    static bool SamePosition(const geometry::Vector3D<>& a, const geometry::Vector3D<>& b) {
+        return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+    }
+
+    // Moves the welded vertices. A file vertex that no longer sits where the others welded to
+    // the same slot gets a slot of its own.
+    void WeldVertices(const std::vector<geometry::Vector3D<>>& vertices) {
+        std::vector<bool> written(welded_vertices.size(), false);
+        for (size_t i = 0; i < vertices.size(); ++i) {
+            auto& slot = vertex_remap[i];
+            if (!written[slot]) {
+                welded_vertices[slot] = vertices[i];
+                written[slot] = true;
+            } else if (!SamePosition(welded_vertices[slot], vertices[i])) {
+                slot = static_cast<uint32_t>(welded_vertices.size());
+                welded_vertices.push_back(vertices[i]);
+                written.push_back(true);
+            }
+        }
+    }
+
+    // Returns whether any of the triangles is degenerate now when was_degenerate is false, or
+    // is not when it is true.
+    bool SetVertices(std::vector<Object>& triangles,
+                     const std::vector<std::array<uint32_t, 3>>& triangle_indices,
+                     bool was_degenerate) const {
+        bool changed = false;
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            const auto& indices = triangle_indices[i];
+            triangles[i].polygon = geometry::Triangle{welded_vertices[vertex_remap[indices[0]]],
+                                                      welded_vertices[vertex_remap[indices[1]]],
+                                                      welded_vertices[vertex_remap[indices[2]]]};
+            changed |= IsDegenerate(triangles[i].polygon) != was_degenerate;
+        }
+        return changed;
+    }
+
+public:
+    std::string name;
+    std::vector<Object> objects;
+    std::vector<SphereObject> sphere_objects;
+    std::unique_ptr<Accelerator> accelerator;
+
+    // Topology for vertex updates: per object indices into the vertex buffer of the file, which
+    // has vertex_count vertices. Triangles of zero area are kept aside, an update may open them.
+    std::vector<std::array<uint32_t, 3>> vertex_indices;
+    size_t vertex_count = 0;
+    // Bit identical file vertices share a welded vertex, vertex_remap maps the file vertices to
+    // them. Copies that a vertex update moves apart are welded no more.
+    std::vector<geometry::Vector3D<>> welded_vertices;
+    std::vector<uint32_t> vertex_remap;
+    std::vector<Object> degenerate_objects;
+    std::vector<std::array<uint32_t, 3>> degenerate_vertex_indices;
+
+    PreprocessStats preprocess_stats;
+
+private:
+    bool primitives_changed_ = false;
+};
+}  // namespace scene
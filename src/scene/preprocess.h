@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/bounding_box.h"
+#include "scene/mesh.h"
+
+namespace scene {
+inline std::ostream& operator<<(std::ostream& out, const PreprocessStats& stats) {
+    return out << "triangles " << stats.triangles_before << " -> " << stats.triangles_after
+               << ", vertices " << stats.vertices_before << " -> " << stats.vertices_after
+               << ", locality " << stats.locality_before << " -> " << stats.locality_after;
+}
+
+// Interleaves the bits of three 10-bit coordinates of the point inside bounds.
+inline uint32_t GetMortonCode(const geometry::Vector3D<>& point,
+                              const geometry::BoundingBox<>& bounds) {
+    auto spread = [](uint32_t x) {
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x << 8)) & 0x0300f00f;
+        x = (x | (x << 4)) & 0x030c30c3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    };
+    auto extent = bounds.Extent();
+    uint32_t code = 0;
+    for (int axis = 0; axis < 3; ++axis) {
+        double position =
+            extent[axis] > 0 ? (point[axis] - bounds.GetMin()[axis]) / extent[axis] : 0;
+        auto quantized = static_cast<uint32_t>(std::clamp(position * 1024, 0.0, 1023.0));
+        code |= spread(quantized) << axis;
+    }
+    return code;
+}
+
+inline geometry::Vector3D<> GetCentroid(const geometry::Triangle<>& triangle) {
+    return (triangle.GetVertex(0) + triangle.GetVertex(1) + triangle.GetVertex(2)) / 3;
+}
+
+inline double GetLocality(const std::vector<Object>& objects) {
+    if (objects.size() < 2) {
+        return 0;
+    }
+    geometry::BoundingBox<> bounds;
+    double distance = 0;
+    for (size_t i = 0; i < objects.size(); ++i) {
+        bounds.Extend(GetBoundingBox(objects[i].polygon));
+        if (i > 0) {
+            distance += Length(GetCentroid(objects[i].polygon) -
+                               GetCentroid(objects[i - 1].polygon));
+        }
+    }
+    double diagonal = Length(bounds.Extent());
+    return diagonal > 0 ? distance / (objects.size() - 1) / diagonal : 0;
+}
+
+// Load time cleanup of a freshly read mesh whose triangles index into vertices:
+//  * bit identical vertices are welded into welded_vertices, vertex_remap keeps file layout
+//    vertex updates working;
+//  * triangles of zero area, which no ray can hit, are set aside in degenerate_objects, where
+//    vertex updates can bring them back;
+//  * triangles are sorted along a Morton curve of their centroids, so that the primitives of a
+//    subtree, and the ones neighbouring rays hit, are close in memory.
+inline PreprocessStats PreprocessMesh(Mesh& mesh,
+                                      const std::vector<geometry::Vector3D<>>& vertices) {
+    PreprocessStats stats;
+    stats.triangles_before = mesh.objects.size();
+    stats.vertices_before = vertices.size();
+    stats.locality_before = GetLocality(mesh.objects);
+
+    auto hash = [](const std::array<double, 3>& position) {
+        size_t seed = 0;
+        for (double coordinate : position) {
+            seed = seed * 1000003 ^ std::hash<double>{}(coordinate);
+        }
+        return seed;
+    };
+    std::unordered_map<std::array<double, 3>, uint32_t, decltype(hash)> welded(vertices.size(),
+                                                                               hash);
+    mesh.welded_vertices.clear();
+    mesh.vertex_remap.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        // Adding zero turns -0 into +0, which compare equal but hash differently.
+        std::array<double, 3> position = {vertices[i][0] + 0.0, vertices[i][1] + 0.0,
+                                          vertices[i][2] + 0.0};
+        auto [it, inserted] =
+            welded.try_emplace(position, static_cast<uint32_t>(mesh.welded_vertices.size()));
+        if (inserted) {
+            mesh.welded_vertices.push_back(vertices[i]);
+        }
+        mesh.vertex_remap[i] = it->second;
+    }
+    stats.vertices_after = mesh.welded_vertices.size();
+
+    bool has_indices = mesh.vertex_indices.size() == mesh.objects.size();
+    std::vector<uint32_t> order;
+    order.reserve(mesh.objects.size());
+    geometry::BoundingBox<> centroid_bounds;
+    for (size_t i = 0; i < mesh.objects.size(); ++i) {
+        const auto& triangle = mesh.objects[i].polygon;
+        if (IsDegenerate(triangle)) {
+            if (has_indices) {
+                mesh.degenerate_objects.push_back(mesh.objects[i]);
+                mesh.degenerate_vertex_indices.push_back(mesh.vertex_indices[i]);
+            }
+            continue;
+        }
+        order.push_back(static_cast<uint32_t>(i));
+        centroid_bounds.Extend(GetCentroid(triangle));
+    }
+
+    std::vector<uint32_t> codes(mesh.objects.size());
+    for (auto i : order) {
+        codes[i] = GetMortonCode(GetCentroid(mesh.objects[i].polygon), centroid_bounds);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t lhs, uint32_t rhs) { return codes[lhs] < codes[rhs]; });
+
+    std::vector<Object> objects;
+    objects.reserve(order.size());
+    std::vector<std::array<uint32_t, 3>> vertex_indices;
+    for (auto i : order) {
+        objects.push_back(mesh.objects[i]);
+        if (has_indices) {
+            vertex_indices.push_back(mesh.vertex_indices[i]);
+        }
+    }
+    mesh.objects = std::move(objects);
+    if (has_indices) {
+        mesh.vertex_indices = std::move(vertex_indices);
+    }
+
+    stats.triangles_after = mesh.objects.size();
+    stats.locality_after = GetLocality(mesh.objects);
+    mesh.preprocess_stats = stats;
+    return stats;
+}
+}  // namespace scene
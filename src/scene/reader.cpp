@@ -6,14 +6,21 @@
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <functional>
+#include <cctype>
 
 #include "geometry/vector.h"
+#include "geometry/transform.h"
 #include "scene/scene.h"
 #include "scene/material.h"
 #include "scene/object.h"
 #include "scene/light.h"
 #include "scene/skybox.h"
+#include "scene/mesh.h"
+#include "scene/preprocess.h"
+#include "scene/instance.h"
 #include "raytracer/image.h"
+#include "raytracer/timeline.h"
 
 namespace {
 inline geometry::Vector3D<> GetThreeNumbers(const std::vector<std::string>& attributes,
@@ -51,6 +58,22 @@ inline std::pair<int, int> ParsePointTriplet(const std::string& line) {
     return {std::stod(parsed_line[0]), std::stod(parsed_line[2])};
 }
 
+// Instance placement: either a translation "tx ty tz" or a row-major 3x4 affine matrix.
+inline geometry::Transform<> GetTransform(const std::vector<std::string>& attributes, int begin) {
+    size_t count = attributes.size() - begin;
+    if (count == 3) {
+        return geometry::Transform<>::Translation(GetThreeNumbers(attributes, begin));
+    }
+    if (count == 12) {
+        std::array<double, 12> matrix;
+        for (size_t i = 0; i < 12; ++i) {
+            matrix[i] = std::stod(attributes[begin + i]);
+        }
+        return geometry::Transform<>(matrix);
+    }
+    throw std::runtime_error("Instance transform has to be 3 or 12 numbers");
+}
+
 inline std::string GetFolderPathFromFilePath(const std::string& s) {
     char sep = '/';
 
@@ -119,20 +142,21 @@ std::map<std::string, std::unique_ptr<scene::Material>> ConstructMaterials(std::
     return materials;
 }
 std::map<std::string, std::unique_ptr<scene::Material>> ReadMaterials(std::string_view filename) {
+    raytracer::TraceSpan span("material load");
     std::ifstream infile(static_cast<std::string>(filename));
     return ConstructMaterials(infile);
 }
-Scene ConstructScene(std::istream& input, const std::string& path) {
-    // Material fields
-    std::vector<Object> objects;
-    std::vector<SphereObject> sphere_objects;
-    std::vector<Light> lights;
-    Sky sky;
-    std::map<std::string, std::unique_ptr<scene::Material>> materials_pointers;
-    std::vector<std::unique_ptr<geometry::Vector3D<>>> normal_pointers;
+// Reads the geometry part of an obj file. Directives it does not know are handed to
+// on_other_directive, which lets the scene file add lights, sky and instances on top.
+Mesh ConstructMesh(
+    std::istream& input, const std::string& path, MaterialPointers& materials_pointers,
+    std::vector<std::unique_ptr<geometry::Vector3D<>>>& normal_pointers,
+    const std::function<void(const std::vector<std::string>&)>& on_other_directive = {}) {
+    Mesh mesh;
 
     // Aux objects
     std::vector<geometry::Vector3D<>> vertices;
+    size_t normals_begin = normal_pointers.size();
     std::string line;
     Material* current_material = nullptr;
 
@@ -144,6 +168,7 @@ Scene ConstructScene(std::istream& input, const std::string& path) {
 
         if (attributes[0] == "v") {
             vertices.push_back(GetThreeNumbers(attributes));
+            continue;
         }
 
         if (attributes[0] == "vt") {
@@ -177,7 +202,8 @@ Scene ConstructScene(std::istream& input, const std::string& path) {
                             normals[j] =
                                 normal_pointers[normal_pointers.size() + indices[j].second].get();
                         } else {
-                            normals[j] = normal_pointers[indices[j].second - 1].get();
+                            normals[j] =
+                                normal_pointers[normals_begin + indices[j].second - 1].get();
                         }
                     }
                 }
@@ -187,13 +213,20 @@ Scene ConstructScene(std::istream& input, const std::string& path) {
                     geometry::Triangle{vertices[indices[0].first], vertices[indices[1].first],
                                        vertices[indices[2].first]},
                     {normals[0], normals[1], normals[2]}};
-                objects.push_back(object);
+                mesh.objects.push_back(object);
+                mesh.vertex_indices.push_back({static_cast<uint32_t>(indices[0].first),
+                                               static_cast<uint32_t>(indices[1].first),
+                                               static_cast<uint32_t>(indices[2].first)});
             }
             continue;
         }
 
         if (attributes[0] == "mtllib") {
-            materials_pointers = ReadMaterials(path + "/" + attributes[1]);
+            // Materials of instanced files end up next to the scene ones; first definition wins
+            // so that already assigned material pointers never dangle.
+            for (auto& [name, material] : ReadMaterials(path + "/" + attributes[1])) {
+                materials_pointers.try_emplace(name, std::move(material));
+            }
             continue;
         }
 
@@ -203,31 +236,101 @@ Scene ConstructScene(std::istream& input, const std::string& path) {
         }
 
         if (attributes[0] == "S") {
-            sphere_objects.push_back(
+            mesh.sphere_objects.push_back(
                 {current_material,
                  geometry::Sphere{GetThreeNumbers(attributes), std::stod(attributes[4])}});
             continue;
         }
 
-        if (attributes[0] == "P") {
-            lights.push_back({GetThreeNumbers(attributes), GetThreeNumbers(attributes, 4)});
-            continue;
-        }
-
-        if (attributes[0] == "Sky") {
-            sky.image_ = std::make_shared<raytracer::Image>(path + "/" + attributes[3]);
+        if (on_other_directive) {
+            on_other_directive(attributes);
         }
     }
 
-    return {objects,
-            sphere_objects,
-            lights,
+    mesh.vertex_count = vertices.size();
+    PreprocessMesh(mesh, vertices);
+    return mesh;
+}
+Scene ConstructScene(std::istream& input, const std::string& path,
+                     AcceleratorType accelerator_type = AcceleratorType::kBvh) {
+    // Material fields
+    std::vector<Light> lights;
+    Sky sky;
+    MaterialPointers materials_pointers;
+    std::vector<std::unique_ptr<geometry::Vector3D<>>> normal_pointers;
+
+    // Instancing
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+    std::map<std::string, size_t> mesh_indices;
+
+    auto world = ConstructMesh(
+        input, path, materials_pointers, normal_pointers,
+        [&](const std::vector<std::string>& attributes) {
+            if (attributes[0] == "P") {
+                lights.push_back({GetThreeNumbers(attributes), GetThreeNumbers(attributes, 4)});
+                return;
+            }
+
+            if (attributes[0] == "Sky") {
+                auto filtering = (attributes.size() > 4 && attributes[4] == "bilinear")
+                                     ? Sky::Filtering::kBilinear
+                                     : Sky::Filtering::kNearest;
+                raytracer::TraceSpan span("skybox decode");
+                sky = Sky(raytracer::Image(path + "/" + attributes[3]), filtering);
+                return;
+            }
+
+            if (attributes[0] == "I") {
+                auto [it, inserted] = mesh_indices.try_emplace(attributes[1], meshes.size());
+                if (inserted) {
+                    auto mesh_path = path + "/" + attributes[1];
+                    std::ifstream mesh_file(mesh_path);
+                    if (!mesh_file) {
+                        throw std::runtime_error("Can't open " + mesh_path);
+                    }
+                    meshes.push_back(ConstructMesh(mesh_file,
+                                                   GetFolderPathFromFilePath(mesh_path),
+                                                   materials_pointers, normal_pointers));
+                    meshes.back().name = attributes[1];
+                }
+                instances.emplace_back(it->second, GetTransform(attributes, 2));
+            }
+        });
+
+    return {std::move(world),
+            std::move(lights),
             std::move(sky),
             std::move(materials_pointers),
-            std::move(normal_pointers)};
+            std::move(normal_pointers),
+            std::move(meshes),
+            std::move(instances),
+            accelerator_type};
 }
-Scene ReadScene(std::string_view filename) {
+// Only the vertex buffer of an obj file, e.g. the next frame of an animated sequence.
+std::vector<geometry::Vector3D<>> ReadVertices(std::string_view filename) {
     std::ifstream infile(static_cast<std::string>(filename));
-    return ConstructScene(infile, GetFolderPathFromFilePath(static_cast<std::string>(filename)));
+    if (!infile) {
+        throw std::runtime_error("Can't open " + static_cast<std::string>(filename));
+    }
+    std::vector<geometry::Vector3D<>> vertices;
+    std::string line;
+    while (std::getline(infile, line)) {
+        if (line.size() < 2 || line[0] != 'v' || !std::isspace(line[1])) {
+            continue;
+        }
+        vertices.push_back(GetThreeNumbers(ParseLine(line)));
+    }
+    return vertices;
+}
+Scene ReadScene(std::string_view filename,
+                AcceleratorType accelerator_type = AcceleratorType::kBvh) {
+    raytracer::TraceSpan span("scene parse");
+    std::ifstream infile(static_cast<std::string>(filename));
+    if (!infile) {
+        throw std::runtime_error("Can't open " + static_cast<std::string>(filename));
+    }
+    return ConstructScene(infile, GetFolderPathFromFilePath(static_cast<std::string>(filename)),
+                          accelerator_type);
 }
 }  // namespace scene
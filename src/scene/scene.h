@@ -3,45 +3,273 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <limits>
+#include <optional>
 
+#include "geometry/ray.h"
+#include "geometry/transform.h"
 #include "scene/material.h"
 #include "scene/object.h"
 #include "scene/light.h"
 #include "scene/skybox.h"
+#include "scene/mesh.h"
+#include "scene/instance.h"
+#include "scene/bvh.h"
+#include "raytracer/stats.h"
+#include "raytracer/timeline.h"
 
 typedef std::map<std::string, std::unique_ptr<scene::Material>> MaterialPointers;
 
 namespace scene {
+struct Hit {
+    double distance;
+    size_t primitive;
+    int instance;  // -1 for world geometry
+    geometry::Ray<> local_ray;  // normalized ray in the coordinate frame of the hit mesh
+};
+
 class Scene {
+public:
+    Scene(Mesh world, std::vector<Light> lights, Sky sky, MaterialPointers materials_pointers,
+          std::vector<std::unique_ptr<geometry::Vector3D<>>> normals, std::vector<Mesh> meshes = {},
+          std::vector<Instance> instances = {},
+          AcceleratorType accelerator_type = AcceleratorType::kBvh)
+        : world_(std::move(world)),
+          meshes_(std::move(meshes)),
+          instances_(std::move(instances)),
+          lights_(std::move(lights)),
+          sky_(std::move(sky)),
+          materials_pointers_(std::move(materials_pointers)),
+          normals_(std::move(normals)) {
+        raytracer::StageTimer build_timer(raytracer::ThreadStats().build_seconds);
+        raytracer::TraceSpan span("accelerator build");
+        RebuildAccelerators(accelerator_type);
+        for (auto& instance : instances_) {
+            instance.SetTransform(instance.object_to_world, meshes_[instance.mesh].Bounds());
+        }
+        BuildTopLevel();
+    }
+
 public:
     [[nodiscard]] const std::vector<Object>& GetObjects() const {
-        return objects_;
+        return world_.objects;
     }
 
     [[nodiscard]] const std::vector<SphereObject>& GetSphereObjects() const {
-        return sphere_objects_;
+        return world_.sphere_objects;
     }
 
     [[nodiscard]] const std::vector<Light>& GetLights() const {
         return lights_;
     }
 
+    [[nodiscard]] const Mesh& GetWorld() const {
+        return world_;
+    }
+
+    [[nodiscard]] const std::vector<Mesh>& GetMeshes() const {
+        return meshes_;
+    }
+
+    [[nodiscard]] const std::vector<Instance>& GetInstances() const {
+        return instances_;
+    }
+
+    [[nodiscard]] const Mesh& GetHitMesh(const Hit& hit) const {
+        return hit.instance < 0 ? world_ : meshes_[instances_[hit.instance].mesh];
+    }
+
+public:
+    // Moving an instance only refits the top level, which is rebuilt once refitting made it too
+    // expensive; mesh hierarchies stay untouched.
+    void SetInstanceTransform(size_t index, const geometry::Transform<>& object_to_world) {
+        auto& instance = instances_.at(index);
+        instance.SetTransform(object_to_world, meshes_[instance.mesh].Bounds());
+        top_level_.Refit(GetInstanceBounds(), kDefaultRebuildThreshold);
+    }
+
+    // Look-dev edits. Materials are changed in place, so the objects using them see the change.
+    void SetMaterial(const std::string& name, const Material& material) {
+        *materials_pointers_.at(name) = material;
+    }
+
+    [[nodiscard]] const Material* GetMaterial(const std::string& name) const {
+        return materials_pointers_.at(name).get();
+    }
+
+    // In name order; the position of a name is the material id of ray queries.
+    [[nodiscard]] std::vector<std::string> GetMaterialNames() const {
+        std::vector<std::string> names;
+        for (const auto& [name, pointer] : materials_pointers_) {
+            names.push_back(name);
+        }
+        return names;
+    }
+
+    void SetLight(size_t index, const Light& light) {
+        lights_.at(index) = light;
+    }
+
+    // Switches every mesh to another spatial index, e.g. to compare them on the same scene.
+    void RebuildAccelerators(AcceleratorType accelerator_type) {
+        world_.Build(accelerator_type);
+        for (auto& mesh : meshes_) {
+            mesh.Build(accelerator_type);
+        }
+    }
+
+    [[nodiscard]] size_t AcceleratorMemoryUsage() const {
+        size_t usage = world_.accelerator->MemoryUsage() + top_level_.MemoryUsage();
+        for (const auto& mesh : meshes_) {
+            usage += mesh.accelerator->MemoryUsage();
+        }
+        return usage;
+    }
+
+    // Estimate of the bytes the loaded scene takes.
+    [[nodiscard]] size_t MemoryUsage() const {
+        size_t usage = sizeof(Scene) + world_.MemoryUsage() + top_level_.MemoryUsage() +
+                       sky_.MemoryUsage() +
+                       lights_.capacity() * sizeof(Light) +
+                       instances_.capacity() * sizeof(Instance) +
+                       materials_pointers_.size() * sizeof(Material) +
+                       normals_.size() * sizeof(geometry::Vector3D<>);
+        for (const auto& mesh : meshes_) {
+            usage += mesh.MemoryUsage();
+        }
+        return usage;
+    }
+
+    // Animation path: new positions for the world geometry with unchanged topology. The
+    // hierarchy is refitted unless that made it rebuild_threshold times worse than a fresh build.
+    bool UpdateVertices(const std::vector<geometry::Vector3D<>>& vertices,
+                        double rebuild_threshold = kDefaultRebuildThreshold) {
+        world_.UpdateVertices(vertices);
+        return world_.Refit(rebuild_threshold);
+    }
+
+    bool UpdateMeshVertices(size_t index, const std::vector<geometry::Vector3D<>>& vertices,
+                            double rebuild_threshold = kDefaultRebuildThreshold) {
+        auto& mesh = meshes_.at(index);
+        mesh.UpdateVertices(vertices);
+        bool rebuilt = mesh.Refit(rebuild_threshold);
+        for (auto& instance : instances_) {
+            if (instance.mesh == index) {
+                instance.SetTransform(instance.object_to_world, mesh.Bounds());
+            }
+        }
+        BuildTopLevel();
+        return rebuilt;
+    }
+
+    [[nodiscard]] std::optional<Hit> Intersect(
+        const geometry::Ray<>& ray,
+        double max_distance = std::numeric_limits<double>::infinity()) const {
+        auto direction = ray.GetDirection();
+        geometry::Ray<> unit_ray(ray.GetOrigin(), direction.Normalize());
+
+        std::optional<Hit> closest;
+        if (auto hit = world_.Intersect(unit_ray, max_distance)) {
+            closest = Hit{hit->first, hit->second, -1, unit_ray};
+            max_distance = hit->first;
+        }
+        if (instances_.empty()) {
+            if (closest) {
+                RAYTRACER_COUNT(hits);
+            }
+            return closest;
+        }
+
+        std::optional<Hit> instance_hit;
+        top_level_.Traverse(
+            unit_ray, max_distance,
+            [&](size_t index, double current_max) -> std::optional<double> {
+                const auto& instance = instances_[index];
+                auto local_ray = instance.world_to_object.ApplyToRay(unit_ray);
+                auto local_direction = local_ray.GetDirection();
+                double scale = Length(local_direction);
+                local_ray = {local_ray.GetOrigin(), local_direction / scale};
+
+                auto hit = meshes_[instance.mesh].Intersect(local_ray, current_max * scale);
+                if (!hit) {
+                    return {};
+                }
+                // Every accepted hit is closer than the previous one, so the last one wins.
+                instance_hit = Hit{hit->first / scale, hit->second, static_cast<int>(index),
+                                   local_ray};
+                return instance_hit->distance;
+            });
+        if (instance_hit || closest) {
+            RAYTRACER_COUNT(hits);
+        }
+        return instance_hit ? instance_hit : closest;
+    }
+
+    // Whether anything is hit closer than max_distance. Cheaper than Intersect, the search ends
+    // with the first primitive found.
+    [[nodiscard]] bool Occluded(
+        const geometry::Ray<>& ray,
+        double max_distance = std::numeric_limits<double>::infinity()) const {
+        auto direction = ray.GetDirection();
+        geometry::Ray<> unit_ray(ray.GetOrigin(), direction.Normalize());
+        bool occluded = world_.Occluded(unit_ray, max_distance);
+        if (!occluded && !instances_.empty()) {
+            top_level_.Traverse<true>(
+                unit_ray, max_distance,
+                [&](size_t index, double current_max) -> std::optional<double> {
+                    const auto& instance = instances_[index];
+                    auto local_ray = instance.world_to_object.ApplyToRay(unit_ray);
+                    auto local_direction = local_ray.GetDirection();
+                    double scale = Length(local_direction);
+                    local_ray = {local_ray.GetOrigin(), local_direction / scale};
+                    if (!meshes_[instance.mesh].Occluded(local_ray, current_max * scale)) {
+                        return {};
+                    }
+                    // Any distance below current_max ends the traversal.
+                    occluded = true;
+                    return 0.0;
+                });
+        }
+        if (occluded) {
+            RAYTRACER_COUNT(hits);
+        }
+        return occluded;
+    }
+
 public:
     [[nodiscard]] static std::map<std::string, Material> BuildMaterialsFromPointers(
         const MaterialPointers& pointers) {
-        static std::map<std::string, Material> materials;
-        if (materials.size() != pointers.size()) {  // None of them are supposed to change
-            for (const auto& [name, pointer] : pointers) {
-                materials[name] = *pointer;
-            }
+        std::map<std::string, Material> materials;
+        for (const auto& [name, pointer] : pointers) {
+            materials[name] = *pointer;
         }
         return materials;
     }
 
+private:
+    static constexpr double kDefaultRebuildThreshold = 1.5;
+
+    [[nodiscard]] std::vector<geometry::BoundingBox<>> GetInstanceBounds() const {
+        std::vector<geometry::BoundingBox<>> bounds;
+        bounds.reserve(instances_.size());
+        for (const auto& instance : instances_) {
+            bounds.push_back(instance.bounds);
+        }
+        return bounds;
+    }
+
+    void BuildTopLevel() {
+        top_level_.Build(GetInstanceBounds());
+    }
+
+private:
+    Mesh world_;
+    std::vector<Mesh> meshes_;
+    std::vector<Instance> instances_;
+    Bvh top_level_;
+    std::vector<Light> lights_;
+
 public:
-    const std::vector<Object> objects_;
-    const std::vector<SphereObject> sphere_objects_;
-    const std::vector<Light> lights_;
     const Sky sky_;
 
 public:  // heap held
@@ -1,7 +1,8 @@
 #pragma once
 
-#include <utility>
-#include <memory>
+#include <array>
+#include <cmath>
+#include <vector>
 
 #include "geometry/vector.h"
 #include "geometry/ray.h"
@@ -11,82 +12,138 @@ namespace scene {
 class Sky {
 public:
     enum class StrongestDirection { kFront, kBack, kTop, kBottom, kRight, kLeft };
+    enum class Filtering { kNearest, kBilinear };
 
 public:
-    Sky() : image_({}) {
-    }
+    Sky() = default;
 
-    explicit Sky(std::shared_ptr<raytracer::Image> image) : image_(std::move(image)) {
+    // Cuts the cross-shaped cubemap into six contiguous float faces once, so that Trace never
+    // touches the png rows or converts colors.
+    explicit Sky(const raytracer::Image& image, Filtering filtering = Filtering::kNearest)
+        : filtering_(filtering), face_size_(image.Width() / 4) {
+        texels_.resize(6 * face_size_ * face_size_ * 3);
+        for (int face = 0; face < 6; ++face) {
+            const auto& layout = kFaceLayouts[face];
+            for (int y = 0; y < face_size_; ++y) {
+                for (int x = 0; x < face_size_; ++x) {
+                    auto color = image.GetPixel(layout.block_row * face_size_ + y,
+                                                layout.block_column * face_size_ + x);
+                    float* texel = Texel(face, y, x);
+                    texel[0] = static_cast<float>(color.r) / 256;
+                    texel[1] = static_cast<float>(color.g) / 256;
+                    texel[2] = static_cast<float>(color.b) / 256;
+                }
+            }
+        }
     }
 
 public:
-    static constexpr StrongestDirection GetStrongestDirection(
-        const geometry::Vector3D<>& direction) {
-        size_t max_abs = std::max_element(direction.data_.begin(), direction.data_.end(),
-                                          [](auto a, auto b) { return fabs(a) < fabs(b); }) -
-                         direction.data_.begin();
-        switch (max_abs) {
-            case 0:
-                return (direction[0] > 0) ? StrongestDirection::kFront : StrongestDirection::kBack;
-            case 1:
-                return (direction[1] > 0) ? StrongestDirection::kTop : StrongestDirection::kBottom;
-            case 2:
-                return (direction[2] > 0) ? StrongestDirection::kRight : StrongestDirection::kLeft;
-            default:
-                throw std::runtime_error("Direction guessing gone wrong");
-        }
+    static StrongestDirection GetStrongestDirection(const geometry::Vector3D<>& direction) {
+        int axis = GetMajorAxis(direction);
+        return static_cast<StrongestDirection>(axis * 2 + (direction[axis] > 0 ? 0 : 1));
     }
 
 public:
     [[nodiscard]] geometry::Vector3D<> Trace(const geometry::Ray<>& ray) const {
-        if (!image_) {
+        if (texels_.empty()) {
             return {0, 0, 0};
         }
 
-        int block_size = image_->Width() / 4;
-        auto cube_v = ray.GetDirection();
-        cube_v =
-            cube_v / std::fabs(*std::max_element(cube_v.data_.begin(), cube_v.data_.end(),
-                                                 [](auto a, auto b) { return fabs(a) < fabs(b); }));
-        raytracer::RGB color{};
-        switch (GetStrongestDirection(ray.GetDirection())) {
-            int x, y;
-            case StrongestDirection::kFront:
-                x = (3 * block_size) / 2 + static_cast<int>(block_size * cube_v[2] / 2);
-                y = (3 * block_size) / 2 + static_cast<int>(block_size * -cube_v[1] / 2);
-                color = image_->GetPixel(y, x);
-                break;
-            case StrongestDirection::kBack:
-                x = (7 * block_size) / 2 + static_cast<int>(block_size * -cube_v[2] / 2);
-                y = (3 * block_size) / 2 + static_cast<int>(block_size * -cube_v[1] / 2);
-                color = image_->GetPixel(y, x);
-                break;
-            case StrongestDirection::kTop:
-                x = (3 * block_size) / 2 + static_cast<int>(block_size * cube_v[2] / 2);
-                y = (1 * block_size) / 2 + static_cast<int>(block_size * cube_v[0] / 2);
-                color = image_->GetPixel(y, x);
-                break;
-            case StrongestDirection::kBottom:
-                x = (3 * block_size) / 2 + static_cast<int>(block_size * cube_v[2] / 2);
-                y = (5 * block_size) / 2 + static_cast<int>(block_size * -cube_v[0] / 2);
-                color = image_->GetPixel(y, x);
-                break;
-            case StrongestDirection::kRight:
-                x = (5 * block_size) / 2 + static_cast<int>(block_size * -cube_v[0] / 2);
-                y = (3 * block_size) / 2 + static_cast<int>(block_size * -cube_v[1] / 2);
-                color = image_->GetPixel(y, x);
-                break;
-            case StrongestDirection::kLeft:
-                x = (1 * block_size) / 2 + static_cast<int>(block_size * cube_v[0] / 2);
-                y = (3 * block_size) / 2 + static_cast<int>(block_size * -cube_v[1] / 2);
-                color = image_->GetPixel(y, x);
-                break;
+        const auto& direction = ray.GetDirection();
+        int axis = GetMajorAxis(direction);
+        int face = axis * 2 + (direction[axis] > 0 ? 0 : 1);
+        double major = std::fabs(direction[axis]);
+
+        const auto& layout = kFaceLayouts[face];
+        double u = layout.u_sign * direction[layout.u_axis] / major;
+        double v = layout.v_sign * direction[layout.v_axis] / major;
+
+        if (filtering_ == Filtering::kBilinear) {
+            return SampleBilinear(face, u, v);
         }
-        return {static_cast<double>(color.r) / 256, static_cast<double>(color.g) / 256,
-                static_cast<double>(color.b) / 256};
+        return SampleNearest(face, u, v);
     }
 
-public:
-    std::shared_ptr<raytracer::Image> image_;
+    [[nodiscard]] int FaceSize() const {
+        return face_size_;
+    }
+
+    // Bytes of the float faces.
+    [[nodiscard]] size_t MemoryUsage() const {
+        return texels_.capacity() * sizeof(float);
+    }
+
+private:
+    // Where each face lives in the 4x3 cross and which direction components map onto its
+    // horizontal (u) and vertical (v) axes. Ordered like StrongestDirection.
+    struct FaceLayout {
+        int block_column, block_row;
+        int u_axis;
+        double u_sign;
+        int v_axis;
+        double v_sign;
+    };
+    static constexpr std::array<FaceLayout, 6> kFaceLayouts = {{
+        {1, 1, 2, 1, 1, -1},   // kFront
+        {3, 1, 2, -1, 1, -1},  // kBack
+        {1, 0, 2, 1, 0, 1},    // kTop
+        {1, 2, 2, 1, 0, -1},   // kBottom
+        {2, 1, 0, -1, 1, -1},  // kRight
+        {0, 1, 0, 1, 1, -1},   // kLeft
+    }};
+
+    static int GetMajorAxis(const geometry::Vector3D<>& direction) {
+        double x = std::fabs(direction[0]);
+        double y = std::fabs(direction[1]);
+        double z = std::fabs(direction[2]);
+        return (x >= y && x >= z) ? 0 : (y >= z ? 1 : 2);
+    }
+
+    float* Texel(int face, int y, int x) {
+        return &texels_[((face * face_size_ + y) * face_size_ + x) * 3];
+    }
+
+    [[nodiscard]] const float* Texel(int face, int y, int x) const {
+        return &texels_[((face * face_size_ + y) * face_size_ + x) * 3];
+    }
+
+    [[nodiscard]] int ClampToFace(int coordinate) const {
+        return std::min(std::max(coordinate, 0), face_size_ - 1);
+    }
+
+    [[nodiscard]] geometry::Vector3D<> SampleNearest(int face, double u, double v) const {
+        int x = ClampToFace(face_size_ / 2 + static_cast<int>(face_size_ * u / 2));
+        int y = ClampToFace(face_size_ / 2 + static_cast<int>(face_size_ * v / 2));
+        const float* texel = Texel(face, y, x);
+        return {texel[0], texel[1], texel[2]};
+    }
+
+    [[nodiscard]] geometry::Vector3D<> SampleBilinear(int face, double u, double v) const {
+        double fx = (u + 1) * face_size_ / 2 - 0.5;
+        double fy = (v + 1) * face_size_ / 2 - 0.5;
+        int x0 = static_cast<int>(std::floor(fx));
+        int y0 = static_cast<int>(std::floor(fy));
+        double tx = fx - x0;
+        double ty = fy - y0;
+
+        const float* top_left = Texel(face, ClampToFace(y0), ClampToFace(x0));
+        const float* top_right = Texel(face, ClampToFace(y0), ClampToFace(x0 + 1));
+        const float* bottom_left = Texel(face, ClampToFace(y0 + 1), ClampToFace(x0));
+        const float* bottom_right = Texel(face, ClampToFace(y0 + 1), ClampToFace(x0 + 1));
+
+        geometry::Vector3D<> result;
+        for (int channel = 0; channel < 3; ++channel) {
+            double top = top_left[channel] + (top_right[channel] - top_left[channel]) * tx;
+            double bottom =
+                bottom_left[channel] + (bottom_right[channel] - bottom_left[channel]) * tx;
+            result[channel] = top + (bottom - top) * ty;
+        }
+        return result;
+    }
+
+private:
+    Filtering filtering_ = Filtering::kNearest;
+    int face_size_ = 0;
+    std::vector<float> texels_;
 };
 }  // namespace scene
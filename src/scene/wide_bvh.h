@@ -0,0 +1,314 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "geometry/vector.h"
+#include "geometry/ray.h"
+#include "geometry/bounding_box.h"
+#include "scene/accelerator.h"
+#include "scene/bvh.h"
+
+namespace scene {
+// Compressed 8-wide bounding volume hierarchy collapsed from the binary one. Child boxes are kept
+// as 8-bit coordinates on a power of two grid anchored at the node origin, so a node with eight
+// children takes less memory than two binary nodes.
+class WideBvh : public Accelerator {
+public:
+    static constexpr size_t kWidth = 8;
+
+    struct Node {
+        std::array<float, 3> origin{};
+        std::array<int8_t, 3> exponent{};  // child coordinates are origin + q * 2^exponent
+        uint8_t inner_mask = 0;            // slots holding inner nodes rather than leaves
+        uint32_t child_base = 0;           // first inner child, the others follow in slot order
+        uint32_t primitive_base = 0;       // first primitive of the leaves of this node
+        std::array<uint8_t, kWidth> primitive_offset{};  // leaf start relative to primitive_base
+        std::array<uint8_t, kWidth> primitive_count{};   // zero for inner and empty slots
+        std::array<std::array<uint8_t, kWidth>, 3> q_min{};
+        std::array<std::array<uint8_t, kWidth>, 3> q_max{};
+    };
+    static_assert(sizeof(Node) == 88);
+
+public:
+    void Build(const std::vector<geometry::BoundingBox<>>& primitive_bounds) override {
+        nodes_.clear();
+        primitive_indices_.clear();
+        bounds_ = {};
+        if (primitive_bounds.empty()) {
+            return;
+        }
+
+        Bvh binary(primitive_bounds);
+        bounds_ = binary.Bounds();
+        nodes_.reserve(binary.GetNodes().size() / 4 + 1);
+        primitive_indices_.reserve(primitive_bounds.size());
+        nodes_.emplace_back();
+        BuildNode(0, MakeChild(binary, 0), binary, primitive_bounds);
+    }
+
+    [[nodiscard]] std::optional<std::pair<double, size_t>> Intersect(
+        const geometry::Ray<>& ray, double max_distance,
+        const PrimitiveIntersector& intersect) const override {
+        return Search<false>(ray, max_distance, intersect);
+    }
+
+    [[nodiscard]] bool IntersectAny(const geometry::Ray<>& ray, double max_distance,
+                                    const PrimitiveIntersector& intersect) const override {
+        return Search<true>(ray, max_distance, intersect).has_value();
+    }
+
+    // The closest hit, or with kAnyHit the first one.
+    template <bool kAnyHit>
+    std::optional<std::pair<double, size_t>> Search(const geometry::Ray<>& ray,
+                                                    double max_distance,
+                                                    const PrimitiveIntersector& intersect) const {
+        if (nodes_.empty()) {
+            return {};
+        }
+        auto inverse_direction = GetInverseDirection(ray);
+        if (!GetEntryDistance(ray, inverse_direction, bounds_, max_distance)) {
+            return {};
+        }
+
+        struct Entry {
+            uint32_t index;  // node, or first primitive of a leaf
+            uint32_t count;  // zero for nodes
+            double distance;
+        };
+        std::array<Entry, kWidth * kMaxDepth> stack;
+        size_t stack_size = 0;
+        stack[stack_size++] = {0, 0, 0};
+
+        std::optional<std::pair<double, size_t>> closest;
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+            if (entry.distance > max_distance) {
+                continue;
+            }
+            if (entry.count > 0) {
+                for (uint32_t i = entry.index; i < entry.index + entry.count; ++i) {
+                    auto distance = intersect(primitive_indices_[i], max_distance);
+                    if (distance && *distance < max_distance) {
+                        max_distance = *distance;
+                        closest = {*distance, primitive_indices_[i]};
+                        if constexpr (kAnyHit) {
+                            return closest;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            // Dequantization is folded into the slab test: the distance to the plane q of an
+            // axis is t_origin + q * t_scale.
+            const Node& node = nodes_[entry.index];
+            std::array<double, 3> t_origin, t_scale;
+            for (int axis = 0; axis < 3; ++axis) {
+                t_origin[axis] =
+                    (node.origin[axis] - ray.GetOrigin()[axis]) * inverse_direction[axis];
+                t_scale[axis] = std::ldexp(inverse_direction[axis], node.exponent[axis]);
+            }
+            std::array<Entry, kWidth> hits;
+            size_t hit_count = 0;
+            uint32_t inner_rank = 0;
+            for (size_t slot = 0; slot < kWidth; ++slot) {
+                bool inner = (node.inner_mask >> slot) & 1;
+                if (!inner && node.primitive_count[slot] == 0) {
+                    continue;
+                }
+                uint32_t target = inner ? node.child_base + inner_rank++
+                                        : node.primitive_base + node.primitive_offset[slot];
+                auto distance = GetChildEntryDistance(node, t_origin, t_scale, slot, max_distance);
+                if (!distance) {
+                    continue;
+                }
+                // Keep the hits sorted from far to near, so the nearest child is popped first.
+                size_t position = hit_count++;
+                for (; position > 0 && hits[position - 1].distance < *distance; --position) {
+                    hits[position] = hits[position - 1];
+                }
+                hits[position] = {target, inner ? 0u : node.primitive_count[slot], *distance};
+            }
+            for (size_t i = 0; i < hit_count; ++i) {
+                stack[stack_size++] = hits[i];
+            }
+        }
+        return closest;
+    }
+
+    [[nodiscard]] const geometry::BoundingBox<>& Bounds() const override {
+        return bounds_;
+    }
+
+    [[nodiscard]] size_t MemoryUsage() const override {
+        return nodes_.capacity() * sizeof(Node) + primitive_indices_.capacity() * sizeof(uint32_t);
+    }
+
+    [[nodiscard]] const std::vector<Node>& GetNodes() const {
+        return nodes_;
+    }
+
+private:
+    // Binary depth limit plus the levels needed to split oversized leaves.
+    static constexpr size_t kMaxDepth = 96;
+    static constexpr uint32_t kMaxLeafSize = 8;
+    static constexpr uint32_t kNoNode = std::numeric_limits<uint32_t>::max();
+    static constexpr int kMinExponent = std::numeric_limits<int8_t>::min();
+    static constexpr int kMaxExponent = std::numeric_limits<int8_t>::max();
+
+    // Child of a wide node before it is emitted: a binary inner node or a primitive range of the
+    // binary hierarchy.
+    struct Child {
+        geometry::BoundingBox<> bounds;
+        uint32_t binary_node = kNoNode;
+        uint32_t first = 0;
+        uint32_t count = 0;
+
+        [[nodiscard]] bool IsLeaf() const {
+            return binary_node == kNoNode && count <= kMaxLeafSize;
+        }
+    };
+
+    static Child MakeChild(const Bvh& binary, uint32_t binary_node) {
+        const auto& node = binary.GetNodes()[binary_node];
+        if (node.count > 0) {
+            return {node.bounds, kNoNode, node.first, node.count};
+        }
+        return {node.bounds, binary_node, 0, 0};
+    }
+
+    static std::array<Child, 2> Split(
+        const Child& child, const Bvh& binary,
+        const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        if (child.binary_node != kNoNode) {
+            auto left = binary.GetNodes()[child.binary_node].first;
+            return {MakeChild(binary, left), MakeChild(binary, left + 1)};
+        }
+        // Leaves the binary builder could not split further are halved in their stored order.
+        const auto& indices = binary.GetPrimitiveIndices();
+        std::array<Child, 2> halves;
+        uint32_t half = child.count / 2;
+        halves[0] = {{}, kNoNode, child.first, half};
+        halves[1] = {{}, kNoNode, child.first + half, child.count - half};
+        for (auto& piece : halves) {
+            for (uint32_t i = piece.first; i < piece.first + piece.count; ++i) {
+                piece.bounds.Extend(primitive_bounds[indices[i]]);
+            }
+        }
+        return halves;
+    }
+
+    // Greedily opens the child with the largest surface area until all slots are used.
+    void BuildNode(uint32_t node_index, const Child& parent, const Bvh& binary,
+                   const std::vector<geometry::BoundingBox<>>& primitive_bounds) {
+        std::vector<Child> children = {parent};
+        while (children.size() < kWidth) {
+            auto best = children.end();
+            for (auto it = children.begin(); it != children.end(); ++it) {
+                if (!it->IsLeaf() && (best == children.end() ||
+                                      it->bounds.SurfaceArea() > best->bounds.SurfaceArea())) {
+                    best = it;
+                }
+            }
+            if (best == children.end()) {
+                break;
+            }
+            auto halves = Split(*best, binary, primitive_bounds);
+            *best = halves[0];
+            children.push_back(halves[1]);
+        }
+
+        Node node;
+        node.child_base = static_cast<uint32_t>(nodes_.size());
+        node.primitive_base = static_cast<uint32_t>(primitive_indices_.size());
+        std::vector<Child> inner_children;
+        for (size_t slot = 0; slot < children.size(); ++slot) {
+            const auto& child = children[slot];
+            if (!child.IsLeaf()) {
+                node.inner_mask |= 1 << slot;
+                inner_children.push_back(child);
+                continue;
+            }
+            node.primitive_offset[slot] =
+                static_cast<uint8_t>(primitive_indices_.size() - node.primitive_base);
+            node.primitive_count[slot] = static_cast<uint8_t>(child.count);
+            const auto& indices = binary.GetPrimitiveIndices();
+            primitive_indices_.insert(primitive_indices_.end(), indices.begin() + child.first,
+                                      indices.begin() + child.first + child.count);
+        }
+        Quantize(node, children, parent.bounds);
+        nodes_[node_index] = node;
+
+        nodes_.resize(nodes_.size() + inner_children.size());
+        for (size_t i = 0; i < inner_children.size(); ++i) {
+            BuildNode(node.child_base + static_cast<uint32_t>(i), inner_children[i], binary,
+                      primitive_bounds);
+        }
+    }
+
+    // Rounds outwards, so the decoded boxes always contain the exact ones.
+    static void Quantize(Node& node, const std::vector<Child>& children,
+                         const geometry::BoundingBox<>& bounds) {
+        for (int axis = 0; axis < 3; ++axis) {
+            double min = bounds.GetMin()[axis];
+            double max = bounds.GetMax()[axis];
+            auto origin = static_cast<float>(min);
+            if (origin > min) {
+                origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+            }
+            double extent = max - origin;
+            int exponent =
+                extent > 0 ? static_cast<int>(std::ceil(std::log2(extent / 255))) : kMinExponent;
+            exponent = std::clamp(exponent, kMinExponent, kMaxExponent);
+            while (exponent < kMaxExponent && origin + 255 * std::ldexp(1.0, exponent) < max) {
+                ++exponent;
+            }
+            node.origin[axis] = origin;
+            node.exponent[axis] = static_cast<int8_t>(exponent);
+
+            double scale = std::ldexp(1.0, exponent);
+            for (size_t slot = 0; slot < children.size(); ++slot) {
+                double low = std::floor((children[slot].bounds.GetMin()[axis] - origin) / scale);
+                double high = std::ceil((children[slot].bounds.GetMax()[axis] - origin) / scale);
+                node.q_min[axis][slot] = static_cast<uint8_t>(std::clamp(low, 0.0, 255.0));
+                node.q_max[axis][slot] = static_cast<uint8_t>(std::clamp(high, 0.0, 255.0));
+            }
+        }
+    }
+
+    // Same comparisons as geometry::GetEntryExitDistances, so NaNs do not clip the interval.
+    static std::optional<double> GetChildEntryDistance(const Node& node,
+                                                       const std::array<double, 3>& t_origin,
+                                                       const std::array<double, 3>& t_scale,
+                                                       size_t slot, double max_distance) {
+        double near = 0;
+        double far = max_distance;
+        for (int axis = 0; axis < 3; ++axis) {
+            double t_min = t_origin[axis] + node.q_min[axis][slot] * t_scale[axis];
+            double t_max = t_origin[axis] + node.q_max[axis][slot] * t_scale[axis];
+            if (t_min > t_max) {
+                std::swap(t_min, t_max);
+            }
+            t_max *= 1 + 4 * std::numeric_limits<double>::epsilon();
+            near = t_min > near ? t_min : near;
+            far = t_max < far ? t_max : far;
+            if (near > far) {
+                return {};
+            }
+        }
+        return near;
+    }
+
+private:
+    geometry::BoundingBox<> bounds_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> primitive_indices_;
+};
+}  // namespace scene
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <raytracer/camera_options.h>
 #include <raytracer/image.h>
 
 #include <cmath>
+#include <cstdlib>
 #include <string>
 #include <optional>
 
@@ -28,4 +30,29 @@ inline void Compare(const raytracer::Image& actual, const raytracer::Image& expe
 
     double similarity = static_cast<double>(matches) / (actual.Width() * actual.Height());
     REQUIRE(similarity >= 0.99);
-}
\ No newline at end of file
+}
+
+// Every channel of every pixel within slack, for images of values that went through floats or
+// were combined in another order.
+inline void RequireClose(const raytracer::Image& actual, const raytracer::Image& expected,
+                         int slack) {
+    REQUIRE(actual.Width() == expected.Width());
+    REQUIRE(actual.Height() == expected.Height());
+    for (int y = 0; y < actual.Height(); ++y) {
+        for (int x = 0; x < actual.Width(); ++x) {
+            auto lhs = actual.GetPixel(y, x);
+            auto rhs = expected.GetPixel(y, x);
+            REQUIRE(std::abs(lhs.r - rhs.r) <= slack);
+            REQUIRE(std::abs(lhs.g - rhs.g) <= slack);
+            REQUIRE(std::abs(lhs.b - rhs.b) <= slack);
+        }
+    }
+}
+
+// The small view into the classic Cornell box the render feature tests share.
+inline raytracer::CameraOptions CornellBoxCamera() {
+    raytracer::CameraOptions camera_options(250, 180);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    return camera_options;
+}
@@ -7,6 +7,8 @@
 #include <optional>
 
 #include "geometry/geometry.h"
+#include "geometry/bounding_box.h"
+#include "geometry/transform.h"
 
 const double kX = 123.;
 const double kY = 456.;
@@ -205,3 +207,33 @@ TEST_CASE("Barycentric coords", "[raytracer]") {
     REQUIRE(std::fabs(inside[1] - 0.1) < kErr);
     REQUIRE(std::fabs(inside[2] - 0.1) < kErr);
 }
+
+TEST_CASE("Transform", "[raytracer]") {
+    geometry::Transform<> transform({0, 0, 2, 1, 0, 3, 0, -2, -1, 0, 0, 4});
+    const geometry::Vector3D<> point{kX, kY, kZ};
+
+    auto restored = transform.Inverse().ApplyToPoint(transform.ApplyToPoint(point));
+    REQUIRE(Length(restored - point) < kErr);
+
+    auto composed = (transform * transform.Inverse()).ApplyToPoint(point);
+    REQUIRE(Length(composed - point) < kErr);
+
+    geometry::BoundingBox<> box({0, 0, 0}, {1, 1, 1});
+    auto moved = transform.ApplyToBox(box);
+    REQUIRE(Length(moved.GetMin() - geometry::Vector3D<>{1, -2, 3}) < kErr);
+    REQUIRE(Length(moved.GetMax() - geometry::Vector3D<>{3, 1, 4}) < kErr);
+}
+
+TEST_CASE("Bounding box", "[raytracer]") {
+    geometry::BoundingBox<> box({-1, -1, -1}, {1, 1, 1});
+    geometry::Ray<> ray({0, 0, 5}, {0, 0, -1});
+    auto inverse_direction = GetInverseDirection(ray);
+
+    auto entry = GetEntryDistance(ray, inverse_direction, box, 100.0);
+    REQUIRE(entry);
+    REQUIRE(std::fabs(*entry - 4) < kErr);
+    REQUIRE(!GetEntryDistance(ray, inverse_direction, box, 3.0));
+
+    geometry::Ray<> miss({2, 0, 5}, {0, 0, -1});
+    REQUIRE(!GetEntryDistance(miss, GetInverseDirection(miss), box, 100.0));
+}
@@ -0,0 +1,199 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "raytracer/benchmark.h"
+
+#ifndef PROGRAM_DIR
+#define PROGRAM_DIR "./"
+#endif
+#ifndef SCENES_DIR
+#define SCENES_DIR "../raytracer/scenes/"
+#endif
+#ifndef BUILD_TYPE
+#define BUILD_TYPE ""
+#endif
+
+// Rays per second and frame times of reduced golden scenes, normalized by a calibration loop so
+// that they compare across machines, against the values baseline.txt has for the build type;
+// build types without a baseline are not measured. Unset RAYTRACER_PERFORMANCE_TOLERANCE allows
+// 30% slowdowns; RAYTRACER_PERFORMANCE_UPDATE=1 writes the measured values as the baseline of the
+// build type instead.
+namespace {
+struct GoldenScene {
+    std::string name;
+    std::string path;  // relative to the raytracer test scenes
+    raytracer::CameraOptions camera_options;
+    bool has_geometry = true;  // without it the rays take too little time to measure
+};
+
+raytracer::CameraOptions Camera(std::array<double, 3> look_from, std::array<double, 3> look_to,
+                                double fov = M_PI / 2) {
+    return raytracer::CameraOptions(300, 300, fov, look_from, look_to);
+}
+
+std::vector<GoldenScene> GetGoldenScenes() {
+    return {
+        {"classic_box", "classic_box/CornellBox-Original.obj",
+         Camera({-0.5, 1.5, 0.98}, {0.0, 1.0, 0.0})},
+        {"opaque_glass", "opaque_glass/OpaqueGlass.obj", Camera({-2, 2, -1}, {0, 0, 0})},
+        {"colored_glass", "colored_glass/ColoredGlass.obj", Camera({-2, 2, -1}, {0, 0, 0})},
+        {"simple_stained_glass", "simple_stained_glass/SimpleStainedGlass.obj",
+         Camera({-2, 4, -12}, {0, -2, -4})},
+        {"skybox", "skybox/Skybox.obj", Camera({0, 0, 0}, {1, 1, 1}, 2.5), false},
+    };
+}
+
+// Seconds of a fixed floating point and memory workload that shares no code with the renderer,
+// best of a few runs.
+double Calibrate() {
+    std::vector<double> values(size_t{1} << 15, 1);
+    double best = std::numeric_limits<double>::infinity();
+    for (int run = 0; run < 3; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t state = 88172645463325252ull;
+        for (int i = 0; i < (1 << 21); ++i) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            auto& value = values[state & (values.size() - 1)];
+            value = std::sqrt(value * 0.75 + static_cast<double>(state >> 40));
+        }
+        best = std::min(
+            best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    volatile double sink = values[0];
+    (void)sink;
+    return best;
+}
+
+struct Measurement {
+    double rays = 0;   // rays per second times the calibration seconds, higher is better
+    double frame = 0;  // frame seconds over the calibration seconds, lower is better
+};
+
+// Best of a few benchmark runs, each ray kind timed separately and added up. Every run is
+// normalized by a calibration right before it, so that clock changes between runs cancel out.
+Measurement Measure(const GoldenScene& scene) {
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    Measurement best{0, std::numeric_limits<double>::infinity()};
+    for (int run = 0; run < 5; ++run) {
+        double calibration = Calibrate();
+        auto benchmark = raytracer::BenchmarkScene(scene.name, SCENES_DIR + scene.path,
+                                                   scene.camera_options, render_options);
+        if (!benchmark.error.empty()) {
+            throw std::runtime_error(benchmark.error);
+        }
+        double seconds = benchmark.primary_rays / benchmark.primary_rays_per_second;
+        if (benchmark.shadow_rays > 0) {
+            seconds += benchmark.shadow_rays / benchmark.shadow_rays_per_second;
+        }
+        if (benchmark.secondary_rays > 0) {
+            seconds += benchmark.secondary_rays / benchmark.secondary_rays_per_second;
+        }
+        auto rays = benchmark.primary_rays + benchmark.shadow_rays + benchmark.secondary_rays;
+        best.rays = std::max(best.rays, rays / seconds * calibration);
+        best.frame = std::min(best.frame, benchmark.frame_seconds / calibration);
+    }
+    return best;
+}
+
+std::string GetBuildType() {
+    std::string build_type = BUILD_TYPE;
+    return build_type.empty() ? "default" : build_type;
+}
+
+// Lines "<build type> <scene> <metric> <value>", # starts a comment.
+using Baseline = std::map<std::string, double>;
+
+std::string BaselineKey(const std::string& scene, const std::string& metric) {
+    return GetBuildType() + " " + scene + " " + metric;
+}
+
+Baseline ReadBaseline(const std::string& path, std::vector<std::string>* other_lines = nullptr) {
+    Baseline baseline;
+    std::ifstream file(path);
+    for (std::string line; std::getline(file, line);) {
+        std::istringstream words(line);
+        std::string build_type, scene, metric;
+        double value;
+        if (line.empty() || line[0] == '#' || !(words >> build_type >> scene >> metric >> value) ||
+            build_type != GetBuildType()) {
+            if (other_lines) {
+                other_lines->push_back(line);
+            }
+            continue;
+        }
+        baseline[build_type + " " + scene + " " + metric] = value;
+    }
+    return baseline;
+}
+
+double GetTolerance() {
+    const char* tolerance = std::getenv("RAYTRACER_PERFORMANCE_TOLERANCE");
+    return tolerance ? std::stod(tolerance) : 0.3;
+}
+}  // namespace
+
+TEST_CASE("Golden scene throughput", "[performance]") {
+    const std::string baseline_path = std::string(PROGRAM_DIR) + "baseline.txt";
+    const char* update = std::getenv("RAYTRACER_PERFORMANCE_UPDATE");
+    bool updating = update && std::string(update) == "1";
+    double tolerance = GetTolerance();
+    auto baseline = ReadBaseline(baseline_path);
+    if (baseline.empty() && !updating) {
+        WARN("No baseline for build type " << GetBuildType() << ", not measured");
+        return;
+    }
+
+    // Untimed, so that the first scene doesn't pay for cold caches and a slow clock.
+    auto scenes = GetGoldenScenes();
+    Measure(scenes[0]);
+    Baseline measured;
+    for (const auto& scene : scenes) {
+        auto measurement = Measure(scene);
+        if (scene.has_geometry) {
+            measured[BaselineKey(scene.name, "rays")] = measurement.rays;
+        }
+        measured[BaselineKey(scene.name, "frame")] = measurement.frame;
+    }
+
+    if (updating) {
+        std::vector<std::string> lines;
+        ReadBaseline(baseline_path, &lines);
+        std::ofstream file(baseline_path);
+        for (const auto& line : lines) {
+            file << line << "\n";
+        }
+        for (const auto& [key, value] : measured) {
+            file << key << " " << value << "\n";
+        }
+        REQUIRE(file);
+        return;
+    }
+
+    for (const auto& [key, value] : measured) {
+        auto it = baseline.find(key);
+        if (it == baseline.end()) {
+            WARN("No baseline for " << key << ", measured " << value);
+            continue;
+        }
+        bool higher_is_better = key.ends_with(" rays");
+        double ratio = higher_is_better ? value / it->second : it->second / value;
+        INFO(key << ": measured " << value << ", baseline " << it->second << ", "
+                 << ratio * 100 << "% of the baseline speed");
+        CHECK(ratio >= 1 - tolerance);
+    }
+}
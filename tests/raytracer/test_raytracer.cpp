@@ -7,7 +7,17 @@
 #define PROGRAM_DIR "./"
 #endif
 
+#include <set>
+
 #include "raytracer/raytracer.cpp"
+#include "raytracer/benchmark.h"
+#include "raytracer/checkpoint.h"
+#include "raytracer/distributed.h"
+#include "raytracer/ray_query.h"
+#include "raytracer/render_service.h"
+#include "raytracer/shared_framebuffer.h"
+#include "raytracer/tile_cache.h"
+#include "raytracer/timeline.h"
 
 #include "auxiliary.hpp"
 #include "raytracer/camera_options.h"
@@ -115,3 +125,960 @@ TEST_CASE("Violin case", "[raytracer]") {
     Compare(render, target);
 //    render.Write(dir_path + "scenes/violin_case/example.png");
 }
+
+TEST_CASE("Skybox faces", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    raytracer::Image image(dir_path + "scenes/skybox/skybox.png");
+    scene::Sky nearest(image);
+    scene::Sky bilinear(image, scene::Sky::Filtering::kBilinear);
+    int block_size = image.Width() / 4;
+
+    auto front_center = image.GetPixel(block_size + block_size / 2, block_size + block_size / 2);
+    auto traced = nearest.Trace({{0, 0, 0}, {1, 0, 0}});
+    REQUIRE(traced[0] == Approx(front_center.r / 256.0).epsilon(1e-5));
+    REQUIRE(traced[1] == Approx(front_center.g / 256.0).epsilon(1e-5));
+    REQUIRE(traced[2] == Approx(front_center.b / 256.0).epsilon(1e-5));
+
+    auto left_center = image.GetPixel(block_size + block_size / 2, block_size / 2);
+    traced = nearest.Trace({{0, 0, 0}, {0, 0, -2}});
+    REQUIRE(traced[0] == Approx(left_center.r / 256.0).epsilon(1e-5));
+
+    for (const auto& direction : std::vector<geometry::Vector3D<>>{
+             {1, 0.3, -0.2}, {-0.1, 1, 0.9}, {0.4, -1, 0.2}, {-1, -1, -1}}) {
+        auto lhs = nearest.Trace({{0, 0, 0}, direction});
+        auto rhs = bilinear.Trace({{0, 0, 0}, direction});
+        REQUIRE(Length(lhs - rhs) < 0.2);
+    }
+
+    // Scene caches account for the faces.
+    REQUIRE(nearest.MemoryUsage() == 6 * 3 * sizeof(float) * block_size * block_size);
+    auto scene = scene::ReadScene(dir_path + "scenes/skybox/Skybox.obj");
+    REQUIRE(scene.MemoryUsage() > scene.sky_.MemoryUsage());
+    REQUIRE(scene.sky_.MemoryUsage() > 0);
+}
+
+TEST_CASE("Instanced meshes", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    raytracer::CameraOptions camera_options(300, 300);
+    camera_options.look_from = {1, 4, 7};
+    camera_options.look_to = {0, 0.5, -1};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+
+    auto instanced = raytracer::Render(dir_path + "scenes/instancing/Instanced.obj",
+                                       camera_options, render_options);
+    auto flattened = raytracer::Render(dir_path + "scenes/instancing/Flattened.obj",
+                                       camera_options, render_options);
+
+    Compare(instanced, flattened);
+}
+
+TEST_CASE("Accelerators agree", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    raytracer::CameraOptions camera_options(200, 200);
+    camera_options.look_from = {-2, 4, -12};
+    camera_options.look_to = {0, -2, -4};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    const auto scene_path = dir_path + "scenes/simple_stained_glass/SimpleStainedGlass.obj";
+
+    render_options.accelerator = scene::AcceleratorType::kBruteForce;
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    for (auto accelerator : {scene::AcceleratorType::kBvh, scene::AcceleratorType::kWideBvh,
+                             scene::AcceleratorType::kGrid, scene::AcceleratorType::kKdTree}) {
+        render_options.accelerator = accelerator;
+        Compare(raytracer::Render(scene_path, camera_options, render_options), reference);
+    }
+
+    auto benchmarks = raytracer::BenchmarkAccelerators(scene_path, camera_options);
+    REQUIRE(benchmarks.size() == 5);
+    for (const auto& benchmark : benchmarks) {
+        REQUIRE(benchmark.rays >= 200 * 200);
+        REQUIRE(benchmark.rays_per_second > 0);
+    }
+    REQUIRE(benchmarks[1].accelerator == scene::AcceleratorType::kWideBvh);
+    REQUIRE(benchmarks[1].memory_bytes < benchmarks[0].memory_bytes);
+}
+
+TEST_CASE("Benchmark suite", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    raytracer::CameraOptions camera_options(40, 30);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+
+    std::vector<raytracer::SceneBenchmark> scenes = {
+        raytracer::BenchmarkScene("classic_box",
+                                  dir_path + "scenes/classic_box/CornellBox-Original.obj",
+                                  camera_options, render_options),
+        raytracer::BenchmarkScene("missing \"scene\"", dir_path + "scenes/missing.obj",
+                                  camera_options, render_options)};
+    const auto& box = scenes[0];
+    REQUIRE(box.error.empty());
+    REQUIRE(box.primary_rays == 40 * 30);
+    // Every primary ray hits the box, which has three lights.
+    REQUIRE(box.shadow_rays == 3 * box.primary_rays);
+    REQUIRE(box.secondary_rays >= box.primary_rays);
+    REQUIRE(box.primary_rays_per_second > 0);
+    REQUIRE(box.frame_seconds > 0);
+    REQUIRE(!scenes[1].error.empty());
+
+    auto microbenchmarks = raytracer::RunMicroBenchmarks(1024);
+    REQUIRE(microbenchmarks.size() == 5);
+    for (const auto& benchmark : microbenchmarks) {
+        REQUIRE(benchmark.calls == 1024);
+        REQUIRE(benchmark.nanoseconds_per_call > 0);
+    }
+
+    std::ostringstream json;
+    raytracer::WriteBenchmarkJson(json, scenes, microbenchmarks);
+    REQUIRE(json.str().find("{\"name\": \"classic_box\", \"load_seconds\": ") !=
+            std::string::npos);
+    REQUIRE(json.str().find("{\"name\": \"missing \\\"scene\\\"\", \"error\": ") !=
+            std::string::npos);
+    REQUIRE(json.str().find("\"name\": \"Sky::Trace\", \"calls\": 1024") != std::string::npos);
+
+    // Rates of sections that took no time are not numbers JSON knows.
+    raytracer::SceneBenchmark empty;
+    empty.name = "empty";
+    empty.primary_rays_per_second = std::numeric_limits<double>::infinity();
+    empty.shadow_rays_per_second = std::numeric_limits<double>::quiet_NaN();
+    std::ostringstream empty_json;
+    raytracer::WriteBenchmarkJson(empty_json, {empty}, {});
+    REQUIRE(empty_json.str().find("\"primary_rays_per_second\": null, ") != std::string::npos);
+    REQUIRE(empty_json.str().find("\"shadow_rays_per_second\": null, ") != std::string::npos);
+    REQUIRE(empty_json.str().find("inf") == std::string::npos);
+    REQUIRE(empty_json.str().find("nan") == std::string::npos);
+}
+
+TEST_CASE("Timeline trace", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    raytracer::CameraOptions camera_options(160, 120);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    auto& timeline = raytracer::Timeline::Instance();
+    auto count = [&](const std::string& name) {
+        auto events = timeline.GetEvents();
+        return std::count_if(events.begin(), events.end(),
+                             [&](const auto& event) { return event.name == name; });
+    };
+
+    timeline.Start();
+    raytracer::SetThreadCount(4);
+    raytracer::Render(dir_path + "scenes/classic_box/CornellBox-Original.obj", camera_options,
+                      {4, raytracer::RenderMode::kFull})
+        .Write(std::filesystem::temp_directory_path() / "timeline_trace.png");
+    raytracer::SetThreadCount(0);
+    std::thread([] { raytracer::TraceSpan span("other thread"); }).join();
+    timeline.Stop();
+    for (const char* name :
+         {"scene parse", "material load", "accelerator build", "render", "tone map", "png encode",
+          "other thread"}) {
+        REQUIRE(count(name) == 1);
+    }
+    auto events = timeline.GetEvents();
+    auto find = [&](const std::string& name) {
+        return *std::find_if(events.begin(), events.end(),
+                             [&](const auto& event) { return event.name == name; });
+    };
+    auto parse = find("scene parse");
+    auto materials = find("material load");
+    REQUIRE(parse.start_nanoseconds <= materials.start_nanoseconds);
+    REQUIRE(materials.start_nanoseconds + materials.duration_nanoseconds <=
+            parse.start_nanoseconds + parse.duration_nanoseconds);
+    REQUIRE(find("other thread").thread != parse.thread);
+
+    // The frame is traced in 16 pixel tiles on the worker threads.
+    REQUIRE(count("tile") == 10 * 8);
+    std::set<uint32_t> tile_threads;
+    for (const auto& event : events) {
+        if (event.name == std::string("tile")) {
+            tile_threads.insert(event.thread);
+        }
+    }
+    REQUIRE(tile_threads.size() > 1);
+
+    std::ostringstream json;
+    timeline.WriteChromeTrace(json);
+    REQUIRE(json.str().rfind("{\"traceEvents\": [\n{\"name\": \"thread_name\", ", 0) == 0);
+    REQUIRE(json.str().find("{\"name\": \"scene parse\", \"ph\": \"X\", \"ts\": ") !=
+            std::string::npos);
+
+    SECTION("Disabled") {
+        { raytracer::TraceSpan span("render"); }
+        REQUIRE(count("render") == 1);
+    }
+
+    SECTION("Ring buffer") {
+        timeline.Start();
+        for (size_t i = 0; i < raytracer::Timeline::kCapacity + 10; ++i) {
+            raytracer::TraceSpan span("span");
+        }
+        timeline.Stop();
+        REQUIRE(count("span") == raytracer::Timeline::kCapacity);
+        REQUIRE(count("render") == 0);
+    }
+}
+
+TEST_CASE("Rasterized primary visibility", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    auto check_agreement = [](const scene::Scene& scene,
+                              const raytracer::CameraOptions& camera_options) {
+        raytracer::RayCaster ray_caster(camera_options);
+        auto buffer = raytracer::Rasterizer(ray_caster).Rasterize(scene);
+        int mismatches = 0;
+        int hits = 0;
+        for (int j = 0; j < ray_caster.screen_height_; ++j) {
+            for (int i = 0; i < ray_caster.screen_width_; ++i) {
+                if (buffer.OnSilhouette(i, j)) {
+                    continue;
+                }
+                auto ray = ray_caster(i, j);
+                auto expected = scene.Intersect(ray);
+                auto actual = buffer.GetHit(scene, ray, i, j);
+                hits += expected.has_value();
+                mismatches += expected.has_value() != actual.has_value() ||
+                              (expected && std::abs(expected->distance - actual->distance) >=
+                                               1e-6 * expected->distance);
+            }
+        }
+        REQUIRE(hits > 0);
+        REQUIRE(mismatches == 0);
+    };
+
+    SECTION("Camera inside a box") {
+        raytracer::CameraOptions camera_options(160, 120);
+        camera_options.look_from = {-0.5, 1.5, 0.98};
+        camera_options.look_to = {0.0, 1.0, 0.0};
+        check_agreement(scene::ReadScene(dir_path + "scenes/classic_box/CornellBox-Original.obj"),
+                        camera_options);
+    }
+
+    SECTION("Instances and spheres") {
+        raytracer::CameraOptions camera_options(120, 160);
+        camera_options.look_from = {1, 4, 7};
+        camera_options.look_to = {0, 0.5, -1};
+        check_agreement(scene::ReadScene(dir_path + "scenes/instancing/Instanced.obj"),
+                        camera_options);
+
+        std::istringstream input(
+            "v -3 -1 -3\nv 3 -1 -3\nv 0 2 -3\nf 1 2 3\nS 0 0 -2 0.8\nS 1 1 2 0.5\nS 0 0 0 10\n");
+        check_agreement(scene::ConstructScene(input, "."), camera_options);
+    }
+
+    SECTION("Full render") {
+        raytracer::CameraOptions camera_options(500, 500);
+        camera_options.look_from = {-0.5, 1.5, 0.98};
+        camera_options.look_to = {0.0, 1.0, 0.0};
+        raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+        render_options.rasterize_primary = true;
+
+        auto path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+        auto render = raytracer::Render(path, camera_options, render_options);
+        auto target = raytracer::Image(500, 500);
+        target.ReadPng(dir_path + "scenes/classic_box/full.png");
+        Compare(render, target);
+
+        // Silhouettes are traced, so rasterizing changes no pixel.
+        render_options.rasterize_primary = false;
+        auto traced = raytracer::Render(path, camera_options, render_options);
+        int differences = 0;
+        for (int j = 0; j < 500; ++j) {
+            for (int i = 0; i < 500; ++i) {
+                differences += PixelDistance(render.GetPixel(j, i), traced.GetPixel(j, i)) > 0;
+            }
+        }
+        REQUIRE(differences == 0);
+    }
+}
+
+TEST_CASE("Progressive rendering", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    std::vector<size_t> traced;
+    auto progressive = raytracer::RenderProgressive(
+        scene_path, camera_options, render_options,
+        [&](const raytracer::Image& preview, size_t traced_pixels) {
+            REQUIRE(preview.Width() == 250);
+            REQUIRE(preview.Height() == 180);
+            traced.push_back(traced_pixels);
+        });
+
+    // Every 8th, 4th, 2nd pixel previews and the final image; no pixel is traced twice.
+    REQUIRE(traced == std::vector<size_t>{32 * 23, 63 * 45, 125 * 90, 250 * 180});
+
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+    for (int y = 0; y < reference.Height(); ++y) {
+        for (int x = 0; x < reference.Width(); ++x) {
+            REQUIRE(progressive.GetPixel(y, x) == reference.GetPixel(y, x));
+        }
+    }
+}
+
+TEST_CASE("Deadline rendering", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    raytracer::CameraOptions camera_options(200, 150);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    REQUIRE(raytracer::GetQualityLadder(2, 4) ==
+            std::vector<raytracer::TileQuality>{{2, 1}, {1, 1}, {1, 2}, {1, 4}, {0, 1}});
+
+    auto check_tiles = [&](const raytracer::DeadlineReport& report) {
+        int area = 0;
+        for (const auto& tile : report.tiles) {
+            area += tile.width * tile.height;
+        }
+        REQUIRE(area == 200 * 150);
+        REQUIRE(report.tiles.size() == 13 * 10);
+    };
+
+    SECTION("Generous budget keeps full quality") {
+        raytracer::DeadlineReport report;
+        auto render = raytracer::RenderWithDeadline(scene_path, camera_options, render_options,
+                                                    1000, report);
+        check_tiles(report);
+        REQUIRE(report.DegradedTileCount() == 0);
+        Compare(render, raytracer::Render(scene_path, camera_options, render_options));
+    }
+
+    SECTION("Exhausted budget degrades to ambient only") {
+        raytracer::DeadlineReport report;
+        raytracer::RenderWithDeadline(scene_path, camera_options, render_options, 1e-6, report);
+        check_tiles(report);
+        REQUIRE(report.DegradedTileCount() >= report.tiles.size() - 1);
+        REQUIRE(report.tiles.back().quality == raytracer::TileQuality{0, 1});
+    }
+}
+
+TEST_CASE("Adaptive antialiasing", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    render_options.antialiasing = 4;
+    raytracer::Raytracer tracer(scene_path, camera_options, render_options);
+    auto antialiased = tracer.Render();
+
+    // Only edge pixels are supersampled, and only they change.
+    auto pixels = static_cast<size_t>(reference.Width()) * reference.Height();
+    REQUIRE(tracer.GetAntialiasedPixelCount() > 0);
+    REQUIRE(tracer.GetAntialiasedPixelCount() < pixels / 4);
+    size_t changed = 0;
+    for (int y = 0; y < reference.Height(); ++y) {
+        for (int x = 0; x < reference.Width(); ++x) {
+            changed += !(antialiased.GetPixel(y, x) == reference.GetPixel(y, x));
+        }
+    }
+    REQUIRE(changed > 0);
+    REQUIRE(changed <= tracer.GetAntialiasedPixelCount());
+}
+
+TEST_CASE("Temporal reuse", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    render_options.temporal_reuse = true;
+    raytracer::Raytracer tracer(scene_path, camera_options, render_options);
+    tracer.Render();
+    REQUIRE(tracer.GetReusedPixelCount() == 0);
+
+    for (int frame = 1; frame <= 3; ++frame) {
+        camera_options.look_from = {-0.5 + 0.01 * frame, 1.5, 0.98};
+        tracer.SetCamera(camera_options);
+        auto reused = tracer.Render();
+        REQUIRE(tracer.GetReusedPixelCount() > 250 * 180 / 2);
+
+        // Reused radiance comes from within a pixel of the surface point it is shown for.
+        auto reference = raytracer::Render(scene_path, camera_options, render_options);
+        double error = 0;
+        for (int y = 0; y < reference.Height(); ++y) {
+            for (int x = 0; x < reference.Width(); ++x) {
+                auto lhs = reused.GetPixel(y, x);
+                auto rhs = reference.GetPixel(y, x);
+                error += std::abs(lhs.r - rhs.r) + std::abs(lhs.g - rhs.g) +
+                         std::abs(lhs.b - rhs.b);
+            }
+        }
+        REQUIRE(error / (3 * 250 * 180) < 2);
+    }
+}
+
+TEST_CASE("Incremental look-dev edits", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    raytracer::Raytracer reference(scene_path, camera_options, render_options);
+    render_options.track_dependencies = true;
+    raytracer::Raytracer tracer(scene_path, camera_options, render_options);
+    tracer.Render();
+
+    scene::Material box = scene::Scene::BuildMaterialsFromPointers(
+        scene::ReadScene(scene_path).materials_pointers_).at("shortBox");
+    // Color edits trace only the pixels the box shadows, the ones seeing it are shaded from the
+    // recorded light reach.
+    box.diffuse_color = {0.2, 0.7, 0.3};
+    box.specular_exponent = 20;
+    auto edited = tracer.UpdateMaterial("shortBox", box);
+    auto shadowed_pixels = tracer.GetReshadedPixelCount();
+    REQUIRE(shadowed_pixels > 0);
+    RequireClose(edited, reference.UpdateMaterial("shortBox", box), 0);
+
+    // Reflections trace every pixel that depends on the box.
+    box.albedo = {0.7, 0.3, 0};
+    auto reflective = tracer.UpdateMaterial("shortBox", box);
+    REQUIRE(tracer.GetReshadedPixelCount() > shadowed_pixels);
+    REQUIRE(tracer.GetReshadedPixelCount() < 250 * 180 / 2);
+    RequireClose(reflective, reference.UpdateMaterial("shortBox", box), 0);
+
+    // Intensity edits rescale recorded contributions without tracing.
+    scene::Light light = {{0, 1.98, 0}, {0.5, 0.8, 1}};
+    auto relit = tracer.UpdateLight(0, light);
+    REQUIRE(tracer.GetReshadedPixelCount() == 0);
+    RequireClose(relit, reference.UpdateLight(0, light), 1);
+
+    // A moved camera leaves nothing to re-shade, the next edit renders the new view in full.
+    raytracer::CameraOptions moved(160, 120);
+    moved.look_from = {0.5, 1.2, 1.5};
+    moved.look_to = {0.0, 0.8, 0.0};
+    tracer.SetCamera(moved);
+    box.diffuse_color = {0.7, 0.2, 0.3};
+    auto moved_edit = tracer.UpdateMaterial("shortBox", box);
+    REQUIRE(moved_edit.Width() == 160);
+    raytracer::Raytracer fresh(scene_path, moved, render_options);
+    fresh.UpdateLight(0, light);
+    RequireClose(moved_edit, fresh.UpdateMaterial("shortBox", box), 0);
+}
+
+TEST_CASE("Region rendering", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    auto camera_options = CornellBoxCamera();
+    for (auto mode : {raytracer::RenderMode::kFull, raytracer::RenderMode::kDepth}) {
+        raytracer::RenderOptions render_options{4, mode};
+        raytracer::Raytracer full_tracer(scene_path, camera_options, render_options);
+        auto full = full_tracer.Render();
+
+        // Crops share the normalization of the full frame and match it exactly.
+        render_options.normalization = full_tracer.GetNormalization();
+        raytracer::Raytracer tracer(scene_path, camera_options, render_options);
+        raytracer::Region region{40, 100, 70, 30};
+        auto crop = tracer.RenderRegion(region);
+        REQUIRE(crop.Width() == 70);
+        REQUIRE(crop.Height() == 30);
+        for (int y = 0; y < crop.Height(); ++y) {
+            for (int x = 0; x < crop.Width(); ++x) {
+                REQUIRE(crop.GetPixel(y, x) == full.GetPixel(region.y + y, region.x + x));
+            }
+        }
+
+        raytracer::Image frame(250, 180);
+        for (int x = 0; x < 250; x += 125) {
+            for (int y = 0; y < 180; y += 90) {
+                tracer.RenderRegion({x, y, 125, 90}, frame);
+            }
+        }
+        for (int y = 0; y < full.Height(); ++y) {
+            for (int x = 0; x < full.Width(); ++x) {
+                REQUIRE(frame.GetPixel(y, x) == full.GetPixel(y, x));
+            }
+        }
+        REQUIRE_THROWS(tracer.RenderRegion({200, 0, 100, 10}));
+    }
+}
+
+TEST_CASE("Batch ray queries", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    auto scene = scene::ReadScene(dir_path + "scenes/classic_box/CornellBox-Original.obj");
+    auto names = scene.GetMaterialNames();
+
+    raytracer::RayBatch rays;
+    const geometry::Vector3D<> origin{0.0, 1.0, 0.5};
+    for (int i = 0; i < 40; ++i) {
+        for (int j = 0; j < 40; ++j) {
+            rays.Add(origin, {std::cos(i * 0.157) * std::sin(j * 0.0785),
+                              std::cos(j * 0.0785), std::sin(i * 0.157) * std::sin(j * 0.0785)});
+        }
+    }
+    auto hits = raytracer::IntersectRays(scene, rays);
+    REQUIRE(hits.distance.size() == rays.Size());
+    for (size_t k = 0; k < rays.Size(); ++k) {
+        geometry::Ray<> ray(origin, {rays.direction_x[k], rays.direction_y[k],
+                                     rays.direction_z[k]});
+        auto [intersection, material] = raytracer::FindClosestIntersectionAndMaterial(scene, ray);
+        if (!intersection) {
+            // Out through the open front of the box.
+            REQUIRE(hits.primitive[k] == -1);
+            REQUIRE(hits.material[k] == -1);
+            continue;
+        }
+        REQUIRE(hits.distance[k] == Approx(intersection->GetDistance()));
+        REQUIRE(scene.GetMaterial(names.at(hits.material[k])) == material);
+        REQUIRE(hits.normal_x[k] == Approx(intersection->GetNormal()[0]).margin(1e-9));
+        REQUIRE(hits.normal_y[k] == Approx(intersection->GetNormal()[1]).margin(1e-9));
+        REQUIRE(hits.normal_z[k] == Approx(intersection->GetNormal()[2]).margin(1e-9));
+    }
+
+    // Distance bounds around the top of the short block 0.4 below and the ceiling above.
+    raytracer::RayBatch bounded;
+    bounded.Add(origin, {0, -1, 0}, 0, 0.3);
+    bounded.Add(origin, {0, -2, 0}, 0, 0.5);
+    bounded.Add(origin, {0, 1, 0}, 0.1, 10);
+    bounded.Add(origin, {0, 1, 0}, 2, 1);
+    auto occluded = raytracer::OccludedRays(scene, bounded);
+    REQUIRE(occluded == std::vector<uint8_t>{0, 1, 1, 0});
+    auto bounded_hits = raytracer::IntersectRays(scene, bounded);
+    REQUIRE(bounded_hits.primitive[0] == -1);
+    REQUIRE(std::isinf(bounded_hits.distance[0]));
+    REQUIRE(bounded_hits.distance[1] == Approx(0.4));
+    REQUIRE(bounded_hits.instance[1] == -1);
+    REQUIRE(bounded_hits.distance[2] == Approx(0.99).margin(0.02));
+
+    // The first hit any accelerator finds, also through instances, agrees with the closest one.
+    for (const auto* path :
+         {"scenes/classic_box/CornellBox-Original.obj", "scenes/instancing/Instanced.obj"}) {
+        for (auto accelerator : {scene::AcceleratorType::kBvh, scene::AcceleratorType::kWideBvh,
+                                 scene::AcceleratorType::kGrid, scene::AcceleratorType::kKdTree,
+                                 scene::AcceleratorType::kBruteForce}) {
+            auto tested = scene::ReadScene(dir_path + path, accelerator);
+            auto closest = raytracer::IntersectRays(tested, rays);
+            for (size_t k = 0; k < rays.Size(); ++k) {
+                geometry::Ray<> ray(origin, {rays.direction_x[k], rays.direction_y[k],
+                                             rays.direction_z[k]});
+                REQUIRE(tested.Occluded(ray) == (closest.primitive[k] >= 0));
+                if (closest.primitive[k] >= 0) {
+                    REQUIRE(!tested.Occluded(ray, closest.distance[k] * 0.99));
+                    REQUIRE(tested.Occluded(ray, closest.distance[k] * 1.01));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Distributed rendering", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    SECTION("Local workers, one of them crashing") {
+        std::vector<raytracer::WorkerConnection> workers;
+        for (int i = 0; i < 3; ++i) {
+            workers.push_back(raytracer::SpawnLocalWorker());
+        }
+        auto crashing = workers[0].pid;
+        raytracer::DistributedOptions options;
+        options.on_tile = [&](size_t worker, const raytracer::Region&) {
+            if (worker == 0) {
+                kill(crashing, SIGKILL);
+            }
+        };
+        raytracer::DistributedReport report;
+        auto image = raytracer::RenderDistributed(scene_path, camera_options, render_options,
+                                                  workers, options, &report);
+        // Tiles travel as floats.
+        RequireClose(image, reference, 1);
+        REQUIRE(report.failed_workers == std::vector<bool>{true, false, false});
+        REQUIRE(report.reassigned_tiles > 0);
+        REQUIRE(report.tiles_per_worker[0] + report.tiles_per_worker[1] +
+                    report.tiles_per_worker[2] ==
+                8 * 6);
+    }
+
+    SECTION("Render options reach the workers") {
+        render_options.antialiasing = 3;
+        render_options.depth = 2;
+        raytracer::Raytracer local(scene_path, camera_options, render_options);
+        auto antialiased = local.Render();
+        REQUIRE(local.GetAntialiasedPixelCount() > 0);
+        std::vector<raytracer::WorkerConnection> workers = {raytracer::SpawnLocalWorker(),
+                                                            raytracer::SpawnLocalWorker()};
+        RequireClose(
+            raytracer::RenderDistributed(scene_path, camera_options, render_options, workers),
+            antialiased, 1);
+    }
+
+    SECTION("TCP workers") {
+        int listen_fd = raytracer::ListenTcp(0);
+        auto port = raytracer::GetListeningPort(listen_fd);
+        pid_t server = fork();
+        if (server == 0) {
+            raytracer::ServeTcpWorkers(listen_fd, 2);
+            _exit(0);
+        }
+        close(listen_fd);
+        std::vector<raytracer::WorkerConnection> workers = {
+            raytracer::ConnectTcpWorker("127.0.0.1", port),
+            raytracer::ConnectTcpWorker("127.0.0.1", port)};
+        RequireClose(
+            raytracer::RenderDistributed(scene_path, camera_options, render_options, workers),
+            reference, 1);
+        waitpid(server, nullptr, 0);
+    }
+
+    SECTION("Malformed and stalled workers") {
+        // Answers the first tile request with a payload built from the request.
+        auto spawn_faulty = [](std::function<std::vector<char>(const std::vector<char>&)> answer,
+                               uint64_t announced_size) {
+            int sockets[2];
+            REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(sockets[0]);
+                raytracer::Message message;
+                raytracer::ReceiveMessage(sockets[1], message, raytracer::kMaxRequestSize);
+                raytracer::ReceiveMessage(sockets[1], message, raytracer::kMaxRequestSize);
+                auto payload = answer(message.payload);
+                uint32_t type = static_cast<uint32_t>(raytracer::MessageType::kResult);
+                uint64_t size = announced_size ? announced_size : payload.size();
+                raytracer::SendAll(sockets[1], &type, sizeof(type));
+                raytracer::SendAll(sockets[1], &size, sizeof(size));
+                raytracer::SendAll(sockets[1], payload.data(), payload.size());
+                pause();
+                _exit(0);
+            }
+            close(sockets[1]);
+            return raytracer::WorkerConnection{sockets[0], pid};
+        };
+        auto truncated = [](const std::vector<char>& request) {
+            return std::vector<char>(request.begin(), request.begin() + 3);
+        };
+        auto region_only = [](const std::vector<char>& request) { return request; };
+
+        int stalled[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, stalled) == 0);
+        std::vector<raytracer::WorkerConnection> workers = {
+            spawn_faulty(truncated, 0), spawn_faulty(region_only, uint64_t{1} << 40),
+            {stalled[0], -1}, raytracer::SpawnLocalWorker()};
+        raytracer::DistributedOptions options;
+        options.tile_timeout_seconds = 0.5;
+        raytracer::DistributedReport report;
+        auto image = raytracer::RenderDistributed(scene_path, camera_options, render_options,
+                                                  workers, options, &report);
+        close(stalled[1]);
+        RequireClose(image, reference, 1);
+        REQUIRE(report.failed_workers == std::vector<bool>{true, true, true, false});
+        REQUIRE(report.tiles_per_worker[3] == 8 * 6);
+    }
+
+    SECTION("No workers left") {
+        REQUIRE_THROWS(
+            raytracer::RenderDistributed(scene_path, camera_options, render_options, {}));
+    }
+}
+
+TEST_CASE("Tile cache", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    auto root = std::filesystem::temp_directory_path() /
+                ("tile_cache_test_" + std::to_string(getpid()));
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    std::filesystem::copy(dir_path + "scenes/classic_box", root / "scene",
+                          std::filesystem::copy_options::recursive);
+    const auto scene_path = (root / "scene" / "CornellBox-Original.obj").string();
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    render_options.tile_size = 32;
+    const size_t tile_count = 8 * 6;
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    // Tiles are stored as floats, so the cached frames match within one.
+    SECTION("Hits, misses and invalidation") {
+        raytracer::TileCache cache(root / "cache");
+        RequireClose(raytracer::RenderCached(scene_path, camera_options, render_options, cache),
+                     reference, 1);
+        REQUIRE(cache.GetStats().misses == tile_count);
+        REQUIRE(cache.GetStats().hits == 0);
+        RequireClose(raytracer::RenderCached(scene_path, camera_options, render_options, cache),
+                     reference, 1);
+        REQUIRE(cache.GetStats().hits == tile_count);
+
+        // Keys depend on file contents, not on where the scene lives.
+        std::filesystem::copy(root / "scene", root / "moved",
+                              std::filesystem::copy_options::recursive);
+        raytracer::RenderCached((root / "moved" / "CornellBox-Original.obj").string(),
+                                camera_options, render_options, cache);
+        REQUIRE(cache.GetStats().hits == 2 * tile_count);
+
+        // Other options and edited material files are other keys.
+        render_options.depth = 2;
+        raytracer::RenderCached(scene_path, camera_options, render_options, cache);
+        REQUIRE(cache.GetStats().misses == 2 * tile_count);
+        render_options.antialiasing = 2;
+        raytracer::RenderCached(scene_path, camera_options, render_options, cache);
+        REQUIRE(cache.GetStats().misses == 3 * tile_count);
+        std::ofstream((root / "scene" / "CornellBox-Original.mtl").string(), std::ios::app)
+            << "\n# edited\n";
+        raytracer::RenderCached(scene_path, camera_options, render_options, cache);
+        REQUIRE(cache.GetStats().misses == 4 * tile_count);
+    }
+
+    SECTION("Eviction") {
+        raytracer::TileCache cache(root / "cache", 64 * 1024);
+        raytracer::RenderCached(scene_path, camera_options, render_options, cache);
+        REQUIRE(cache.GetStats().evicted > 0);
+        uintmax_t size = 0;
+        for (const auto& entry : std::filesystem::directory_iterator(root / "cache")) {
+            size += entry.file_size();
+        }
+        REQUIRE(size <= 64 * 1024);
+    }
+
+    SECTION("Shared by processes") {
+        std::vector<pid_t> children;
+        for (int i = 0; i < 2; ++i) {
+            pid_t child = fork();
+            if (child == 0) {
+                raytracer::TileCache cache(root / "cache");
+                raytracer::RenderCached(scene_path, camera_options, render_options, cache);
+                _exit(0);
+            }
+            children.push_back(child);
+        }
+        for (auto child : children) {
+            int status;
+            waitpid(child, &status, 0);
+            REQUIRE(WIFEXITED(status));
+            REQUIRE(WEXITSTATUS(status) == 0);
+        }
+        raytracer::TileCache cache(root / "cache");
+        RequireClose(raytracer::RenderCached(scene_path, camera_options, render_options, cache),
+                     reference, 1);
+        REQUIRE(cache.GetStats().hits == tile_count);
+    }
+
+    std::filesystem::remove_all(root);
+}
+
+TEST_CASE("Checkpoint and resume", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+    auto path = std::filesystem::temp_directory_path() /
+                ("checkpoint_test_" + std::to_string(getpid()) + ".chk");
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    render_options.tile_size = 32;
+    const size_t tile_count = 8 * 6;
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    // Preempted after 10 tiles.
+    std::atomic<bool> cancelled = false;
+    size_t traced = 0;
+    raytracer::CheckpointOptions options;
+    options.path = path;
+    options.interval_seconds = 0;
+    options.cancelled = &cancelled;
+    options.on_tile = [&](const raytracer::Region&) { cancelled = ++traced == 10; };
+    raytracer::CheckpointReport report;
+    REQUIRE_THROWS_AS(raytracer::RenderWithCheckpoints(scene_path, camera_options,
+                                                       render_options, options, &report),
+                      raytracer::RenderCancelled);
+    REQUIRE(report.traced_tiles == 10);
+    REQUIRE(std::filesystem::exists(path));
+
+    options.cancelled = nullptr;
+    options.on_tile = nullptr;
+    options.remove_when_done = false;
+    auto image = raytracer::RenderWithCheckpoints(scene_path, camera_options, render_options,
+                                                  options, &report);
+    REQUIRE(report.resumed_tiles == 10);
+    REQUIRE(report.traced_tiles == tile_count - 10);
+    // Tiles are kept as floats.
+    RequireClose(image, reference, 1);
+
+    // The complete checkpoint of other options is not resumed.
+    options.remove_when_done = true;
+    render_options.depth = 2;
+    raytracer::RenderWithCheckpoints(scene_path, camera_options, render_options, options,
+                                     &report);
+    REQUIRE(report.resumed_tiles == 0);
+    REQUIRE(report.traced_tiles == tile_count);
+    REQUIRE(!std::filesystem::exists(path));
+}
+
+TEST_CASE("Shared framebuffer", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+    const auto name = "/raytracer_test_" + std::to_string(getpid());
+
+    auto camera_options = CornellBoxCamera();
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    auto reference = raytracer::Render(scene_path, camera_options, render_options);
+
+    raytracer::SharedFramebuffer framebuffer(name, 250, 180, 32);
+    REQUIRE(framebuffer.Tiles().size() == 8 * 6);
+    pid_t viewer = fork();
+    if (viewer == 0) {
+        // Polls like an external viewer; the exit status tells whether the last snapshot is the
+        // complete frame.
+        int status = 1;
+        try {
+            raytracer::SharedFramebuffer view(name);
+            std::vector<float> values;
+            while (!view.IsFrameComplete()) {
+                view.Snapshot(values);
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            auto sequences = view.Snapshot(values);
+            bool published = std::all_of(sequences.begin(), sequences.end(),
+                                         [](uint64_t sequence) { return sequence == 2; });
+            bool same = std::equal(values.begin(), values.end(), view.Values());
+            status = published && same ? 0 : 1;
+        } catch (...) {
+        }
+        _exit(status);
+    }
+
+    auto image = raytracer::RenderToSharedFramebuffer(scene_path, camera_options,
+                                                      render_options, framebuffer);
+    int status;
+    waitpid(viewer, &status, 0);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+    REQUIRE(framebuffer.IsFrameComplete());
+    // The framebuffer holds floats.
+    RequireClose(image, reference, 1);
+
+    camera_options.screen_width = 200;
+    REQUIRE_THROWS(raytracer::RenderToSharedFramebuffer(scene_path, camera_options,
+                                                        render_options, framebuffer));
+    REQUIRE_THROWS(raytracer::SharedFramebuffer("/raytracer_test_missing"));
+}
+
+TEST_CASE("Render service", "[raytracer]") {
+    const std::string dir_path(PROGRAM_DIR);
+    const auto scene_path = dir_path + "scenes/classic_box/CornellBox-Original.obj";
+
+    SECTION("Scene cache") {
+        raytracer::SceneCache cache(size_t{1} << 30);
+        bool hit = true;
+        auto scene = cache.Get(scene_path, scene::AcceleratorType::kBvh, &hit);
+        REQUIRE(!hit);
+        REQUIRE(cache.Get(scene_path, scene::AcceleratorType::kBvh, &hit) == scene);
+        REQUIRE(hit);
+        cache.Get(scene_path, scene::AcceleratorType::kGrid);
+        REQUIRE(cache.Size() == 2);
+
+        // Over budget the least recently used scene goes, holders keep theirs.
+        raytracer::SceneCache small(1);
+        auto evicted = small.Get(scene_path, scene::AcceleratorType::kBvh);
+        small.Get(scene_path, scene::AcceleratorType::kGrid);
+        REQUIRE(small.Size() == 1);
+        small.Get(scene_path, scene::AcceleratorType::kBvh, &hit);
+        REQUIRE(!hit);
+        REQUIRE(evicted->GetObjects().size() > 0);
+    }
+
+    SECTION("Priorities, cancellation and warm scenes") {
+        std::mutex mutex;
+        std::condition_variable ended;
+        std::vector<raytracer::JobResult> results;
+        auto collect = [&](const raytracer::JobResult& result) {
+            std::lock_guard lock(mutex);
+            results.push_back(result);
+            ended.notify_all();
+        };
+        raytracer::RenderJob job;
+        job.scene = scene_path;
+        job.camera = raytracer::CameraOptions(250, 180);
+        job.camera.look_from = {-0.5, 1.5, 0.98};
+        job.camera.look_to = {0.0, 1.0, 0.0};
+
+        raytracer::RenderService service(1);
+        auto submit = [&](uint64_t id, int priority, int width, int height) {
+            auto copy = job;
+            copy.id = id;
+            copy.priority = priority;
+            copy.camera.screen_width = width;
+            copy.camera.screen_height = height;
+            return service.Submit(copy, collect);
+        };
+        submit(1, 0, 250, 180);
+        submit(2, 0, 40, 30);
+        REQUIRE(!submit(2, 0, 40, 30));
+        submit(3, 5, 250, 180);
+        submit(4, 9, 40, 30);
+        REQUIRE(service.Cancel(4));
+        REQUIRE(!service.Cancel(42));
+        {
+            std::unique_lock lock(mutex);
+            ended.wait(lock, [&] { return results.size() == 4; });
+        }
+
+        // The cancelled job ends right away, higher priorities and older jobs run first, only
+        // the first job loads the scene.
+        REQUIRE(results[0].id == 4);
+        REQUIRE(results[0].status == raytracer::JobStatus::kCancelled);
+        REQUIRE(results[3].id == 2);
+        REQUIRE(!results[1].scene_cached);
+        REQUIRE(results[2].scene_cached);
+        REQUIRE(results[3].scene_cached);
+
+        auto reference = raytracer::Render(scene_path, job.camera, job.render);
+        const auto& prioritized = results[1].id == 3 ? results[1] : results[2];
+        REQUIRE(prioritized.status == raytracer::JobStatus::kDone);
+        for (int y = 0; y < reference.Height(); ++y) {
+            for (int x = 0; x < reference.Width(); ++x) {
+                REQUIRE(prioritized.image->GetPixel(y, x) == reference.GetPixel(y, x));
+            }
+        }
+
+        // Running jobs stop at the next tile.
+        submit(5, 0, 2000, 2000);
+        REQUIRE(service.Cancel(5));
+        std::unique_lock lock(mutex);
+        ended.wait(lock, [&] { return results.size() == 5; });
+        REQUIRE(results[4].status == raytracer::JobStatus::kCancelled);
+    }
+
+    SECTION("Line protocol") {
+        int sockets[2];
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+        raytracer::RenderService service(2);
+        std::thread server([&] { service.Serve(sockets[1], sockets[1]); });
+        std::string requests = "render 7 " + scene_path + " 40 30 mode=depth\n" +
+                               "render 8 " + scene_path + " 40 30 priority=2 from=0,1,3\n" +
+                               "render 9 " + scene_path + " 40 30 mode=sepia\n" +
+                               "render 10 " + scene_path + " 2000 2000\n" +
+                               "render 10 " + scene_path + " 40 30\n" + "cancel 10\nquit\n";
+        REQUIRE(write(sockets[0], requests.data(), requests.size()) ==
+                static_cast<ssize_t>(requests.size()));
+        server.join();
+        close(sockets[1]);
+
+        std::string replies;
+        char chunk[256];
+        for (ssize_t size; (size = read(sockets[0], chunk, sizeof(chunk))) > 0;) {
+            replies.append(chunk, size);
+        }
+        close(sockets[0]);
+        REQUIRE(replies.find("queued 7\n") != std::string::npos);
+        REQUIRE(replies.find("done 7 ") != std::string::npos);
+        REQUIRE(replies.find("done 8 ") != std::string::npos);
+        REQUIRE(replies.find("error bad mode sepia\n") != std::string::npos);
+        REQUIRE(replies.find("error duplicate id 10\n") != std::string::npos);
+        REQUIRE(replies.find("cancelled 10\n") != std::string::npos);
+    }
+}
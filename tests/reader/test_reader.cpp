@@ -5,6 +5,7 @@
 
 #include <string>
 
+#include "scene/generator.h"
 #include "scene/reader.cpp"
 
 #ifndef PROGRAM_DIR
@@ -48,3 +49,171 @@ TEST_CASE("Objects read correctly") {
         REQUIRE(objects.size() == 36);
     }
 }
+
+TEST_CASE("Instances read correctly") {
+    const std::string dir_path(PROGRAM_DIR);
+    auto scene = scene::ReadScene(dir_path + "../raytracer/scenes/instancing/Instanced.obj");
+
+    REQUIRE(scene.GetObjects().size() == 2);
+    REQUIRE(scene.GetMeshes().size() == 1);
+    REQUIRE(scene.GetMeshes()[0].objects.size() == 4);
+    REQUIRE(scene.GetInstances().size() == 3);
+
+    SECTION("Moving an instance") {
+        geometry::Ray<> ray({0, 1, 10}, {0, 0, -1});
+        REQUIRE(!scene.Intersect(ray));
+
+        scene.SetInstanceTransform(0, geometry::Transform<>::Translation({0, 0, 5}));
+        auto hit = scene.Intersect(ray);
+        REQUIRE(hit);
+        REQUIRE(hit->instance == 0);
+        REQUIRE(hit->distance == Approx(5));
+        REQUIRE(scene.GetInstances()[0].bounds.GetMin()[2] == Approx(5));
+    }
+}
+
+TEST_CASE("Vertex updates refit the hierarchy") {
+    const std::string dir_path(PROGRAM_DIR);
+    auto scene = scene::ReadScene(dir_path + "classic_box/CornellBox-Original.obj");
+    auto vertices = scene::ReadVertices(dir_path + "classic_box/CornellBox-Original.obj");
+    REQUIRE(vertices.size() == scene.GetWorld().vertex_count);
+
+    auto closest_brute_force = [&](const geometry::Ray<>& ray) {
+        std::optional<double> closest;
+        for (const auto& object : scene.GetObjects()) {
+            auto intersection = GetIntersection(ray, object.polygon);
+            if (intersection && (!closest || intersection->GetDistance() < *closest)) {
+                closest = intersection->GetDistance();
+            }
+        }
+        return closest;
+    };
+    auto check_rays = [&](const geometry::Vector3D<>& origin) {
+        for (double x = -1; x <= 1; x += 0.25) {
+            for (double y = -1; y <= 1; y += 0.25) {
+                geometry::Ray<> ray(origin, geometry::Vector3D<>{x, y, -1}.Normalize());
+                auto expected = closest_brute_force(ray);
+                auto hit = scene.Intersect(ray);
+                REQUIRE(hit.has_value() == expected.has_value());
+                if (hit) {
+                    REQUIRE(hit->distance == Approx(*expected));
+                }
+            }
+        }
+    };
+
+    SECTION("Translation keeps the topology good") {
+        for (auto& vertex : vertices) {
+            vertex += geometry::Vector3D<>{0, 5, 0};
+        }
+        REQUIRE(!scene.UpdateVertices(vertices));
+        REQUIRE(scene.GetWorld().Bounds().GetMin()[1] == Approx(5));
+        check_rays({0, 6, 3});
+    }
+
+    SECTION("Scrambled vertices trigger a rebuild") {
+        std::reverse(vertices.begin(), vertices.end());
+        for (size_t i = 0; i < vertices.size(); i += 2) {
+            vertices[i] *= 3;
+        }
+        REQUIRE(scene.UpdateVertices(vertices, 1.0));
+        check_rays({0, 1, 3});
+    }
+}
+
+TEST_CASE("Meshes are preprocessed") {
+    std::istringstream input(
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 0 0\nv 2 0 0\n"
+        "f 1 2 3\nf 1 4 2\nf 1 2 5\nf 5 1 3\nf 4 2 3 1\n");
+    MaterialPointers materials;
+    std::vector<std::unique_ptr<geometry::Vector3D<>>> normals;
+    auto mesh = scene::ConstructMesh(input, ".", materials, normals);
+    const auto& stats = mesh.preprocess_stats;
+
+    // Duplicate and collinear points leave the first and the last two triangles.
+    REQUIRE(stats.triangles_before == 6);
+    REQUIRE(stats.triangles_after == 3);
+    REQUIRE(stats.vertices_before == 5);
+    REQUIRE(stats.vertices_after == 4);
+    REQUIRE(mesh.objects.size() == 3);
+    REQUIRE(mesh.vertex_indices.size() == 3);
+    REQUIRE(mesh.degenerate_objects.size() == 3);
+
+    mesh.UpdateVertices({{0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 0, 1}, {2, 0, 1}});
+    mesh.Build();
+    auto hit = mesh.Intersect({{0.2, 0.2, 5}, {0, 0, -1}}, 10);
+    REQUIRE(hit);
+    REQUIRE(hit->first == Approx(4));
+}
+
+TEST_CASE("Vertex updates separate coincident vertices") {
+    // Vertices 2 and 4 coincide and so do the first two triangles, the third one is flat until
+    // vertex 5 leaves the line.
+    std::istringstream input(
+        "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 0 0\nv 2 0 0\nf 1 2 3\nf 4 3 1\nf 1 2 5\n");
+    MaterialPointers materials;
+    std::vector<std::unique_ptr<geometry::Vector3D<>>> normals;
+    auto mesh = scene::ConstructMesh(input, ".", materials, normals);
+    REQUIRE(mesh.objects.size() == 2);
+    REQUIRE(mesh.welded_vertices.size() == 4);
+    mesh.Build();
+
+    std::vector<geometry::Vector3D<>> vertices = {
+        {0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 0, -1}, {2, 0, 1}};
+    mesh.UpdateVertices(vertices);
+    REQUIRE(mesh.welded_vertices.size() == 5);
+    REQUIRE(mesh.vertex_remap[1] != mesh.vertex_remap[3]);
+    REQUIRE(mesh.Refit(1.5));
+    REQUIRE(mesh.objects.size() == 3);
+    REQUIRE(mesh.degenerate_objects.empty());
+    for (size_t i = 0; i < mesh.objects.size(); ++i) {
+        for (int k = 0; k < 3; ++k) {
+            auto offset = mesh.objects[i].polygon.GetVertex(k) -
+                          vertices[mesh.vertex_indices[i][k]];
+            REQUIRE(Length(offset) == 0);
+        }
+    }
+    auto hit = mesh.Intersect({{1, 5, 0.2}, {0, -1, 0}}, 10);
+    REQUIRE(hit);
+    REQUIRE(hit->first == Approx(5));
+
+    // Collapsing the third triangle again drops it.
+    vertices[4] = {2, 0, 0};
+    mesh.UpdateVertices(vertices);
+    REQUIRE(mesh.Refit(1.5));
+    REQUIRE(mesh.objects.size() == 2);
+    REQUIRE(!mesh.Intersect({{1, 5, 0.2}, {0, -1, 0}}, 10));
+}
+
+TEST_CASE("Synthetic scenes read correctly") {
+    auto path = std::filesystem::temp_directory_path() / "synthetic_scene.obj";
+    scene::SyntheticSceneOptions options{2000, 30, 3, 0.25, scene::SceneDistribution::kLongThin, 7};
+    scene::WriteSyntheticScene(path, options);
+    auto scene = scene::ReadScene(path.string());
+
+    REQUIRE(scene.GetObjects().size() == 2000);
+    REQUIRE(scene.GetSphereObjects().size() == 30);
+    REQUIRE(scene.GetLights().size() == 3);
+    size_t glass = 0;
+    auto extent = scene::GetSyntheticSceneExtent(options.distribution);
+    for (const auto& object : scene.GetObjects()) {
+        glass += object.material->name == "glass";
+        for (int k = 0; k < 3; ++k) {
+            REQUIRE(std::abs(object.polygon.GetVertex(0)[k]) < extent[k] * 1.5);
+        }
+    }
+    REQUIRE(glass > 400);
+    REQUIRE(glass < 600);
+
+    SECTION("Same seed, same scene") {
+        auto copy = std::filesystem::temp_directory_path() / "synthetic_scene_copy.obj";
+        scene::WriteSyntheticScene(copy, options);
+        std::ifstream lhs(path);
+        std::ifstream rhs(copy);
+        std::string lhs_text((std::istreambuf_iterator<char>(lhs)), {});
+        std::string rhs_text((std::istreambuf_iterator<char>(rhs)), {});
+        // Only the mtllib lines differ.
+        REQUIRE(lhs_text.substr(lhs_text.find("usemtl")) ==
+                rhs_text.substr(rhs_text.find("usemtl")));
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_MAIN
+#endif
+#include <catch2/catch.hpp>
+
+#ifndef SCENES_DIR
+#define SCENES_DIR "./"
+#endif
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+// Built with RAYTRACER_STATS, unlike the other tests, for the hot path counters.
+#include "raytracer/raytracer.cpp"
+#include "raytracer/ray_query.h"
+
+#include "raytracer/camera_options.h"
+#include "raytracer/render_options.h"
+
+TEST_CASE("Render statistics", "[raytracer]") {
+    const std::string dir_path(SCENES_DIR);
+    raytracer::CameraOptions camera_options(40, 30);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+
+    // Tiles traced on several threads all count.
+    raytracer::RenderStats stats;
+    raytracer::SetThreadCount(4);
+    auto image = raytracer::Render(dir_path + "classic_box/CornellBox-Original.obj",
+                                   camera_options, render_options, stats);
+    raytracer::SetThreadCount(0);
+    REQUIRE(raytracer::kStatsEnabled);
+    REQUIRE(stats.camera_rays == 40 * 30);
+    // Every camera ray hits the box, which has three lights.
+    REQUIRE(stats.depth_histogram[0] == stats.camera_rays);
+    REQUIRE(stats.shadow_rays >= 3 * stats.camera_rays);
+    REQUIRE(stats.hits >= stats.camera_rays);
+    REQUIRE(stats.triangle_tests > stats.hits);
+    uint64_t shaded = 0;
+    for (auto count : stats.depth_histogram) {
+        shaded += count;
+    }
+    REQUIRE(shaded + stats.sky_misses <=
+            stats.camera_rays + stats.reflected_rays + stats.refracted_rays);
+    REQUIRE(stats.load_seconds > 0);
+    REQUIRE(stats.build_seconds > 0);
+    REQUIRE(stats.trace_seconds > 0);
+    REQUIRE(stats.tone_map_seconds > 0);
+    REQUIRE(stats.encode_seconds == 0);
+    image.Write(std::filesystem::temp_directory_path() / "render_statistics.png", &stats);
+    REQUIRE(stats.encode_seconds > 0);
+}
+
+TEST_CASE("Cost heatmap", "[raytracer]") {
+    const std::string dir_path(SCENES_DIR);
+    raytracer::CameraOptions camera_options(40, 30);
+    camera_options.look_from = {-0.5, 1.5, 0.98};
+    camera_options.look_to = {0.0, 1.0, 0.0};
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kCost};
+    render_options.cost_metric = raytracer::CostMetric::kIntersectionTests;
+    render_options.color_map = raytracer::ColorMap::kGrayscale;
+
+    raytracer::Raytracer tracer(dir_path + "classic_box/CornellBox-Original.obj",
+                                camera_options, render_options);
+    auto image = tracer.Render();
+    const auto& costs = tracer.GetCostValues();
+    REQUIRE(costs.size() == 40);
+    double max_tests = 0;
+    for (const auto& column : costs) {
+        for (const auto& cost : column) {
+            // The camera ray and a shadow ray to each of the three lights at least.
+            REQUIRE(cost[0] > 0);
+            REQUIRE(cost[1] >= 4);
+            REQUIRE(cost[2] > 0);
+            max_tests = std::max(max_tests, cost[0]);
+        }
+    }
+    REQUIRE(tracer.GetNormalization() == max_tests);
+    int brightest = 0;
+    for (int y = 0; y < image.Height(); ++y) {
+        for (int x = 0; x < image.Width(); ++x) {
+            brightest = std::max(brightest, image.GetPixel(y, x).r);
+        }
+    }
+    REQUIRE(brightest == 255);
+
+    std::ostringstream csv;
+    raytracer::WriteCostValues(csv, costs);
+    auto lines = csv.str();
+    REQUIRE(lines.rfind("x,y,intersection_tests,rays,nanoseconds\n0,0,", 0) == 0);
+    REQUIRE(std::count(lines.begin(), lines.end(), '\n') == 40 * 30 + 1);
+
+    REQUIRE(raytracer::ApplyColorMap(raytracer::ColorMap::kHeat, 0) == raytracer::RGB{0, 0, 0});
+    REQUIRE(raytracer::ApplyColorMap(raytracer::ColorMap::kHeat, 2) ==
+            raytracer::RGB{255, 255, 255});
+}
+
+TEST_CASE("Batch query statistics", "[raytracer]") {
+    const std::string dir_path(SCENES_DIR);
+    auto scene = scene::ReadScene(dir_path + "classic_box/CornellBox-Original.obj");
+
+    // Several chunks on several worker threads, whose counts add up.
+    raytracer::SetThreadCount(4);
+    raytracer::RayBatch rays;
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 100; ++j) {
+            rays.Add({0.0, 1.0, 0.5}, {std::cos(i * 0.0628) * std::sin(j * 0.0314),
+                                       std::cos(j * 0.0314),
+                                       std::sin(i * 0.0628) * std::sin(j * 0.0314)});
+        }
+    }
+    raytracer::ThreadStats() = {};
+    auto hits = raytracer::IntersectRays(scene, rays);
+    raytracer::SetThreadCount(0);
+    auto hit_count = std::count_if(hits.primitive.begin(), hits.primitive.end(),
+                                   [](auto primitive) { return primitive >= 0; });
+    REQUIRE(hit_count > 0);
+    REQUIRE(raytracer::ThreadStats().triangle_tests >= rays.Size());
+
+    raytracer::RenderStats stats;
+    stats.TakeCounters(raytracer::ThreadStats());
+    REQUIRE(stats.hits == static_cast<uint64_t>(hit_count));
+}
@@ -0,0 +1,95 @@
+// Rays per second and frame times of the bundled scenes plus microbenchmarks of the shading
+// kernels, written as JSON for tracking across releases.
+//
+//     benchmark [--quick] [--output <file.json>] [--trace <timeline.json>]
+//
+// --trace records the spans of the scene renders as Chrome trace events.
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "raytracer/benchmark.h"
+#include "raytracer/timeline.h"
+
+#ifndef SOURCE_DIR
+#define SOURCE_DIR "./"
+#endif
+
+namespace {
+struct BenchmarkedScene {
+    std::string name;
+    std::string path;  // relative to the source tree
+    raytracer::CameraOptions camera_options;
+};
+
+raytracer::CameraOptions Camera(int size, std::array<double, 3> look_from,
+                                std::array<double, 3> look_to, double fov = M_PI / 2) {
+    return raytracer::CameraOptions(size, size, fov, look_from, look_to);
+}
+
+std::vector<BenchmarkedScene> GetScenes(int size) {
+    return {
+        {"classic_box", "tests/raytracer/scenes/classic_box/CornellBox-Original.obj",
+         Camera(size, {-0.5, 1.5, 0.98}, {0.0, 1.0, 0.0})},
+        {"violin_case", "tests/raytracer/scenes/violin_case/ViolinCase.obj",
+         Camera(size, {1.5, 1.5, 1.5}, {0.5, 0, 0})},
+        {"skybox", "tests/raytracer/scenes/skybox/Skybox.obj",
+         Camera(size, {0, 0, 0}, {1, 1, 1}, 2.5)},
+        {"trumpet", "examples/trumpet/Trumpet.obj",
+         Camera(size, {745, -334, 29}, {45, -434, 29})},
+        {"ysda", "examples/ysda/StainedGlass.obj", Camera(size, {-2, 4, -12}, {0, -2, -4})},
+        {"dgap", "examples/dgap/StainedGlass.obj", Camera(size, {-2, 4, -12}, {0, -2, -4})},
+    };
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool quick = false;
+    std::string output;
+    std::string trace;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--quick") {
+            quick = true;
+        } else if (argument == "--output" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (argument == "--trace" && i + 1 < argc) {
+            trace = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--quick] [--output <file.json>] [--trace <timeline.json>]\n";
+            return 2;
+        }
+    }
+
+    raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+    std::vector<raytracer::SceneBenchmark> scenes;
+    auto& timeline = raytracer::Timeline::Instance();
+    if (!trace.empty()) {
+        timeline.Start();
+    }
+    for (const auto& scene : GetScenes(quick ? 128 : 500)) {
+        std::cerr << scene.name << "\n";
+        scenes.push_back(raytracer::BenchmarkScene(scene.name, SOURCE_DIR + scene.path,
+                                                   scene.camera_options, render_options));
+    }
+    if (!trace.empty()) {
+        timeline.Stop();
+        std::ofstream file(trace);
+        timeline.WriteChromeTrace(file);
+        if (!file) {
+            std::cerr << "Can't write " << trace << "\n";
+            return 1;
+        }
+    }
+    auto microbenchmarks = raytracer::RunMicroBenchmarks(quick ? 1 << 18 : 1 << 22);
+
+    if (output.empty()) {
+        raytracer::WriteBenchmarkJson(std::cout, scenes, microbenchmarks);
+        return 0;
+    }
+    std::ofstream file(output);
+    raytracer::WriteBenchmarkJson(file, scenes, microbenchmarks);
+    return file ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+// Polls the shared framebuffer of a running render and writes a PNG whenever tiles changed,
+// until the frame is complete.
+//
+//     framebuffer_reader <segment name> <output prefix> [poll interval ms]
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raytracer/shared_framebuffer.h"
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " <segment name> <output prefix> [interval ms]\n";
+        return 2;
+    }
+    const std::string name = argv[1];
+    const std::string prefix = argv[2];
+    std::chrono::milliseconds interval(argc > 3 ? std::stoi(argv[3]) : 100);
+
+    try {
+        raytracer::SharedFramebuffer framebuffer(name);
+        std::vector<uint64_t> shown(framebuffer.Tiles().size(), 0);
+        std::vector<float> values;
+        for (int snapshot = 0;;) {
+            // Read before the snapshot, a frame completed during it is dumped on the next poll.
+            bool complete = framebuffer.IsFrameComplete();
+            auto sequences = framebuffer.Snapshot(values);
+            if (sequences != shown) {
+                char suffix[16];
+                std::snprintf(suffix, sizeof(suffix), "_%04d.png", snapshot++);
+                raytracer::BuildImageFromFloats(values, framebuffer.Width(), framebuffer.Height(),
+                                                framebuffer.Mode(), 0)
+                    .Write(prefix + suffix);
+                shown = std::move(sequences);
+            }
+            if (complete) {
+                std::cout << snapshot << " snapshots\n";
+                return 0;
+            }
+            std::this_thread::sleep_for(interval);
+        }
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << "\n";
+        return 1;
+    }
+}
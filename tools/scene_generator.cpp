@@ -0,0 +1,143 @@
+// Writes synthetic OBJ/MTL scenes of a given size, or reports how loading time, memory and ray
+// throughput scale with the triangle count of such scenes.
+//
+//     scene_generator <output.obj> [options]
+//     scene_generator --report [--max-triangles <n>] [--size <pixels>] [--output <file.json>]
+//                     [options]
+//
+// Options: --triangles <n> --spheres <n> --lights <n> --transparent <ratio>
+//          --distribution uniform|clustered|thin --seed <n>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "scene/generator.h"
+#include "raytracer/benchmark.h"
+
+namespace {
+scene::SceneDistribution ParseDistribution(const std::string& name) {
+    if (name == "uniform") {
+        return scene::SceneDistribution::kUniform;
+    }
+    if (name == "clustered") {
+        return scene::SceneDistribution::kClustered;
+    }
+    if (name == "thin") {
+        return scene::SceneDistribution::kLongThin;
+    }
+    throw std::runtime_error("Unknown distribution " + name);
+}
+
+// Looks at the origin from above and in front, or down the length of a long thin scene, so that
+// most camera rays meet the scene.
+raytracer::CameraOptions SyntheticCamera(scene::SceneDistribution distribution, int size) {
+    auto extent = scene::GetSyntheticSceneExtent(distribution);
+    raytracer::CameraOptions camera_options(size, size);
+    if (distribution == scene::SceneDistribution::kLongThin) {
+        camera_options.fov = M_PI / 4;
+        camera_options.look_from = {-extent[0] - 2 * extent[1], 0.5 * extent[1], 0.5 * extent[2]};
+    } else {
+        camera_options.look_from = geometry::Vector3D<>{0.4, 0.6, 1.4} * extent;
+    }
+    camera_options.look_to = {0, 0, 0};
+    return camera_options;
+}
+
+int Usage(const char* program) {
+    std::cerr << "Usage: " << program << " <output.obj> [options]\n       " << program
+              << " --report [--max-triangles <n>] [--size <pixels>] [--output <file.json>]"
+                 " [options]\nOptions: --triangles <n> --spheres <n> --lights <n>"
+                 " --transparent <ratio> --distribution uniform|clustered|thin --seed <n>\n";
+    return 2;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    scene::SyntheticSceneOptions options;
+    std::string output;
+    bool report = false;
+    size_t max_triangles = 1000000;
+    int size = 128;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string argument = argv[i];
+            bool has_value = i + 1 < argc;
+            if (argument == "--report") {
+                report = true;
+            } else if (argument == "--triangles" && has_value) {
+                options.triangles = std::stoull(argv[++i]);
+            } else if (argument == "--spheres" && has_value) {
+                options.spheres = std::stoull(argv[++i]);
+            } else if (argument == "--lights" && has_value) {
+                options.lights = std::stoull(argv[++i]);
+            } else if (argument == "--transparent" && has_value) {
+                options.transparent_ratio = std::stod(argv[++i]);
+            } else if (argument == "--distribution" && has_value) {
+                options.distribution = ParseDistribution(argv[++i]);
+            } else if (argument == "--seed" && has_value) {
+                options.seed = std::stoull(argv[++i]);
+            } else if (argument == "--max-triangles" && has_value) {
+                max_triangles = std::stoull(argv[++i]);
+            } else if (argument == "--size" && has_value) {
+                size = std::stoi(argv[++i]);
+            } else if (argument == "--output" && has_value) {
+                output = argv[++i];
+            } else if (argument[0] != '-' && output.empty()) {
+                output = argument;
+            } else {
+                return Usage(argv[0]);
+            }
+        }
+        if (!report) {
+            if (output.empty()) {
+                return Usage(argv[0]);
+            }
+            scene::WriteSyntheticScene(output, options);
+            return 0;
+        }
+
+        // Scenes ten times larger each, rendered with the same camera and options.
+        auto directory = std::filesystem::temp_directory_path() /
+                         ("scene_generator_" + std::to_string(getpid()));
+        std::filesystem::create_directories(directory);
+        raytracer::RenderOptions render_options{4, raytracer::RenderMode::kFull};
+        std::vector<raytracer::SceneBenchmark> scenes;
+        std::printf("%12s %10s %12s %14s %14s %10s\n", "triangles", "load s", "memory MiB",
+                    "primary ray/s", "shadow ray/s", "frame s");
+        for (size_t triangles = 1000; triangles <= max_triangles; triangles *= 10) {
+            options.triangles = triangles;
+            auto path = directory / ("scene_" + std::to_string(triangles) + ".obj");
+            scene::WriteSyntheticScene(path, options);
+            scenes.push_back(raytracer::BenchmarkScene(
+                std::to_string(triangles), path, SyntheticCamera(options.distribution, size),
+                render_options));
+            std::filesystem::remove(path);
+            const auto& scene = scenes.back();
+            if (!scene.error.empty()) {
+                std::cerr << scene.error << "\n";
+                continue;
+            }
+            std::printf("%12zu %10.3f %12.1f %14.0f %14.0f %10.3f\n", triangles,
+                        scene.load_seconds, scene.memory_bytes / 1048576.0,
+                        scene.primary_rays_per_second, scene.shadow_rays_per_second,
+                        scene.frame_seconds);
+            std::fflush(stdout);
+        }
+        std::filesystem::remove_all(directory);
+        if (!output.empty()) {
+            std::ofstream file(output);
+            raytracer::WriteBenchmarkJson(file, scenes, {});
+            return file ? 0 : 1;
+        }
+        return 0;
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << "\n";
+        return 1;
+    }
+}